@@ -0,0 +1,71 @@
+# Compares the default allocator with the pool allocator on a workload of many
+# small statements, which is where SQLite makes most of its short lived
+# allocations. The workload runs on one connection, then on one connection per
+# scheduler at once, where the allocator's locks are contended. The allocator
+# is picked when the NIF loads, so run it once per mode:
+#
+#     mix run bench/allocator.exs --output bench/results/default.csv
+#     EXQLITE_ALLOCATOR=pool mix run bench/allocator.exs --output bench/results/pool.csv
+#     mix run bench/compare.exs bench/results/default.csv bench/results/pool.csv
+
+Code.require_file("bench_helper.exs", __DIR__)
+
+alias Exqlite.Sqlite3
+
+run = fn rows ->
+  {:ok, db} = Sqlite3.open(":memory:")
+  :ok = Sqlite3.execute(db, "create table t (id integer primary key, name text)")
+
+  {:ok, insert} = Sqlite3.prepare(db, "insert into t (id, name) values (?, ?)")
+  {:ok, select} = Sqlite3.prepare(db, "select name from t where id = ?")
+
+  :ok = Sqlite3.execute(db, "begin")
+
+  for id <- 1..rows do
+    :ok = Sqlite3.bind(insert, [id, "name #{id}"])
+    :done = Sqlite3.step(db, insert)
+  end
+
+  :ok = Sqlite3.execute(db, "commit")
+
+  for id <- 1..rows do
+    :ok = Sqlite3.bind(select, [id])
+    {:row, _row} = Sqlite3.step(db, select)
+  end
+
+  sql = "select count(*) from t where name like 'name 1%'"
+
+  for _ <- 1..1_000 do
+    {:ok, statement} = Sqlite3.prepare(db, sql)
+    {:ok, _rows} = Sqlite3.fetch_all(db, statement)
+    :ok = Sqlite3.release(db, statement)
+  end
+
+  Sqlite3.close(db)
+end
+
+opts = Exqlite.Bench.options(System.argv())
+schedulers = System.schedulers_online()
+
+run_concurrently = fn ->
+  1..schedulers
+  |> Task.async_stream(fn _ -> run.(div(20_000, schedulers)) end, timeout: :infinity)
+  |> Stream.run()
+end
+
+jobs = [
+  %{name: "mixed_small_statements", run: fn _ -> run.(20_000) end},
+  %{name: "mixed_small_statements_x#{schedulers}", run: fn _ -> run_concurrently.() end}
+]
+
+Exqlite.Bench.run("allocator", jobs, opts)
+
+{:ok, stats} = Sqlite3.allocator_stats()
+IO.puts("allocator: #{stats.allocator}")
+
+for class <- stats.classes do
+  IO.puts(
+    "  #{class.size} bytes: #{class.allocations} allocations, " <>
+      "#{class.reused} reused, high water #{class.high_water}"
+  )
+end
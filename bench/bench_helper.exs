@@ -0,0 +1,162 @@
+defmodule Exqlite.Bench do
+  @moduledoc false
+
+  # A small harness for the scripts in bench/, kept dependency free so they run
+  # with a plain `mix run`.
+  #
+  # A job is a map with a `:name`, a `:run` function and optionally `:setup`,
+  # `:before_each` and `:teardown` functions. `:setup` returns the state handed
+  # to the others. `:before_each` runs outside the measured time, its result is
+  # passed to `:run` instead of the state.
+  #
+  # Every job is run for `:warmup` seconds, then measured for `:time` seconds.
+  # The results are printed and appended as CSV to `:output`, one line per job,
+  # so that runs can be compared with bench/compare.exs.
+
+  @columns ~w(suite job database samples min_us median_us p99_us mean_us ips)a
+  @switches [time: :float, warmup: :float, output: :string, only: :string]
+
+  # Parses the options every script accepts, plus the script specific
+  # `switches`, which are added to the returned map when given.
+  def options(argv, switches \\ []) do
+    {opts, _args, _invalid} = OptionParser.parse(argv, strict: @switches ++ switches)
+
+    timestamp =
+      DateTime.utc_now()
+      |> DateTime.truncate(:second)
+      |> DateTime.to_iso8601(:basic)
+
+    %{
+      time: Keyword.get(opts, :time, 2.0),
+      warmup: Keyword.get(opts, :warmup, 0.5),
+      output: Keyword.get(opts, :output, "bench/results/#{timestamp}.csv"),
+      only: Keyword.get(opts, :only)
+    }
+    |> Map.merge(Map.new(Keyword.take(opts, Keyword.keys(switches))))
+  end
+
+  # Splits a comma separated option into a list, converting every entry.
+  def list_option(opts, key, default, convert) do
+    case Map.fetch(opts, key) do
+      {:ok, value} -> value |> String.split(",", trim: true) |> Enum.map(convert)
+      :error -> default
+    end
+  end
+
+  # The sample at `percentile`, between 0 and 100, of a sorted list.
+  def percentile([], _percentile), do: 0
+
+  def percentile(sorted, percentile) do
+    count = length(sorted)
+    Enum.at(sorted, min(count - 1, trunc(count * percentile / 100)))
+  end
+
+  # Runs `fun` once for an in-memory and once for an on-disk database, passing
+  # the database path, and tags the jobs it returns with the database kind and
+  # path.
+  def databases(fun) do
+    for {kind, path} <- [memory: ":memory:", disk: disk_path()],
+        job <- fun.(path) do
+      Map.merge(job, %{database: kind, path: path})
+    end
+  end
+
+  def run(suite, jobs, opts) do
+    jobs = Enum.filter(jobs, &selected?(&1, opts.only))
+
+    results =
+      for job <- jobs do
+        result = measure(job, opts)
+        print(suite, result)
+        result
+      end
+
+    write(suite, results, opts.output)
+    results
+  end
+
+  def cleanup_disk(":memory:"), do: :ok
+
+  def cleanup_disk(path) do
+    Enum.each(["", "-wal", "-shm", "-journal"], &File.rm(path <> &1))
+  end
+
+  defp disk_path do
+    name = "exqlite_bench_#{System.unique_integer([:positive])}.db"
+    Path.join(System.tmp_dir!(), name)
+  end
+
+  defp selected?(_job, nil), do: true
+  defp selected?(job, only), do: String.contains?(job.name, only)
+
+  defp measure(job, opts) do
+    state = Map.get(job, :setup, fn -> nil end).()
+    before_each = Map.get(job, :before_each, fn state -> state end)
+
+    try do
+      loop(job.run, before_each, state, seconds(opts.warmup), [])
+      samples = loop(job.run, before_each, state, seconds(opts.time), [])
+      Map.merge(%{job: job.name, database: Map.get(job, :database)}, stats(samples))
+    after
+      Map.get(job, :teardown, fn _state -> :ok end).(state)
+    end
+  end
+
+  defp seconds(seconds), do: round(seconds * 1_000_000)
+
+  defp loop(run, before_each, state, budget_us, samples) when budget_us > 0 do
+    input = before_each.(state)
+    {elapsed_us, _result} = :timer.tc(run, [input])
+    budget_us = budget_us - max(elapsed_us, 1)
+    loop(run, before_each, state, budget_us, [elapsed_us | samples])
+  end
+
+  defp loop(_run, _before_each, _state, _budget_us, samples), do: samples
+
+  defp stats([]) do
+    %{samples: 0, min_us: 0, median_us: 0, p99_us: 0, mean_us: 0, ips: 0}
+  end
+
+  defp stats(samples) do
+    sorted = Enum.sort(samples)
+    count = length(sorted)
+    mean = Enum.sum(sorted) / count
+
+    %{
+      samples: count,
+      min_us: hd(sorted),
+      median_us: percentile(sorted, 50),
+      p99_us: percentile(sorted, 99),
+      mean_us: Float.round(mean, 2),
+      ips: Float.round(1_000_000 / max(mean, 1), 2)
+    }
+  end
+
+  defp print(suite, result) do
+    IO.puts(
+      String.pad_trailing("#{suite}/#{result.job} (#{result.database})", 48) <>
+        " median #{result.median_us} us, p99 #{result.p99_us} us, " <>
+        "#{result.ips} ips, #{result.samples} samples"
+    )
+  end
+
+  defp write(suite, results, output) do
+    write_csv(output, @columns, Enum.map(results, &Map.put(&1, :suite, suite)))
+  end
+
+  # Appends `rows`, maps holding every key of `columns`, to the CSV file at
+  # `output`. The header is only written to new files.
+  def write_csv(output, columns, rows) do
+    File.mkdir_p!(Path.dirname(output))
+    exists = File.exists?(output)
+
+    lines =
+      Enum.map(rows, fn row ->
+        Enum.map_join(columns, ",", &to_string(Map.fetch!(row, &1)))
+      end)
+
+    header = if exists, do: [], else: [Enum.join(columns, ",")]
+    File.write!(output, Enum.map(header ++ lines, &[&1, "\n"]), [:append])
+    IO.puts("results written to #{output}")
+  end
+end
@@ -0,0 +1,61 @@
+# Compares two result files written by the bench/ scripts, matching jobs by
+# suite, job and database, and prints the change of the median and p99 times.
+#
+#     mix run bench/compare.exs bench/results/base.csv bench/results/new.csv
+#
+# A positive change means the second run is slower.
+
+defmodule Exqlite.Bench.Compare do
+  def read(path) do
+    [header | lines] =
+      path
+      |> File.read!()
+      |> String.split("\n", trim: true)
+
+    columns = String.split(header, ",")
+
+    # Files can hold several runs appended after each other, the last wins.
+    for line <- lines, line != header, into: %{} do
+      row = Enum.zip(columns, String.split(line, ",")) |> Map.new()
+      {{row["suite"], row["job"], row["database"]}, row}
+    end
+  end
+
+  def print(base, new) do
+    for {key, new_row} <- Enum.sort(new), Map.has_key?(base, key) do
+      {suite, job, database} = key
+      base_row = Map.fetch!(base, key)
+
+      IO.puts(
+        String.pad_trailing("#{suite}/#{job} (#{database})", 48) <>
+          " median #{change(base_row, new_row, "median_us")}," <>
+          " p99 #{change(base_row, new_row, "p99_us")}"
+      )
+    end
+
+    for key <- Map.keys(new) -- Map.keys(base) do
+      IO.puts("#{inspect(key)} is only in the second run")
+    end
+  end
+
+  defp change(base_row, new_row, column) do
+    base = String.to_integer(base_row[column])
+    new = String.to_integer(new_row[column])
+    percent = if base == 0, do: 0.0, else: (new - base) * 100 / base
+
+    sign = if percent >= 0, do: "+", else: ""
+    "#{base} -> #{new} us (#{sign}#{Float.round(percent, 1)}%)"
+  end
+end
+
+case System.argv() do
+  [base, new] ->
+    Exqlite.Bench.Compare.print(
+      Exqlite.Bench.Compare.read(base),
+      Exqlite.Bench.Compare.read(new)
+    )
+
+  _ ->
+    IO.puts("usage: mix run bench/compare.exs BASE.csv NEW.csv")
+    System.halt(1)
+end
@@ -0,0 +1,287 @@
+# Drives 1..N client processes against one database and reports throughput and
+# p50/p99/p999 latency, to show where the connection mutex, the dirty IO
+# schedulers and the busy handler stop scaling. Every combination of the swept
+# settings is run for `--time` seconds against a fresh on-disk database:
+#
+#   * `--targets` - `pool` runs the clients through a DBConnection pool of
+#     `Exqlite.Connection`, `handles` gives every client its own
+#     `Exqlite.Sqlite3` handle and `shared` makes all clients share one.
+#   * `--clients`, `--pool-sizes`, `--journal-modes`, `--busy-timeouts` and
+#     `--read-ratios` (the percentage of operations that are point reads, the
+#     rest update a random row) take comma separated lists.
+#
+#     mix run bench/concurrency.exs
+#     mix run bench/concurrency.exs --targets handles --clients 1,8,64 --read-ratios 50
+#
+# For the Sqlite3 targets the connection lock wait and busy handler sleep of
+# all handles are reported too, see `Exqlite.Sqlite3.lock_stats/1`.
+
+Code.require_file("bench_helper.exs", __DIR__)
+
+defmodule Exqlite.Bench.Concurrency do
+  alias Exqlite.Bench
+  alias Exqlite.Connection
+  alias Exqlite.Query
+  alias Exqlite.Sqlite3
+
+  @rows 10_000
+  @read_sql "select value from kv where id = ?"
+  @write_sql "update kv set value = ? where id = ?"
+
+  @columns ~w(suite job database target clients pool_size journal_mode
+              busy_timeout read_ratio ops errors throughput median_us p99_us
+              p999_us lock_wait_ms busy_sleep_ms)a
+
+  @switches [
+    targets: :string,
+    clients: :string,
+    pool_sizes: :string,
+    journal_modes: :string,
+    busy_timeouts: :string,
+    read_ratios: :string
+  ]
+
+  def main(argv) do
+    opts = Bench.options(argv, @switches)
+
+    results =
+      for config <- configs(opts), selected?(config, opts.only) do
+        result = run(config, opts)
+        print(result)
+        result
+      end
+
+    Bench.write_csv(opts.output, @columns, results)
+  end
+
+  defp configs(opts) do
+    int = &String.to_integer/1
+    targets = Bench.list_option(opts, :targets, [:pool, :handles, :shared], &atom/1)
+    clients = Bench.list_option(opts, :clients, [1, 4, 16, 64], int)
+    pool_sizes = Bench.list_option(opts, :pool_sizes, [1, 4, 16], int)
+    journal_modes = Bench.list_option(opts, :journal_modes, [:wal, :delete], &atom/1)
+    busy_timeouts = Bench.list_option(opts, :busy_timeouts, [2000], int)
+    read_ratios = Bench.list_option(opts, :read_ratios, [100, 90, 50], int)
+
+    for target <- targets,
+        pool_size <- if(target == :pool, do: pool_sizes, else: [nil]),
+        journal_mode <- journal_modes,
+        busy_timeout <- busy_timeouts,
+        read_ratio <- read_ratios,
+        clients <- clients do
+      config = %{
+        target: target,
+        clients: clients,
+        pool_size: pool_size,
+        journal_mode: journal_mode,
+        busy_timeout: busy_timeout,
+        read_ratio: read_ratio
+      }
+
+      Map.put(config, :job, job_name(config))
+    end
+  end
+
+  defp atom(value), do: String.to_existing_atom(value)
+
+  defp job_name(config) do
+    [
+      config.target,
+      config.pool_size && "pool_#{config.pool_size}",
+      config.journal_mode,
+      "busy_#{config.busy_timeout}",
+      "read_#{config.read_ratio}",
+      "clients_#{config.clients}"
+    ]
+    |> Enum.reject(&is_nil/1)
+    |> Enum.join("/")
+  end
+
+  defp selected?(_config, nil), do: true
+  defp selected?(config, only), do: String.contains?(config.job, only)
+
+  defp run(config, opts) do
+    name = "exqlite_bench_#{System.unique_integer([:positive])}.db"
+    path = Path.join(System.tmp_dir!(), name)
+    seed(path, config.journal_mode)
+
+    try do
+      {target, clients} = start(config, path)
+      {samples, errors} = drive(clients, config, opts)
+      {lock_wait_ms, busy_sleep_ms} = stop(target)
+
+      sorted = Enum.sort(samples)
+
+      Map.merge(config, %{
+        suite: "concurrency",
+        database: :disk,
+        ops: length(sorted),
+        errors: errors,
+        throughput: Float.round(length(sorted) / opts.time, 1),
+        median_us: Bench.percentile(sorted, 50),
+        p99_us: Bench.percentile(sorted, 99),
+        p999_us: Bench.percentile(sorted, 99.9),
+        lock_wait_ms: lock_wait_ms,
+        busy_sleep_ms: busy_sleep_ms
+      })
+    after
+      Bench.cleanup_disk(path)
+    end
+  end
+
+  defp seed(path, journal_mode) do
+    {:ok, db} = Sqlite3.open(path)
+    :ok = Sqlite3.execute(db, "PRAGMA journal_mode = #{journal_mode}")
+    :ok = Sqlite3.execute(db, "create table kv (id integer primary key, value text)")
+    {:ok, statement} = Sqlite3.prepare(db, "insert into kv values (?, ?)")
+    rows = for id <- 1..@rows, do: [id, "value #{id}"]
+    {:ok, @rows} = Sqlite3.execute_many(db, statement, rows)
+    :ok = Sqlite3.release(db, statement)
+    :ok = Sqlite3.close(db)
+  end
+
+  # Every client is a function running one operation, built in the process
+  # that runs it.
+  defp start(%{target: :pool} = config, path) do
+    {:ok, pool} =
+      DBConnection.start_link(Connection,
+        database: path,
+        pool_size: config.pool_size,
+        journal_mode: config.journal_mode,
+        busy_timeout: config.busy_timeout
+      )
+
+    read = Query.build(statement: @read_sql)
+    write = Query.build(statement: @write_sql)
+
+    client = fn ->
+      fn
+        :read, id -> DBConnection.prepare_execute(pool, read, [id])
+        :write, id -> DBConnection.prepare_execute(pool, write, ["updated", id])
+      end
+    end
+
+    {{:pool, pool}, List.duplicate(client, config.clients)}
+  end
+
+  defp start(%{target: :handles} = config, path) do
+    dbs = for _ <- 1..config.clients, do: open(path, config.busy_timeout)
+    {{:handles, dbs}, Enum.map(dbs, &handle_client/1)}
+  end
+
+  defp start(%{target: :shared} = config, path) do
+    db = open(path, config.busy_timeout)
+    {{:handles, [db]}, List.duplicate(handle_client(db), config.clients)}
+  end
+
+  defp open(path, busy_timeout) do
+    {:ok, db} = Sqlite3.open(path)
+    :ok = Sqlite3.set_busy_timeout(db, busy_timeout)
+    db
+  end
+
+  defp handle_client(db) do
+    fn ->
+      {:ok, read} = Sqlite3.prepare(db, @read_sql)
+      {:ok, write} = Sqlite3.prepare(db, @write_sql)
+
+      fn
+        :read, id -> step(db, read, [id])
+        :write, id -> step(db, write, ["updated", id])
+      end
+    end
+  end
+
+  # A read stops after its first row, so the statement is reset to end its
+  # read transaction instead of holding it until the next bind.
+  defp step(db, statement, params) do
+    :ok = Sqlite3.bind(statement, params)
+
+    result =
+      case Sqlite3.step(db, statement) do
+        {:row, _row} -> :ok
+        :done -> :ok
+        other -> {:error, other}
+      end
+
+    :ok = Sqlite3.reset(statement)
+    result
+  end
+
+  defp stop({:pool, pool}) do
+    GenServer.stop(pool)
+    {"", ""}
+  end
+
+  defp stop({:handles, dbs}) do
+    stats =
+      for db <- dbs do
+        {:ok, stats} = Sqlite3.lock_stats(db)
+        :ok = Sqlite3.close(db)
+        stats
+      end
+
+    lock_wait_ns = stats |> Enum.map(& &1.lock_wait_ns) |> Enum.sum()
+    busy_sleep_ms = stats |> Enum.map(& &1.busy_sleep_ms) |> Enum.sum()
+    {div(lock_wait_ns, 1_000_000), busy_sleep_ms}
+  end
+
+  # Starts every client, lets them run for `opts.time` seconds once all are
+  # ready, and collects their latencies and error counts.
+  defp drive(clients, config, opts) do
+    parent = self()
+
+    tasks =
+      for client <- clients do
+        Task.async(fn ->
+          operation = client.()
+          send(parent, {:ready, self()})
+
+          receive do
+            {:go, deadline} -> loop(operation, config.read_ratio, deadline, [], 0)
+          end
+        end)
+      end
+
+    for task <- tasks, do: await_ready(task.pid)
+
+    deadline = System.monotonic_time(:microsecond) + round(opts.time * 1_000_000)
+    for task <- tasks, do: send(task.pid, {:go, deadline})
+
+    tasks
+    |> Task.await_many(:infinity)
+    |> Enum.reduce({[], 0}, fn {samples, errors}, {all, total} ->
+      {samples ++ all, errors + total}
+    end)
+  end
+
+  defp await_ready(pid) do
+    receive do
+      {:ready, ^pid} -> :ok
+    end
+  end
+
+  defp loop(operation, read_ratio, deadline, samples, errors) do
+    start = System.monotonic_time(:microsecond)
+
+    if start >= deadline do
+      {samples, errors}
+    else
+      kind = if :rand.uniform(100) <= read_ratio, do: :read, else: :write
+      result = operation.(kind, :rand.uniform(@rows))
+      elapsed = System.monotonic_time(:microsecond) - start
+      errors = if match?({:error, _}, result), do: errors + 1, else: errors
+      loop(operation, read_ratio, deadline, [elapsed | samples], errors)
+    end
+  end
+
+  defp print(result) do
+    IO.puts(
+      String.pad_trailing(result.job, 44) <>
+        " #{result.throughput} ops/s, p50 #{result.median_us} us," <>
+        " p99 #{result.p99_us} us, p999 #{result.p999_us} us, #{result.errors} errors"
+    )
+  end
+end
+
+Exqlite.Bench.Concurrency.main(System.argv())
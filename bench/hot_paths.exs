@@ -0,0 +1,214 @@
+# Measures the NIF hot paths: point selects, wide rows, large TEXT and BLOB
+# values, bulk inserts and chunked reads over a sweep of chunk sizes, each
+# against an in-memory and an on-disk database.
+#
+#     mix bench
+#     mix bench --time 5 --only point_select --output bench/results/base.csv
+#
+# Compare two result files with bench/compare.exs.
+
+Code.require_file("bench_helper.exs", __DIR__)
+
+defmodule Exqlite.Bench.HotPaths do
+  alias Exqlite.Sqlite3
+
+  @rows 10_000
+  @wide_rows 1_000
+  @wide_columns 50
+  @large_rows 16
+  @large_size 64 * 1024
+  @bulk_rows 1_000
+  @chunk_sizes [1, 10, 50, 100, 500, 1_000]
+  @item_columns "id integer primary key, name text, value real"
+  @large_columns "id integer primary key, body text, data blob"
+
+  def jobs(path) do
+    [
+      point_select(path),
+      fetch(path, "wide_rows", "select * from wide limit 100"),
+      fetch(path, "large_text", "select body from large"),
+      fetch(path, "large_blob", "select data from large"),
+      bulk_insert_step(path),
+      bulk_insert_execute_many(path)
+    ] ++
+      Enum.map(@chunk_sizes, &fetch_all_chunked(path, &1)) ++
+      Enum.map(@chunk_sizes, &stream_chunked(path, &1))
+  end
+
+  defp point_select(path) do
+    %{
+      name: "point_select",
+      setup: fn ->
+        prepare(path, "select id, name, value from items where id = ?")
+      end,
+      run: fn {db, statement} ->
+        :ok = Sqlite3.bind(statement, [:rand.uniform(@rows)])
+        {:row, _row} = Sqlite3.step(db, statement)
+      end,
+      teardown: &close/1
+    }
+  end
+
+  defp fetch(path, name, sql) do
+    %{
+      name: name,
+      setup: fn -> prepare(path, sql) end,
+      run: fn {db, statement} ->
+        :ok = Sqlite3.reset(statement)
+        {:ok, _rows} = Sqlite3.fetch_all(db, statement)
+      end,
+      teardown: &close/1
+    }
+  end
+
+  defp bulk_insert_step(path) do
+    %{
+      name: "bulk_insert_step",
+      setup: fn -> bulk_setup(path) end,
+      before_each: &bulk_clear/1,
+      run: fn {db, statement, rows} ->
+        :ok = Sqlite3.execute(db, "begin")
+
+        Enum.each(rows, fn row ->
+          :ok = Sqlite3.bind(statement, row)
+          :done = Sqlite3.step(db, statement)
+        end)
+
+        :ok = Sqlite3.execute(db, "commit")
+      end,
+      teardown: &close/1
+    }
+  end
+
+  defp bulk_insert_execute_many(path) do
+    %{
+      name: "bulk_insert_execute_many",
+      setup: fn -> bulk_setup(path) end,
+      before_each: &bulk_clear/1,
+      run: fn {db, statement, rows} ->
+        {:ok, @bulk_rows} = Sqlite3.execute_many(db, statement, rows)
+      end,
+      teardown: &close/1
+    }
+  end
+
+  # `fetch_all/2` and `multi_step/2` read :default_chunk_size on every call.
+  defp fetch_all_chunked(path, chunk_size) do
+    %{
+      name: "fetch_all/chunk_#{chunk_size}",
+      setup: fn -> chunked_setup(path, chunk_size) end,
+      run: fn {db, statement} ->
+        :ok = Sqlite3.reset(statement)
+        {:ok, _rows} = Sqlite3.fetch_all(db, statement)
+      end,
+      teardown: &chunked_teardown/1
+    }
+  end
+
+  defp stream_chunked(path, chunk_size) do
+    %{
+      name: "stream/chunk_#{chunk_size}",
+      setup: fn -> chunked_setup(path, chunk_size) end,
+      run: fn {db, statement} ->
+        :ok = Sqlite3.reset(statement)
+        drain(db, statement)
+      end,
+      teardown: &chunked_teardown/1
+    }
+  end
+
+  defp drain(db, statement) do
+    case Sqlite3.multi_step(db, statement) do
+      {:rows, _rows} -> drain(db, statement)
+      {:done, _rows} -> :ok
+    end
+  end
+
+  defp chunked_setup(path, chunk_size) do
+    Application.put_env(:exqlite, :default_chunk_size, chunk_size)
+    prepare(path, "select * from items")
+  end
+
+  defp chunked_teardown(state) do
+    Application.delete_env(:exqlite, :default_chunk_size)
+    close(state)
+  end
+
+  defp bulk_setup(path) do
+    {db, statement} = prepare(path, "insert into bulk (name, value) values (?, ?)")
+    rows = for i <- 1..@bulk_rows, do: ["name #{i}", i * 1.5]
+    {db, statement, rows}
+  end
+
+  defp bulk_clear({db, _statement, _rows} = state) do
+    :ok = Sqlite3.execute(db, "delete from bulk")
+    state
+  end
+
+  defp prepare(path, sql) do
+    db = open(path)
+    {:ok, statement} = Sqlite3.prepare(db, sql)
+    {db, statement}
+  end
+
+  defp close(state) do
+    db = elem(state, 0)
+    :ok = Sqlite3.release(db, elem(state, 1))
+    :ok = Sqlite3.close(db)
+  end
+
+  # In-memory databases are private to their connection, so every job seeds
+  # its own. On disk the first job seeds the file and the others reuse it.
+  defp open(path) do
+    {:ok, db} = Sqlite3.open(path)
+
+    case Sqlite3.execute(db, "create table items (#{@item_columns})") do
+      :ok -> seed(db)
+      {:error, _already_exists} -> :ok
+    end
+
+    db
+  end
+
+  defp seed(db) do
+    insert_all(db, "insert into items values (?, ?, ?)", @rows, fn id ->
+      [id, "name #{id}", id * 1.5]
+    end)
+
+    columns = Enum.map_join(1..@wide_columns, ", ", &"c#{&1}")
+    placeholders = Enum.map_join(1..@wide_columns, ", ", fn _ -> "?" end)
+    :ok = Sqlite3.execute(db, "create table wide (#{columns})")
+
+    insert_all(db, "insert into wide values (#{placeholders})", @wide_rows, fn id ->
+      for column <- 1..@wide_columns do
+        if rem(column, 2) == 0, do: id * column, else: "value #{id} #{column}"
+      end
+    end)
+
+    :ok = Sqlite3.execute(db, "create table large (#{@large_columns})")
+
+    insert_all(db, "insert into large values (?, ?, ?)", @large_rows, fn id ->
+      [id, String.duplicate("x", @large_size), {:blob, :rand.bytes(@large_size)}]
+    end)
+
+    :ok = Sqlite3.execute(db, "create table bulk (#{@item_columns})")
+  end
+
+  defp insert_all(db, sql, count, row) do
+    {:ok, statement} = Sqlite3.prepare(db, sql)
+    {:ok, ^count} = Sqlite3.execute_many(db, statement, Enum.map(1..count, row))
+    :ok = Sqlite3.release(db, statement)
+  end
+end
+
+opts = Exqlite.Bench.options(System.argv())
+jobs = Exqlite.Bench.databases(&Exqlite.Bench.HotPaths.jobs/1)
+
+try do
+  Exqlite.Bench.run("hot_paths", jobs, opts)
+after
+  jobs
+  |> Enum.map(&Map.get(&1, :path))
+  |> Enum.uniq()
+  |> Enum.each(&Exqlite.Bench.cleanup_disk/1)
+end
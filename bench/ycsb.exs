@@ -0,0 +1,311 @@
+# Runs YCSB style workloads through a DBConnection pool of `Exqlite.Connection`,
+# the way applications use exqlite, and reports a latency histogram for every
+# operation. Run it against two releases to see whether one is faster:
+#
+#     mix run bench/ycsb.exs
+#     mix run bench/ycsb.exs --workloads a,b --records 1000000 --clients 32 --time 30
+#
+# The workloads follow the YCSB core workloads:
+#
+#   * `a` - 50% reads, 50% updates
+#   * `b` - 95% reads, 5% updates
+#   * `c` - 100% reads
+#   * `d` - 95% reads of recently inserted records, 5% inserts
+#   * `e` - 95% scans of up to 100 records, 5% inserts
+#   * `f` - 50% reads, 50% read-modify-writes in a transaction
+#
+# Keys follow a scrambled zipfian distribution over the loaded records, except
+# for `d` which favours the latest records. Records have ten 100 byte fields.
+#
+# Options: `--records`, `--clients`, `--pool-size`, `--journal-mode` and
+# `--busy-timeout`, plus `--time`, `--warmup`, `--only` and `--output`, which
+# every bench/ script accepts. All workloads run against one database, loaded
+# once before the first.
+
+Code.require_file("bench_helper.exs", __DIR__)
+
+defmodule Exqlite.Bench.YCSB do
+  alias Exqlite.Bench
+  alias Exqlite.Connection
+  alias Exqlite.Query
+  alias Exqlite.Sqlite3
+
+  @fields 10
+  @field_size 100
+  @max_scan 100
+  @zipfian_theta 0.99
+
+  @workloads %{
+    "a" => [read: 50, update: 50],
+    "b" => [read: 95, update: 5],
+    "c" => [read: 100],
+    "d" => [read_latest: 95, insert: 5],
+    "e" => [scan: 95, insert: 5],
+    "f" => [read: 50, read_modify_write: 50]
+  }
+
+  @columns ~w(suite job database ops throughput mean_us median_us p95_us p99_us
+              p999_us max_us errors histogram)a
+
+  @switches [
+    workloads: :string,
+    records: :integer,
+    clients: :integer,
+    pool_size: :integer,
+    journal_mode: :string,
+    busy_timeout: :integer
+  ]
+
+  def main(argv) do
+    opts = Bench.options(argv, @switches)
+    records = Map.get(opts, :records, 100_000)
+    clients = Map.get(opts, :clients, System.schedulers_online() * 2)
+    workloads = Bench.list_option(opts, :workloads, ~w(a b c d e f), & &1)
+
+    name = "exqlite_ycsb_#{System.unique_integer([:positive])}.db"
+    path = Path.join(System.tmp_dir!(), name)
+    load(path, records)
+
+    {:ok, pool} =
+      DBConnection.start_link(Connection,
+        database: path,
+        pool_size: Map.get(opts, :pool_size, System.schedulers_online()),
+        journal_mode: String.to_existing_atom(Map.get(opts, :journal_mode, "wal")),
+        busy_timeout: Map.get(opts, :busy_timeout, 5000)
+      )
+
+    # Inserted keys are handed out from a shared counter, so every workload
+    # sees the records inserted by the ones before it.
+    counter = :atomics.new(1, signed: false)
+    :atomics.put(counter, 1, records)
+    zipfian = zipfian(records)
+
+    try do
+      results =
+        for workload <- workloads, opts.only == nil or workload == opts.only do
+          mix = Map.fetch!(@workloads, workload)
+
+          run(pool, counter, zipfian, mix, clients, opts.warmup)
+          samples = run(pool, counter, zipfian, mix, clients, opts.time)
+
+          Enum.map(samples, fn {operation, {latencies, errors}} ->
+            job = "workload_#{workload}/#{operation}"
+            result = summary(job, latencies, errors, opts)
+            print(result)
+            result
+          end)
+        end
+
+      Bench.write_csv(opts.output, @columns, List.flatten(results))
+    after
+      GenServer.stop(pool)
+      Bench.cleanup_disk(path)
+    end
+  end
+
+  defp load(path, records) do
+    {:ok, db} = Sqlite3.open(path)
+    :ok = Sqlite3.execute(db, "PRAGMA journal_mode = WAL")
+
+    fields = Enum.map_join(0..(@fields - 1), ", ", &"field#{&1} text")
+    sql = "create table usertable (ycsb_key integer primary key, #{fields})"
+    :ok = Sqlite3.execute(db, sql)
+
+    {:ok, statement} = Sqlite3.prepare(db, insert_sql())
+
+    1..records
+    |> Stream.chunk_every(10_000)
+    |> Enum.each(fn keys ->
+      rows = Enum.map(keys, &[&1 | record()])
+      {:ok, _changes} = Sqlite3.execute_many(db, statement, rows)
+    end)
+
+    :ok = Sqlite3.release(db, statement)
+    :ok = Sqlite3.close(db)
+  end
+
+  defp insert_sql do
+    placeholders = Enum.map_join(0..@fields, ", ", fn _ -> "?" end)
+    "insert into usertable values (#{placeholders})"
+  end
+
+  defp record do
+    for _ <- 1..@fields, do: Base.encode64(:rand.bytes(div(@field_size * 3, 4)))
+  end
+
+  # Runs `clients` processes for `seconds` and returns, per operation, the
+  # latencies in microseconds and the number of errors.
+  defp run(pool, counter, zipfian, mix, clients, seconds) do
+    deadline = System.monotonic_time(:microsecond) + round(seconds * 1_000_000)
+
+    1..clients
+    |> Enum.map(fn _ ->
+      Task.async(fn -> client(pool, counter, zipfian, mix, deadline, %{}) end)
+    end)
+    |> Task.await_many(:infinity)
+    |> Enum.reduce(%{}, fn samples, acc ->
+      Map.merge(acc, samples, fn _operation, {latencies, errors}, {more, more_errors} ->
+        {more ++ latencies, errors + more_errors}
+      end)
+    end)
+  end
+
+  defp client(pool, counter, zipfian, mix, deadline, samples) do
+    start = System.monotonic_time(:microsecond)
+
+    if start >= deadline do
+      samples
+    else
+      operation = pick(mix, :rand.uniform(100))
+      result = execute(operation, pool, counter, zipfian)
+      elapsed = System.monotonic_time(:microsecond) - start
+      error = if match?({:error, _}, result), do: 1, else: 0
+
+      samples =
+        Map.update(samples, operation, {[elapsed], error}, fn {latencies, errors} ->
+          {[elapsed | latencies], errors + error}
+        end)
+
+      client(pool, counter, zipfian, mix, deadline, samples)
+    end
+  end
+
+  defp pick([{operation, percent} | rest], roll) do
+    if roll <= percent or rest == [], do: operation, else: pick(rest, roll - percent)
+  end
+
+  defp execute(:read, pool, _counter, zipfian) do
+    read(pool, next_key(zipfian))
+  end
+
+  defp execute(:read_latest, pool, counter, zipfian) do
+    latest = :atomics.get(counter, 1)
+    read(pool, max(latest - zipfian_next(zipfian), 1))
+  end
+
+  defp execute(:update, pool, _counter, zipfian) do
+    update(pool, next_key(zipfian))
+  end
+
+  defp execute(:insert, pool, counter, _zipfian) do
+    key = :atomics.add_get(counter, 1, 1)
+    query(pool, insert_sql(), [key | record()])
+  end
+
+  defp execute(:scan, pool, _counter, zipfian) do
+    sql = "select * from usertable where ycsb_key >= ? order by ycsb_key limit ?"
+    query(pool, sql, [next_key(zipfian), :rand.uniform(@max_scan)])
+  end
+
+  defp execute(:read_modify_write, pool, _counter, zipfian) do
+    key = next_key(zipfian)
+
+    DBConnection.transaction(pool, fn conn ->
+      with {:ok, _result} <- read(conn, key),
+           {:ok, result} <- update(conn, key) do
+        result
+      else
+        {:error, error} -> DBConnection.rollback(conn, error)
+      end
+    end)
+  end
+
+  defp read(conn, key) do
+    query(conn, "select * from usertable where ycsb_key = ?", [key])
+  end
+
+  defp update(conn, key) do
+    field = "field#{:rand.uniform(@fields) - 1}"
+    value = Base.encode64(:rand.bytes(div(@field_size * 3, 4)))
+    query(conn, "update usertable set #{field} = ? where ycsb_key = ?", [value, key])
+  end
+
+  defp query(conn, sql, params) do
+    case DBConnection.prepare_execute(conn, Query.build(statement: sql), params) do
+      {:ok, _query, result} -> {:ok, result}
+      {:error, _error} = error -> error
+    end
+  end
+
+  # The zipfian generator of YCSB (Gray et al., "Quickly generating billion
+  # record synthetic databases"), over 0..records - 1. Popular items are
+  # scrambled over the key space with a hash, as YCSB does.
+  defp zipfian(records) do
+    zeta_n = zeta(records)
+    zeta_2 = zeta(2)
+    alpha = 1 / (1 - @zipfian_theta)
+    eta = (1 - :math.pow(2 / records, 1 - @zipfian_theta)) / (1 - zeta_2 / zeta_n)
+
+    %{records: records, zeta_n: zeta_n, alpha: alpha, eta: eta}
+  end
+
+  defp zeta(n) do
+    Enum.reduce(1..n, 0.0, fn i, sum -> sum + 1 / :math.pow(i, @zipfian_theta) end)
+  end
+
+  defp zipfian_next(%{records: records} = zipfian) do
+    u = :rand.uniform()
+    uz = u * zipfian.zeta_n
+
+    cond do
+      uz < 1.0 ->
+        0
+
+      uz < 1.0 + :math.pow(0.5, @zipfian_theta) ->
+        1
+
+      true ->
+        rank = records * :math.pow(zipfian.eta * u - zipfian.eta + 1, zipfian.alpha)
+        min(trunc(rank), records - 1)
+    end
+  end
+
+  defp next_key(zipfian) do
+    :erlang.phash2(zipfian_next(zipfian), zipfian.records) + 1
+  end
+
+  defp summary(job, latencies, errors, opts) do
+    sorted = Enum.sort(latencies)
+    count = length(sorted)
+
+    %{
+      suite: "ycsb",
+      job: job,
+      database: :disk,
+      ops: count,
+      throughput: Float.round(count / opts.time, 1),
+      mean_us: Float.round(Enum.sum(sorted) / max(count, 1), 1),
+      median_us: Bench.percentile(sorted, 50),
+      p95_us: Bench.percentile(sorted, 95),
+      p99_us: Bench.percentile(sorted, 99),
+      p999_us: Bench.percentile(sorted, 99.9),
+      max_us: List.last(sorted, 0),
+      errors: errors,
+      histogram: histogram(sorted)
+    }
+  end
+
+  # Counts per power of two bucket, written as `upper_bound_us:count` pairs
+  # separated by `;` so the CSV stays one field.
+  defp histogram(sorted) do
+    sorted
+    |> Enum.frequencies_by(&bucket/1)
+    |> Enum.sort()
+    |> Enum.map_join(";", fn {bound, count} -> "#{bound}:#{count}" end)
+  end
+
+  defp bucket(latency_us), do: bucket(latency_us, 1)
+  defp bucket(latency_us, bound) when latency_us <= bound, do: bound
+  defp bucket(latency_us, bound), do: bucket(latency_us, bound * 2)
+
+  defp print(result) do
+    IO.puts(
+      String.pad_trailing(result.job, 32) <>
+        " #{result.throughput} ops/s, p50 #{result.median_us} us," <>
+        " p95 #{result.p95_us} us, p99 #{result.p99_us} us," <>
+        " p999 #{result.p999_us} us, #{result.errors} errors"
+    )
+  end
+end
+
+Exqlite.Bench.YCSB.main(System.argv())
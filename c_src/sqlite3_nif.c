@@ -1,4 +1,10 @@
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -26,6 +32,8 @@ static ERL_NIF_TERM am_invalid_connection;
 static ERL_NIF_TERM am_sql_not_iolist;
 static ERL_NIF_TERM am_connection_closed;
 static ERL_NIF_TERM am_invalid_statement;
+static ERL_NIF_TERM am_invalid_snapshot;
+static ERL_NIF_TERM am_snapshots_not_supported;
 static ERL_NIF_TERM am_invalid_chunk_size;
 static ERL_NIF_TERM am_busy;
 static ERL_NIF_TERM am_invalid_column_count;
@@ -40,18 +48,241 @@ static ERL_NIF_TERM am_delete;
 static ERL_NIF_TERM am_update;
 static ERL_NIF_TERM am_invalid_pid;
 static ERL_NIF_TERM am_log;
+static ERL_NIF_TERM am_blob;
+static ERL_NIF_TERM am_undefined;
+static ERL_NIF_TERM am_invalid_parameter_count;
+static ERL_NIF_TERM am_unknown_parameter;
+static ERL_NIF_TERM am_unsupported_type;
+static ERL_NIF_TERM am_integer;
+static ERL_NIF_TERM am_float;
+static ERL_NIF_TERM am_text;
+static ERL_NIF_TERM am_null;
+static ERL_NIF_TERM am_mixed;
+static ERL_NIF_TERM am_true;
+static ERL_NIF_TERM am_false;
+static ERL_NIF_TERM am_list;
+static ERL_NIF_TERM am_tuple;
+static ERL_NIF_TERM am_bind;
+static ERL_NIF_TERM am_raw;
+static ERL_NIF_TERM am_boolean;
+static ERL_NIF_TERM am_naive_datetime;
+static ERL_NIF_TERM am_date;
+static ERL_NIF_TERM am_json;
+static ERL_NIF_TERM am_atom_from_text;
+static ERL_NIF_TERM am_calendar;
+static ERL_NIF_TERM am_year;
+static ERL_NIF_TERM am_month;
+static ERL_NIF_TERM am_day;
+static ERL_NIF_TERM am_hour;
+static ERL_NIF_TERM am_minute;
+static ERL_NIF_TERM am_second;
+static ERL_NIF_TERM am_microsecond;
+static ERL_NIF_TERM am___struct__;
+static ERL_NIF_TERM am_calendar_iso;
+static ERL_NIF_TERM am_elixir_date;
+static ERL_NIF_TERM am_elixir_naive_datetime;
+static ERL_NIF_TERM am_execute;
+static ERL_NIF_TERM am_prepare;
+static ERL_NIF_TERM am_step;
+static ERL_NIF_TERM am_multi_step;
+static ERL_NIF_TERM am_no_worker;
+static ERL_NIF_TERM am_failed_to_create_thread;
+static ERL_NIF_TERM am_lock_acquisitions;
+static ERL_NIF_TERM am_lock_contended;
+static ERL_NIF_TERM am_lock_wait_ns;
+static ERL_NIF_TERM am_lock_max_wait_ns;
+static ERL_NIF_TERM am_busy_handler_calls;
+static ERL_NIF_TERM am_busy_sleep_ms;
+static ERL_NIF_TERM am_busy_timeouts;
+static ERL_NIF_TERM am_infinity;
+static ERL_NIF_TERM am_allocator;
+static ERL_NIF_TERM am_default;
+static ERL_NIF_TERM am_pool;
+static ERL_NIF_TERM am_classes;
+static ERL_NIF_TERM am_size;
+static ERL_NIF_TERM am_allocations;
+static ERL_NIF_TERM am_reused;
+static ERL_NIF_TERM am_in_use;
+static ERL_NIF_TERM am_high_water;
+static ERL_NIF_TERM am_cached;
+static ERL_NIF_TERM am_prepare_ns;
+static ERL_NIF_TERM am_bind_ns;
+static ERL_NIF_TERM am_step_ns;
+static ERL_NIF_TERM am_decode_ns;
+static ERL_NIF_TERM am_rows_returned;
+static ERL_NIF_TERM am_bytes_returned;
+static ERL_NIF_TERM am_fullscan_step;
+static ERL_NIF_TERM am_sort;
+static ERL_NIF_TERM am_autoindex;
+static ERL_NIF_TERM am_vm_step;
+static ERL_NIF_TERM am_reprepare;
+static ERL_NIF_TERM am_run;
+static ERL_NIF_TERM am_filter_miss;
+static ERL_NIF_TERM am_filter_hit;
+static ERL_NIF_TERM am_memused;
+static ERL_NIF_TERM am_lookaside_used;
+static ERL_NIF_TERM am_lookaside_used_highwater;
+static ERL_NIF_TERM am_lookaside_hit;
+static ERL_NIF_TERM am_lookaside_miss_size;
+static ERL_NIF_TERM am_lookaside_miss_full;
+static ERL_NIF_TERM am_cache_used;
+static ERL_NIF_TERM am_cache_used_shared;
+static ERL_NIF_TERM am_cache_hit;
+static ERL_NIF_TERM am_cache_miss;
+static ERL_NIF_TERM am_cache_write;
+static ERL_NIF_TERM am_cache_spill;
+static ERL_NIF_TERM am_schema_used;
+static ERL_NIF_TERM am_stmt_used;
+static ERL_NIF_TERM am_deferred_fks;
+static ERL_NIF_TERM am_tempbuf_spill;
+static ERL_NIF_TERM am_memory_used;
+static ERL_NIF_TERM am_memory_used_highwater;
+static ERL_NIF_TERM am_malloc_count;
+static ERL_NIF_TERM am_malloc_count_highwater;
+static ERL_NIF_TERM am_malloc_size_highwater;
+static ERL_NIF_TERM am_pagecache_used;
+static ERL_NIF_TERM am_pagecache_used_highwater;
+static ERL_NIF_TERM am_pagecache_overflow;
+static ERL_NIF_TERM am_pagecache_overflow_highwater;
+static ERL_NIF_TERM am_pagecache_size_highwater;
+static ERL_NIF_TERM am_parser_stack_highwater;
 
 static ErlNifResourceType* connection_type       = NULL;
 static ErlNifResourceType* statement_type        = NULL;
+static ErlNifResourceType* snapshot_type         = NULL;
 static sqlite3_mem_methods default_alloc_methods = {0};
 
 ErlNifPid* log_hook_pid     = NULL;
 ErlNifMutex* log_hook_mutex = NULL;
 
+// enif_get_atom only learned ERL_NIF_UTF8 in NIF 2.17 (OTP 26).
+#if ERL_NIF_MAJOR_VERSION > 2 || (ERL_NIF_MAJOR_VERSION == 2 && ERL_NIF_MINOR_VERSION >= 17)
+    #define EXQLITE_HAS_UTF8_ATOMS 1
+#endif
+
+// How long fetch_all may step a statement before it gives the dirty
+// scheduler back and reschedules itself.
+#define FETCH_ALL_TIMESLICE_NS 1000000
+
+// Same for execute_many, checked between parameter rows.
+#define EXECUTE_MANY_TIMESLICE_NS 1000000
+
+// Large enough for the longest atom (255 characters, 4 bytes each) plus NUL.
+#define ATOM_TEXT_SIZE 1024
+
+// conn->deadline when no deadline is set. Erlang monotonic time may be
+// negative or zero, so no smaller value can serve as the sentinel.
+#define NO_DEADLINE LLONG_MAX
+
+// Lock free loads and stores for the flags the progress handler polls every
+// few opcodes, so it never takes a mutex.
+#if defined(_MSC_VER)
+    #include <windows.h>
+    #define ATOMIC_LOAD_INT64(ptr)         InterlockedCompareExchange64((ptr), 0, 0)
+    #define ATOMIC_STORE_INT64(ptr, value) InterlockedExchange64((ptr), (value))
+    #define ATOMIC_ADD_INT64(ptr, value)   InterlockedExchangeAdd64((ptr), (value))
+    #define ATOMIC_CAS_INT64(ptr, expected, desired) \
+        (InterlockedCompareExchange64((ptr), (desired), (expected)) == (expected))
+#else
+    #define ATOMIC_LOAD_INT64(ptr)         __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+    #define ATOMIC_STORE_INT64(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+    #define ATOMIC_ADD_INT64(ptr, value)   __atomic_fetch_add((ptr), (value), __ATOMIC_ACQ_REL)
+    #define ATOMIC_CAS_INT64(ptr, expected, desired) __sync_bool_compare_and_swap((ptr), (expected), (desired))
+#endif
+
+// Raises `*ptr` to `value` unless it already is at least that.
+static inline void
+atomic_max_int64(ErlNifSInt64* ptr, ErlNifSInt64 value)
+{
+    ErlNifSInt64 current;
+
+    do {
+        current = ATOMIC_LOAD_INT64(ptr);
+    } while (value > current && !ATOMIC_CAS_INT64(ptr, current, value));
+}
+
+// The write lock arbiter needs a condition variable with a timeout, which
+// erl_nif does not offer.
+#if defined(_WIN32)
+    #include <windows.h>
+typedef SRWLOCK arbiter_lock_t;
+typedef CONDITION_VARIABLE arbiter_cond_t;
+    #define ARBITER_LOCK_INIT(lock)            InitializeSRWLock(lock)
+    #define ARBITER_LOCK_DESTROY(lock)         ((void)(lock))
+    #define ARBITER_LOCK(lock)                 AcquireSRWLockExclusive(lock)
+    #define ARBITER_UNLOCK(lock)               ReleaseSRWLockExclusive(lock)
+    #define ARBITER_COND_INIT(cond)            InitializeConditionVariable(cond)
+    #define ARBITER_COND_DESTROY(cond)         ((void)(cond))
+    #define ARBITER_BROADCAST(cond)            WakeAllConditionVariable(cond)
+    #define ARBITER_TIMED_WAIT(cond, lock, ms) SleepConditionVariableSRW((cond), (lock), (DWORD)(ms), 0)
+#else
+    #include <pthread.h>
+    #include <time.h>
+typedef pthread_mutex_t arbiter_lock_t;
+typedef pthread_cond_t arbiter_cond_t;
+    #define ARBITER_LOCK_INIT(lock)            pthread_mutex_init((lock), NULL)
+    #define ARBITER_LOCK_DESTROY(lock)         pthread_mutex_destroy(lock)
+    #define ARBITER_LOCK(lock)                 pthread_mutex_lock(lock)
+    #define ARBITER_UNLOCK(lock)               pthread_mutex_unlock(lock)
+    #define ARBITER_COND_INIT(cond)            pthread_cond_init((cond), NULL)
+    #define ARBITER_COND_DESTROY(cond)         pthread_cond_destroy(cond)
+    #define ARBITER_BROADCAST(cond)            pthread_cond_broadcast(cond)
+    #define ARBITER_TIMED_WAIT(cond, lock, ms) arbiter_timed_wait((cond), (lock), (ms))
+
+static void
+arbiter_timed_wait(pthread_cond_t* cond, pthread_mutex_t* lock, int ms)
+{
+    struct timespec until;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ms / 1000;
+    until.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    pthread_cond_timedwait(cond, lock, &until);
+}
+#endif
+
+// How long the oldest waiter on the write lock waits for a wakeup before it
+// retries anyway, since holders outside this VM never send one.
+#define WRITE_ARBITER_POLL_MS 50
+
 // Denied authorizer action codes. Sized to 64 for margin — highest
 // currently defined SQLite action code is SQLITE_RECURSIVE (33).
 #define AUTHORIZER_DENY_SIZE 64
 
+typedef struct async_worker async_worker_t;
+typedef struct write_arbiter write_arbiter_t;
+
+// Contention counters, see lock_stats/1. All of them are atomic, so counting
+// never takes a mutex.
+typedef struct connection_stats
+{
+    ErlNifSInt64 lock_acquisitions;
+    ErlNifSInt64 lock_contended;
+    ErlNifSInt64 lock_wait_ns;
+    ErlNifSInt64 lock_max_wait_ns;
+    ErlNifSInt64 busy_handler_calls;
+    ErlNifSInt64 busy_sleep_ms;
+    ErlNifSInt64 busy_timeouts;
+} connection_stats_t;
+
+// Time spent in each phase of the queries run since the stats were last taken,
+// only collected while `enabled` is set.
+typedef struct query_stats
+{
+    int enabled;
+    ErlNifUInt64 prepare_ns;
+    ErlNifUInt64 bind_ns;
+    ErlNifUInt64 step_ns;   // in sqlite3_step
+    ErlNifUInt64 decode_ns; // turning columns into terms
+    ErlNifUInt64 rows;
+    ErlNifUInt64 bytes; // TEXT and BLOB payload handed out
+} query_stats_t;
+
 typedef struct connection
 {
     sqlite3* db;
@@ -61,20 +292,76 @@ typedef struct connection
     int authorizer_deny[AUTHORIZER_DENY_SIZE];
 
     // Custom busy handler state
-    int cancelled; // guarded by interrupt_mutex
+    ErlNifSInt64 cancelled;     // atomic
+    ErlNifSInt64 deadline;      // atomic, monotonic time in ns, NO_DEADLINE when unset
+    ErlNifSInt64 call_deadline; // atomic, same, only armed while conn->mutex is held
     int busy_timeout_ms;
     int progress_handler_steps;
     ErlNifEnv* callback_env; // for enif_is_process_alive
     ErlNifPid caller_pid;
+
+    async_worker_t* worker;   // guarded by interrupt_mutex
+    connection_stats_t stats;  // atomic
+    query_stats_t query_stats; // guarded by mutex
+
+    // Write lock arbiter, NULL for in-memory and temporary databases. Only
+    // the connection itself changes these, `arbiter_ready` aside.
+    write_arbiter_t* arbiter;
+    int arbiter_wrote;               // a write transaction ended, guarded by mutex
+    int arbiter_queued;              // guarded by arbiter->lock
+    int arbiter_ready;               // may retry now, guarded by arbiter->lock
+    struct connection* arbiter_next; // guarded by arbiter->lock
+    ErlNifTime busy_started;         // ms, first busy handler call of this wait
 } connection_t;
 
+// Shared by the connections of this VM that opened the same database file.
+struct write_arbiter
+{
+    char* path;
+    int refs;              // guarded by write_arbiters_mutex
+    write_arbiter_t* next; // guarded by write_arbiters_mutex
+    arbiter_lock_t lock;
+    arbiter_cond_t cond;
+    connection_t* head; // busy handlers waiting for the write lock, oldest first
+    connection_t* tail;
+};
+
+static write_arbiter_t* write_arbiters   = NULL;
+static ErlNifMutex* write_arbiters_mutex = NULL;
+
+typedef struct prefetch_job prefetch_job_t;
+
+// A WAL snapshot of the main database. It is not tied to the connection it was
+// taken on, any connection to the same file can open it.
+typedef struct snapshot
+{
+    ErlNifMutex* mutex;
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    sqlite3_snapshot* snapshot; // guarded by mutex, NULL once freed
+#endif
+} snapshot_t;
+
 typedef struct statement
 {
     connection_t* conn;
     sqlite3_stmt* statement;
+    prefetch_job_t* prefetch; // guarded by conn->mutex
+
+    // Metadata computed once per (re)compilation of the statement. The terms
+    // live in `env`, which is independent from any process.
+    ErlNifEnv* env;
+    ERL_NIF_TERM columns;
+    ERL_NIF_TERM column_types;
+    int readonly;
+    int reprepared; // -1 until the metadata is cached
 } statement_t;
 
 static int exqlite_progress_handler(void* arg);
+static prefetch_job_t* statement_prefetch_detach(statement_t* statement);
+static void statement_prefetch_discard(statement_t* statement);
+static void prefetch_job_reap(prefetch_job_t* job);
+static void prefetch_job_orphan(prefetch_job_t* job);
+static void prefetch_orphans_reap(int all);
 
 static void*
 exqlite_malloc(int bytes)
@@ -153,6 +440,401 @@ exqlite_mem_shutdown(void* ptr)
 {
 }
 
+// ---------------------------------------------------------------------------
+// Pool allocator
+//
+// Selected with EXQLITE_ALLOCATOR=pool in the environment of the VM, read
+// once when the NIF loads. SQLite makes many small, short lived allocations,
+// so blocks of up to POOL_MAX_SIZE bytes are rounded up to a size class and
+// recycled through free lists instead of going back to enif_alloc every
+// time. Larger blocks take the default path. Blocks keep the size_t header of
+// the default allocator, xFree gets no size and the header is what tells the
+// two kinds apart.
+//
+// Every size class splits its free list into POOL_SHARDS shards, each with
+// its own mutex, and a thread always uses the shard its id hashes to. So
+// schedulers and native threads allocating at once rarely share a mutex. A
+// block freed on another thread than the one that allocated it simply joins
+// the free list of the freeing thread. The in_use and high_water counters
+// span the whole class and are updated with atomics.
+// ---------------------------------------------------------------------------
+
+#define POOL_CLASSES    8
+#define POOL_MAX_SIZE   512
+#define POOL_SHARD_BITS 4
+#define POOL_SHARDS     (1 << POOL_SHARD_BITS)
+#define POOL_MAX_CACHED (256 * 1024) // bytes kept on the free lists of a class
+
+typedef struct pool_block
+{
+    struct pool_block* next;
+} pool_block_t;
+
+typedef struct pool_shard
+{
+    ErlNifMutex* mutex;
+    pool_block_t* free; // guarded by mutex, as are the counters below
+    size_t cached;
+    ErlNifUInt64 allocations;
+    ErlNifUInt64 reused;
+} pool_shard_t;
+
+typedef struct pool_class
+{
+    size_t size;
+    ErlNifSInt64 in_use;     // atomic
+    ErlNifSInt64 high_water; // atomic
+    pool_shard_t shards[POOL_SHARDS];
+} pool_class_t;
+
+static const size_t pool_class_sizes[POOL_CLASSES] = {16, 32, 64, 96, 128, 192, 256, POOL_MAX_SIZE};
+
+static pool_class_t pool_classes[POOL_CLASSES];
+
+static int pool_allocator_enabled = 0;
+
+static pool_class_t*
+pool_class_for(size_t bytes)
+{
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        if (bytes <= pool_classes[i].size) {
+            return &pool_classes[i];
+        }
+    }
+
+    return NULL;
+}
+
+// The shard of the calling thread, picked by a Fibonacci hash of its id.
+static inline pool_shard_t*
+pool_shard_for(pool_class_t* size_class)
+{
+    ErlNifUInt64 key = (ErlNifUInt64)(uintptr_t)enif_thread_self();
+    return &size_class->shards[(key * 0x9E3779B97F4A7C15ULL) >> (64 - POOL_SHARD_BITS)];
+}
+
+static void
+pool_class_add_in_use(pool_class_t* size_class, ErlNifSInt64 delta)
+{
+    ErlNifSInt64 in_use = ATOMIC_ADD_INT64(&size_class->in_use, delta) + delta;
+
+    if (delta > 0) {
+        atomic_max_int64(&size_class->high_water, in_use);
+    }
+}
+
+static void*
+exqlite_pool_malloc(int bytes)
+{
+    assert(bytes > 0);
+
+    pool_class_t* size_class = pool_class_for(bytes);
+    pool_shard_t* shard;
+    pool_block_t* block = NULL;
+    size_t* p;
+
+    if (!size_class) {
+        return exqlite_malloc(bytes);
+    }
+
+    shard = pool_shard_for(size_class);
+
+    enif_mutex_lock(shard->mutex);
+    block = shard->free;
+    if (block) {
+        shard->free = block->next;
+        shard->cached--;
+        shard->reused++;
+    }
+    shard->allocations++;
+    enif_mutex_unlock(shard->mutex);
+
+    if (!block) {
+        p = enif_alloc(size_class->size + sizeof(size_t));
+        if (!p) {
+            enif_mutex_lock(shard->mutex);
+            shard->allocations--;
+            enif_mutex_unlock(shard->mutex);
+            return NULL;
+        }
+
+        p[0]  = size_class->size;
+        block = (pool_block_t*)(p + 1);
+    }
+
+    pool_class_add_in_use(size_class, 1);
+
+    return block;
+}
+
+static void
+exqlite_pool_free(void* prior)
+{
+    if (!prior) {
+        return;
+    }
+
+    size_t size              = ((size_t*)prior)[-1];
+    pool_class_t* size_class = size <= POOL_MAX_SIZE ? pool_class_for(size) : NULL;
+    pool_block_t* block      = prior;
+    pool_shard_t* shard;
+
+    if (!size_class) {
+        exqlite_free(prior);
+        return;
+    }
+
+    pool_class_add_in_use(size_class, -1);
+
+    shard = pool_shard_for(size_class);
+
+    enif_mutex_lock(shard->mutex);
+    if (shard->cached * size_class->size < POOL_MAX_CACHED / POOL_SHARDS) {
+        block->next = shard->free;
+        shard->free = block;
+        shard->cached++;
+        block = NULL;
+    }
+    enif_mutex_unlock(shard->mutex);
+
+    if (block) {
+        exqlite_free(prior);
+    }
+}
+
+static void*
+exqlite_pool_realloc(void* prior, int bytes)
+{
+    assert(prior);
+    assert(bytes > 0);
+
+    size_t size = ((size_t*)prior)[-1];
+    void* p;
+
+    if (size > POOL_MAX_SIZE) {
+        if (bytes > POOL_MAX_SIZE) {
+            return exqlite_realloc(prior, bytes);
+        }
+    } else if (pool_class_for(bytes) == pool_class_for(size)) {
+        return prior;
+    }
+
+    p = exqlite_pool_malloc(bytes);
+    if (!p) {
+        return NULL;
+    }
+
+    memcpy(p, prior, size < (size_t)bytes ? size : (size_t)bytes);
+    exqlite_pool_free(prior);
+
+    return p;
+}
+
+static int
+exqlite_pool_init(void)
+{
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        pool_classes[i].size = pool_class_sizes[i];
+
+        for (int j = 0; j < POOL_SHARDS; j++) {
+            pool_classes[i].shards[j].mutex = enif_mutex_create("exqlite:pool_shard");
+            if (!pool_classes[i].shards[j].mutex) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static void
+exqlite_pool_shutdown(void)
+{
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        for (int j = 0; j < POOL_SHARDS; j++) {
+            pool_shard_t* shard = &pool_classes[i].shards[j];
+
+            while (shard->free) {
+                pool_block_t* block = shard->free;
+                shard->free         = block->next;
+                exqlite_free(block);
+            }
+            shard->cached = 0;
+
+            if (shard->mutex) {
+                enif_mutex_destroy(shard->mutex);
+                shard->mutex = NULL;
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Page cache budget
+//
+// A thin SQLITE_CONFIG_PCACHE2 wrapper around SQLite's own page cache. Each
+// cache still belongs to a single connection, but the caches of file
+// databases split one global budget evenly, so a pool of connections stays
+// within a fixed amount of memory however large it grows. A cache may only
+// be touched by the thread holding its connection, so each one picks up a
+// new share the next time its connection fetches a page.
+// ---------------------------------------------------------------------------
+
+// Lower bound of a cache's share, SQLite needs a handful of pages per query.
+#define PAGE_CACHE_MIN_PAGES 10
+
+typedef struct budget_cache
+{
+    sqlite3_pcache* base;
+    int page_size; // page plus per page extra, in bytes
+    int purgeable;
+    int requested;           // cache size set by the connection, in pages
+    ErlNifSInt64 generation; // of the budget last applied
+} budget_cache_t;
+
+static sqlite3_pcache_methods2 default_pcache_methods = {0};
+
+static ErlNifSInt64 page_cache_budget     = 0; // atomic, bytes, 0 without a budget
+static ErlNifSInt64 page_cache_count      = 0; // atomic, purgeable caches
+static ErlNifSInt64 page_cache_generation = 0; // atomic, bumped on every change
+
+static void
+budget_cache_apply(budget_cache_t* cache)
+{
+    // Read the generation first, a change racing with this is applied on the
+    // next fetch.
+    cache->generation   = ATOMIC_LOAD_INT64(&page_cache_generation);
+    ErlNifSInt64 budget = ATOMIC_LOAD_INT64(&page_cache_budget);
+    ErlNifSInt64 count  = ATOMIC_LOAD_INT64(&page_cache_count);
+    int size            = cache->requested;
+
+    if (budget > 0 && count > 0) {
+        ErlNifSInt64 share = budget / count / cache->page_size;
+        if (share < PAGE_CACHE_MIN_PAGES) {
+            share = PAGE_CACHE_MIN_PAGES;
+        }
+        if (share < size) {
+            size = (int)share;
+        }
+    }
+
+    default_pcache_methods.xCachesize(cache->base, size);
+}
+
+// `arg` is the pArg of our methods, the default implementation they wrap.
+static int
+budget_cache_init(void* arg)
+{
+    const sqlite3_pcache_methods2* base = arg;
+    return base->xInit(base->pArg);
+}
+
+static void
+budget_cache_shutdown(void* arg)
+{
+    const sqlite3_pcache_methods2* base = arg;
+    base->xShutdown(base->pArg);
+}
+
+static sqlite3_pcache*
+budget_cache_create(int page_size, int extra_size, int purgeable)
+{
+    budget_cache_t* cache = enif_alloc(sizeof(budget_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->base = default_pcache_methods.xCreate(page_size, extra_size, purgeable);
+    if (!cache->base) {
+        enif_free(cache);
+        return NULL;
+    }
+
+    cache->page_size  = page_size + extra_size;
+    cache->purgeable  = purgeable;
+    cache->requested  = 0;
+    cache->generation = 0;
+
+    // In-memory databases keep every page in their cache, there is nothing
+    // to budget.
+    if (purgeable) {
+        ATOMIC_ADD_INT64(&page_cache_count, 1);
+        ATOMIC_ADD_INT64(&page_cache_generation, 1);
+    }
+
+    return (sqlite3_pcache*)cache;
+}
+
+static void
+budget_cache_cachesize(sqlite3_pcache* p, int size)
+{
+    budget_cache_t* cache = (budget_cache_t*)p;
+
+    cache->requested = size;
+    if (cache->purgeable) {
+        budget_cache_apply(cache);
+    } else {
+        default_pcache_methods.xCachesize(cache->base, size);
+    }
+}
+
+static int
+budget_cache_pagecount(sqlite3_pcache* p)
+{
+    return default_pcache_methods.xPagecount(((budget_cache_t*)p)->base);
+}
+
+static sqlite3_pcache_page*
+budget_cache_fetch(sqlite3_pcache* p, unsigned key, int create)
+{
+    budget_cache_t* cache = (budget_cache_t*)p;
+
+    if (cache->purgeable && cache->generation != ATOMIC_LOAD_INT64(&page_cache_generation)) {
+        budget_cache_apply(cache);
+    }
+
+    return default_pcache_methods.xFetch(cache->base, key, create);
+}
+
+static void
+budget_cache_unpin(sqlite3_pcache* p, sqlite3_pcache_page* page, int discard)
+{
+    default_pcache_methods.xUnpin(((budget_cache_t*)p)->base, page, discard);
+}
+
+static void
+budget_cache_rekey(sqlite3_pcache* p, sqlite3_pcache_page* page, unsigned old_key, unsigned new_key)
+{
+    default_pcache_methods.xRekey(((budget_cache_t*)p)->base, page, old_key, new_key);
+}
+
+static void
+budget_cache_truncate(sqlite3_pcache* p, unsigned limit)
+{
+    default_pcache_methods.xTruncate(((budget_cache_t*)p)->base, limit);
+}
+
+static void
+budget_cache_destroy(sqlite3_pcache* p)
+{
+    budget_cache_t* cache = (budget_cache_t*)p;
+
+    default_pcache_methods.xDestroy(cache->base);
+
+    if (cache->purgeable) {
+        ATOMIC_ADD_INT64(&page_cache_count, -1);
+        ATOMIC_ADD_INT64(&page_cache_generation, 1);
+    }
+
+    enif_free(cache);
+}
+
+static void
+budget_cache_shrink(sqlite3_pcache* p)
+{
+    default_pcache_methods.xShrink(((budget_cache_t*)p)->base);
+}
+
 static const char*
 get_sqlite3_error_msg(int rc, sqlite3* db)
 {
@@ -188,16 +870,18 @@ make_error_tuple(ErlNifEnv* env, ERL_NIF_TERM reason)
 static ERL_NIF_TERM
 make_binary(ErlNifEnv* env, const void* bytes, unsigned int size)
 {
-    ErlNifBinary blob;
     ERL_NIF_TERM term;
 
-    if (!enif_alloc_binary(size, &blob)) {
+    // Small binaries land directly on the process heap, larger ones are
+    // allocated as a refc binary in one go.
+    unsigned char* data = enif_make_new_binary(env, size, &term);
+    if (!data) {
         return am_out_of_memory;
     }
 
-    memcpy(blob.data, bytes, size);
-    term = enif_make_binary(env, &blob);
-    enif_release_binary(&blob);
+    if (size > 0) {
+        memcpy(data, bytes, size);
+    }
 
     return term;
 }
@@ -247,304 +931,2080 @@ make_cell(ErlNifEnv* env, sqlite3_stmt* statement, unsigned int i)
     }
 }
 
-static ERL_NIF_TERM
-make_row(ErlNifEnv* env, sqlite3_stmt* statement)
+//
+// Decode hints
+//
+// multi_step and fetch_all accept a decode hint per column, applied while the
+// row is built so callers don't need a second pass over the result. A hint
+// only applies to the storage class it expects; other values, and values that
+// don't parse, come back as they are.
+//
+
+typedef enum decode_hint
 {
-    assert(env);
-    assert(statement);
+    DECODE_RAW = 0,
+    DECODE_BOOLEAN,
+    DECODE_NAIVE_DATETIME,
+    DECODE_DATE,
+    DECODE_JSON,
+    DECODE_ATOM_FROM_TEXT,
+} decode_hint_t;
+
+// Nesting limit for JSON arrays and objects, the parser is recursive.
+#define JSON_MAX_DEPTH 256
+
+// Numbers up to this size are copied to the stack to be parsed, longer
+// ones to the heap.
+#define JSON_NUMBER_SIZE 64
+
+// Parses a list of hint atoms, one per column, into a freshly allocated array.
+// Leaves `*hints` NULL for an empty list.
+static int
+get_decode_hints(ErlNifEnv* env, ERL_NIF_TERM list, int** hints, unsigned int* count)
+{
+    ERL_NIF_TERM head;
+    unsigned int i = 0;
 
-    ERL_NIF_TERM* columns = NULL;
-    ERL_NIF_TERM row;
-    unsigned int count = sqlite3_column_count(statement);
+    *hints = NULL;
+    *count = 0;
 
-    columns = enif_alloc(sizeof(ERL_NIF_TERM) * count);
-    if (!columns) {
-        return make_error_tuple(env, am_out_of_memory);
+    if (!enif_get_list_length(env, list, count)) {
+        return 0;
     }
 
-    for (unsigned int i = 0; i < count; i++) {
-        columns[i] = make_cell(env, statement, i);
+    if (*count == 0) {
+        return 1;
     }
 
-    row = enif_make_list_from_array(env, columns, count);
+    *hints = enif_alloc(sizeof(int) * *count);
+    if (!*hints) {
+        return 0;
+    }
 
-    enif_free(columns);
+    while (enif_get_list_cell(env, list, &head, &list)) {
+        int hint;
+
+        if (enif_is_identical(head, am_raw)) {
+            hint = DECODE_RAW;
+        } else if (enif_is_identical(head, am_boolean)) {
+            hint = DECODE_BOOLEAN;
+        } else if (enif_is_identical(head, am_naive_datetime)) {
+            hint = DECODE_NAIVE_DATETIME;
+        } else if (enif_is_identical(head, am_date)) {
+            hint = DECODE_DATE;
+        } else if (enif_is_identical(head, am_json)) {
+            hint = DECODE_JSON;
+        } else if (enif_is_identical(head, am_atom_from_text)) {
+            hint = DECODE_ATOM_FROM_TEXT;
+        } else {
+            enif_free(*hints);
+            *hints = NULL;
+            return 0;
+        }
+
+        (*hints)[i++] = hint;
+    }
 
-    return row;
+    return 1;
 }
 
-static inline void
-connection_acquire_lock(connection_t* conn)
+static int
+parse_digits(const unsigned char* text, int count, int* value)
 {
-    assert(conn);
-    enif_mutex_lock(conn->mutex);
+    *value = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return 0;
+        }
+        *value = *value * 10 + (text[i] - '0');
+    }
+
+    return 1;
 }
 
-static inline void
-connection_release_lock(connection_t* conn)
+static int
+days_in_month(int year, int month)
 {
-    assert(conn);
-    enif_mutex_unlock(conn->mutex);
+    static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    if (month == 2 && (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))) {
+        return 29;
+    }
+
+    return days[month - 1];
 }
 
-static inline void
-statement_acquire_lock(statement_t* statement)
+// Parses "YYYY-MM-DD" at the start of `text`.
+static int
+parse_iso8601_date(const unsigned char* text, int size, int* year, int* month, int* day)
 {
-    assert(statement);
-    connection_acquire_lock(statement->conn);
+    if (size < 10 || text[4] != '-' || text[7] != '-') {
+        return 0;
+    }
+
+    if (!parse_digits(text, 4, year) || !parse_digits(text + 5, 2, month) || !parse_digits(text + 8, 2, day)) {
+        return 0;
+    }
+
+    return *month >= 1 && *month <= 12 && *day >= 1 && *day <= days_in_month(*year, *month);
 }
 
-static inline void
-statement_release_lock(statement_t* statement)
+// Builds a struct of `module` from the `count` given fields, plus the
+// __struct__ and calendar fields for which `keys` and `values` need room.
+static int
+make_calendar_struct(ErlNifEnv* env, ERL_NIF_TERM module, ERL_NIF_TERM* keys, ERL_NIF_TERM* values, size_t count, ERL_NIF_TERM* out)
 {
-    assert(statement);
-    connection_release_lock(statement->conn);
+    keys[count]       = am___struct__;
+    values[count]     = module;
+    keys[count + 1]   = am_calendar;
+    values[count + 1] = am_calendar_iso;
+
+    return enif_make_map_from_arrays(env, keys, values, count + 2, out);
 }
 
-static inline void
-connection_configure_progress_handler(connection_t* conn)
+static int
+decode_date(ErlNifEnv* env, const unsigned char* text, int size, ERL_NIF_TERM* out)
 {
-    assert(conn);
-    assert(conn->db);
+    int year, month, day;
 
-    if (conn->progress_handler_steps < 1) {
-        sqlite3_progress_handler(conn->db, 0, NULL, NULL);
-        return;
+    if (size != 10 || !parse_iso8601_date(text, size, &year, &month, &day)) {
+        return 0;
     }
 
-    sqlite3_progress_handler(
-      conn->db,
-      conn->progress_handler_steps,
-      exqlite_progress_handler,
-      conn);
-}
+    ERL_NIF_TERM keys[5]   = {am_year, am_month, am_day};
+    ERL_NIF_TERM values[5] = {
+      enif_make_int(env, year),
+      enif_make_int(env, month),
+      enif_make_int(env, day),
+    };
 
-// ---------------------------------------------------------------------------
-// Custom busy handler
-//
-// Replaces SQLite's default busy handler (which sleeps via sqlite3OsSleep and
-// cannot be interrupted) with one that polls conn->cancelled between each
-// sqlite3_sleep() call.  cancel() sets the flag and calls sqlite3_interrupt()
-// so disconnect() wakes within at most one sleep interval (~10ms).
-// ---------------------------------------------------------------------------
+    return make_calendar_struct(env, am_elixir_date, keys, values, 3, out);
+}
 
+// Accepts "YYYY-MM-DD HH:MM:SS" with a space or "T" separator and up to six
+// fractional digits (more are truncated). A "Z" or an offset makes it a UTC
+// or zoned datetime, which is not naive, so it is rejected.
 static int
-exqlite_busy_handler(void* arg, int count)
+decode_naive_datetime(ErlNifEnv* env, const unsigned char* text, int size, ERL_NIF_TERM* out)
 {
-    connection_t* conn = (connection_t*)arg;
-    int cancelled;
-    int timeout_ms;
-    ErlNifEnv* callback_env;
-    ErlNifPid caller_pid;
+    int year, month, day, hour, minute, second;
+    int microsecond = 0;
+    int precision   = 0;
+    int pos         = 19;
 
-    enif_mutex_lock(conn->interrupt_mutex);
-    cancelled    = conn->cancelled;
-    timeout_ms   = conn->busy_timeout_ms;
-    callback_env = conn->callback_env;
-    caller_pid   = conn->caller_pid;
-    enif_mutex_unlock(conn->interrupt_mutex);
+    if (size < 19 || !parse_iso8601_date(text, size, &year, &month, &day)) {
+        return 0;
+    }
 
-    if (cancelled) {
+    if ((text[10] != ' ' && text[10] != 'T') || text[13] != ':' || text[16] != ':') {
         return 0;
     }
 
-    // Check if the calling process is still alive
-    if (callback_env != NULL && !enif_is_process_alive(callback_env, &caller_pid)) {
-        enif_mutex_lock(conn->interrupt_mutex);
-        conn->cancelled = 1;
-        enif_mutex_unlock(conn->interrupt_mutex);
+    if (!parse_digits(text + 11, 2, &hour) || !parse_digits(text + 14, 2, &minute) || !parse_digits(text + 17, 2, &second)) {
         return 0;
     }
 
-    if (timeout_ms <= 0) {
+    if (hour > 23 || minute > 59 || second > 59) {
         return 0;
     }
 
-    static const int delays[] = {1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50};
-    static const int ndelay   = sizeof(delays) / sizeof(delays[0]);
+    if (pos < size && text[pos] == '.') {
+        pos++;
+        while (pos < size && text[pos] >= '0' && text[pos] <= '9') {
+            if (precision < 6) {
+                microsecond = microsecond * 10 + (text[pos] - '0');
+                precision++;
+            }
+            pos++;
+        }
 
-    int total_waited = 0;
-    for (int i = 0; i < count && i < ndelay; i++) {
-        total_waited += delays[i];
-    }
-    if (count >= ndelay) {
-        total_waited += (count - ndelay) * 50;
+        if (precision == 0) {
+            return 0;
+        }
+
+        for (int i = precision; i < 6; i++) {
+            microsecond *= 10;
+        }
     }
 
-    if (total_waited >= timeout_ms) {
+    if (pos != size) {
         return 0;
     }
 
-    int sleep_ms  = (count < ndelay) ? delays[count] : 50;
-    int remaining = timeout_ms - total_waited;
-    if (sleep_ms > remaining) {
-        sleep_ms = remaining;
+    ERL_NIF_TERM keys[9]   = {am_year, am_month, am_day, am_hour, am_minute, am_second, am_microsecond};
+    ERL_NIF_TERM values[9] = {
+      enif_make_int(env, year),
+      enif_make_int(env, month),
+      enif_make_int(env, day),
+      enif_make_int(env, hour),
+      enif_make_int(env, minute),
+      enif_make_int(env, second),
+      enif_make_tuple2(env, enif_make_int(env, microsecond), enif_make_int(env, precision)),
+    };
+
+    return make_calendar_struct(env, am_elixir_naive_datetime, keys, values, 7, out);
+}
+
+// Only atoms that already exist are returned, so untrusted text can't fill
+// up the atom table.
+static int
+decode_atom(ErlNifEnv* env, const unsigned char* text, int size, ERL_NIF_TERM* out)
+{
+#ifdef EXQLITE_HAS_UTF8_ATOMS
+    return enif_make_existing_atom_len(env, (const char*)text, size, out, ERL_NIF_UTF8);
+#else
+    for (int i = 0; i < size; i++) {
+        if (text[i] >= 0x80) {
+            return 0;
+        }
     }
 
-    sqlite3_sleep(sleep_ms);
+    return enif_make_existing_atom_len(env, (const char*)text, size, out, ERL_NIF_LATIN1);
+#endif
+}
 
-    enif_mutex_lock(conn->interrupt_mutex);
-    cancelled = conn->cancelled;
-    enif_mutex_unlock(conn->interrupt_mutex);
+typedef struct json_parser
+{
+    ErlNifEnv* env;
+    const unsigned char* pos;
+    const unsigned char* end;
+    int depth;
+} json_parser_t;
 
-    return cancelled ? 0 : 1;
+static int json_parse_value(json_parser_t* parser, ERL_NIF_TERM* out);
+
+static void
+json_skip_whitespace(json_parser_t* parser)
+{
+    while (parser->pos < parser->end && (*parser->pos == ' ' || *parser->pos == '\t' || *parser->pos == '\n' || *parser->pos == '\r')) {
+        parser->pos++;
+    }
 }
 
-// Progress handler: fires every N VDBE opcodes.
-// Returns non-zero to interrupt execution when cancelled.
 static int
-exqlite_progress_handler(void* arg)
+json_expect(json_parser_t* parser, const char* literal)
 {
-    connection_t* conn = (connection_t*)arg;
-    int cancelled;
+    size_t len = strlen(literal);
 
-    enif_mutex_lock(conn->interrupt_mutex);
-    cancelled = conn->cancelled;
-    enif_mutex_unlock(conn->interrupt_mutex);
+    if ((size_t)(parser->end - parser->pos) < len || memcmp(parser->pos, literal, len) != 0) {
+        return 0;
+    }
 
-    return cancelled ? 1 : 0;
+    parser->pos += len;
+    return 1;
 }
 
-// Stash the current env + caller pid before a db operation.
-// Must be called while holding conn->mutex.
-static inline void
-connection_stash_caller(connection_t* conn, ErlNifEnv* env)
+static int
+json_parse_hex4(const unsigned char* text, unsigned int* value)
 {
-    enif_mutex_lock(conn->interrupt_mutex);
-    conn->callback_env = env;
-    enif_self(env, &conn->caller_pid);
-    conn->cancelled = 0;
-    enif_mutex_unlock(conn->interrupt_mutex);
+    *value = 0;
+
+    for (int i = 0; i < 4; i++) {
+        unsigned char c = text[i];
+        *value <<= 4;
+
+        if (c >= '0' && c <= '9') {
+            *value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            *value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            *value |= c - 'A' + 10;
+        } else {
+            return 0;
+        }
+    }
+
+    return 1;
 }
 
-// Clear the stashed caller after a db operation completes.
-// Assumes that the `conn` has been locked for clearing the
-// caller.
-static inline void
-connection_clear_caller(connection_t* conn)
+static size_t
+utf8_encode(unsigned int codepoint, unsigned char* out)
 {
-    enif_mutex_lock(conn->interrupt_mutex);
-    conn->callback_env = NULL;
-    enif_mutex_unlock(conn->interrupt_mutex);
+    if (codepoint < 0x80) {
+        out[0] = codepoint;
+        return 1;
+    }
+
+    if (codepoint < 0x800) {
+        out[0] = 0xC0 | (codepoint >> 6);
+        out[1] = 0x80 | (codepoint & 0x3F);
+        return 2;
+    }
+
+    if (codepoint < 0x10000) {
+        out[0] = 0xE0 | (codepoint >> 12);
+        out[1] = 0x80 | ((codepoint >> 6) & 0x3F);
+        out[2] = 0x80 | (codepoint & 0x3F);
+        return 3;
+    }
+
+    out[0] = 0xF0 | (codepoint >> 18);
+    out[1] = 0x80 | ((codepoint >> 12) & 0x3F);
+    out[2] = 0x80 | ((codepoint >> 6) & 0x3F);
+    out[3] = 0x80 | (codepoint & 0x3F);
+    return 4;
 }
 
-///
-/// Opens a new SQLite database
-///
-ERL_NIF_TERM
-exqlite_open(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+static int
+json_parse_string(json_parser_t* parser, ERL_NIF_TERM* out)
 {
-    assert(env);
+    const unsigned char* start;
+    int escaped = 0;
 
-    int flags;
-    int rc             = 0;
-    int size           = 0;
-    connection_t* conn = NULL;
-    sqlite3* db        = NULL;
-    ErlNifMutex* mutex = NULL;
-    ERL_NIF_TERM result;
-    ErlNifBinary bin;
+    if (!json_expect(parser, "\"")) {
+        return 0;
+    }
 
-    ERL_NIF_TERM eos = enif_make_int(env, 0);
+    start = parser->pos;
+    while (parser->pos < parser->end && *parser->pos != '"') {
+        if (*parser->pos < 0x20) {
+            return 0;
+        }
 
-    if (argc != 2) {
-        return enif_make_badarg(env);
+        if (*parser->pos == '\\') {
+            escaped = 1;
+            parser->pos++;
+        }
+        parser->pos++;
     }
 
-    if (!enif_inspect_iolist_as_binary(env, enif_make_list2(env, argv[0], eos), &bin)) {
-        return make_error_tuple(env, am_invalid_filename);
+    if (parser->pos >= parser->end) {
+        return 0;
     }
 
-    if (!enif_get_int(env, argv[1], &flags)) {
-        return make_error_tuple(env, am_invalid_flags);
+    size_t size = parser->pos - start;
+    parser->pos++;
+
+    if (!escaped) {
+        *out = make_binary(parser->env, start, size);
+        return 1;
     }
 
-    rc = sqlite3_open_v2((char*)bin.data, &db, flags, NULL);
-    if (rc != SQLITE_OK) {
-        sqlite3_close_v2(db);
-        return make_error_tuple(env, am_database_open_failed);
+    // Escapes never take more bytes than the text they decode to.
+    unsigned char* buffer = enif_alloc(size);
+    size_t used           = 0;
+    if (!buffer) {
+        return 0;
     }
 
-    mutex = enif_mutex_create("exqlite:connection");
-    if (mutex == NULL) {
-        sqlite3_close_v2(db);
-        return make_error_tuple(env, am_failed_to_create_mutex);
+    for (size_t i = 0; i < size; i++) {
+        if (start[i] != '\\') {
+            buffer[used++] = start[i];
+            continue;
+        }
+
+        unsigned int codepoint;
+        switch (start[++i]) {
+            case '"':
+            case '\\':
+            case '/':
+                buffer[used++] = start[i];
+                break;
+            case 'b':
+                buffer[used++] = '\b';
+                break;
+            case 'f':
+                buffer[used++] = '\f';
+                break;
+            case 'n':
+                buffer[used++] = '\n';
+                break;
+            case 'r':
+                buffer[used++] = '\r';
+                break;
+            case 't':
+                buffer[used++] = '\t';
+                break;
+            case 'u':
+                if (i + 4 >= size || !json_parse_hex4(start + i + 1, &codepoint)) {
+                    enif_free(buffer);
+                    return 0;
+                }
+                i += 4;
+
+                if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+                    unsigned int low;
+                    if (i + 6 >= size || start[i + 1] != '\\' || start[i + 2] != 'u' || !json_parse_hex4(start + i + 3, &low) || low < 0xDC00 || low > 0xDFFF) {
+                        enif_free(buffer);
+                        return 0;
+                    }
+                    i += 6;
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                } else if (codepoint >= 0xDC00 && codepoint <= 0xDFFF) {
+                    enif_free(buffer);
+                    return 0;
+                }
+
+                used += utf8_encode(codepoint, buffer + used);
+                break;
+            default:
+                enif_free(buffer);
+                return 0;
+        }
     }
 
-    conn = enif_alloc_resource(connection_type, sizeof(connection_t));
-    if (!conn) {
-        sqlite3_close_v2(db);
-        enif_mutex_destroy(mutex);
-        return make_error_tuple(env, am_out_of_memory);
+    *out = make_binary(parser->env, buffer, used);
+    enif_free(buffer);
+
+    return 1;
+}
+
+static int
+json_parse_number(json_parser_t* parser, ERL_NIF_TERM* out)
+{
+    char number[JSON_NUMBER_SIZE];
+    const unsigned char* start = parser->pos;
+    const unsigned char* p     = parser->pos;
+    int integer                = 1;
+
+    if (p < parser->end && *p == '-') {
+        p++;
     }
-    conn->db              = db;
-    conn->mutex           = mutex;
-    conn->interrupt_mutex = NULL;
-    memset(conn->authorizer_deny, 0, sizeof(conn->authorizer_deny));
 
-    // Initialize busy handler fields
-    conn->cancelled              = 0;
-    conn->busy_timeout_ms        = 2000; // default matches sqlite3_busy_timeout(db, 2000)
-    conn->progress_handler_steps = 1000;
-    conn->callback_env           = NULL;
+    if (p < parser->end && *p == '0') {
+        p++;
+    } else if (p < parser->end && *p >= '1' && *p <= '9') {
+        while (p < parser->end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    } else {
+        return 0;
+    }
 
-    conn->interrupt_mutex = enif_mutex_create("exqlite:interrupt");
-    if (conn->interrupt_mutex == NULL) {
-        enif_release_resource(conn);
-        return make_error_tuple(env, am_failed_to_create_mutex);
+    if (p < parser->end && *p == '.') {
+        integer = 0;
+        p++;
+        if (p >= parser->end || *p < '0' || *p > '9') {
+            return 0;
+        }
+        while (p < parser->end && *p >= '0' && *p <= '9') {
+            p++;
+        }
     }
 
-    // Install our custom busy handler + progress handler
-    sqlite3_busy_handler(db, exqlite_busy_handler, conn);
-    connection_configure_progress_handler(conn);
+    if (p < parser->end && (*p == 'e' || *p == 'E')) {
+        integer = 0;
+        p++;
+        if (p < parser->end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        if (p >= parser->end || *p < '0' || *p > '9') {
+            return 0;
+        }
+        while (p < parser->end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
 
-    result = enif_make_resource(env, conn);
-    enif_release_resource(conn);
+    // strtod reads the decimal point of the current locale, so the JSON "."
+    // is swapped for it.
+    const char* point = localeconv()->decimal_point;
+    size_t point_size = strlen(point);
+    size_t size       = p - start + point_size;
+    char* buffer      = size < sizeof(number) ? number : enif_alloc(size + 1);
+    char* q           = buffer;
+    int ok            = 1;
 
-    return make_ok_tuple(env, result);
+    if (buffer == NULL) {
+        return 0;
+    }
+
+    for (const unsigned char* c = start; c < p; c++) {
+        if (*c == '.') {
+            memcpy(q, point, point_size);
+            q += point_size;
+        } else {
+            *q++ = (char)*c;
+        }
+    }
+    *q = 0;
+
+    // Integers that don't fit in 64 bits are returned as floats.
+    errno = 0;
+    if (integer) {
+        long long value = strtoll(buffer, NULL, 10);
+        if (errno != ERANGE) {
+            *out = enif_make_int64(parser->env, value);
+        } else {
+            integer = 0;
+            errno   = 0;
+        }
+    }
+
+    // Underflow returns a denormal or zero, which is kept. Overflow has no
+    // Erlang float to map to.
+    if (!integer) {
+        double value = strtod(buffer, NULL);
+        if (errno == ERANGE && (value == HUGE_VAL || value == -HUGE_VAL)) {
+            ok = 0;
+        } else {
+            *out = enif_make_double(parser->env, value);
+        }
+    }
+
+    if (buffer != number) {
+        enif_free(buffer);
+    }
+
+    if (!ok) {
+        return 0;
+    }
+
+    parser->pos = p;
+    return 1;
 }
 
-///
-/// Closes an SQLite database
-///
-ERL_NIF_TERM
-exqlite_close(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+static int
+json_parse_array(json_parser_t* parser, ERL_NIF_TERM* out)
 {
-    assert(env);
+    ERL_NIF_TERM list = enif_make_list(parser->env, 0);
+    ERL_NIF_TERM value;
 
-    connection_t* conn = NULL;
-    int rc             = SQLITE_OK;
+    parser->pos++;
+    json_skip_whitespace(parser);
 
-    if (argc != 1) {
-        return enif_make_badarg(env);
+    if (parser->pos < parser->end && *parser->pos == ']') {
+        parser->pos++;
+        *out = list;
+        return 1;
     }
 
-    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
-        return make_error_tuple(env, am_invalid_connection);
+    for (;;) {
+        if (!json_parse_value(parser, &value)) {
+            return 0;
+        }
+
+        list = enif_make_list_cell(parser->env, value, list);
+        json_skip_whitespace(parser);
+
+        if (parser->pos < parser->end && *parser->pos == ',') {
+            parser->pos++;
+            continue;
+        }
+
+        if (!json_expect(parser, "]")) {
+            return 0;
+        }
+
+        return enif_make_reverse_list(parser->env, list, out);
     }
+}
 
-    // close connection in critical section to avoid race-condition
-    // cases. Cases such as query timeout and connection pooling
-    // attempting to close the connection
-    connection_acquire_lock(conn);
-    connection_stash_caller(conn, env);
+// Duplicate keys keep the last value.
+static int
+json_parse_object(json_parser_t* parser, ERL_NIF_TERM* out)
+{
+    ERL_NIF_TERM map = enif_make_new_map(parser->env);
+    ERL_NIF_TERM key;
+    ERL_NIF_TERM value;
 
-    // DB is already closed, nothing to do here.
-    if (conn->db == NULL) {
-        connection_clear_caller(conn);
-        connection_release_lock(conn);
-        return am_ok;
+    parser->pos++;
+    json_skip_whitespace(parser);
+
+    if (parser->pos < parser->end && *parser->pos == '}') {
+        parser->pos++;
+        *out = map;
+        return 1;
     }
 
-    int autocommit = sqlite3_get_autocommit(conn->db);
-    if (autocommit == 0) {
-        rc = sqlite3_exec(conn->db, "ROLLBACK;", NULL, NULL, NULL);
-        if (rc != SQLITE_OK) {
-            connection_clear_caller(conn);
-            connection_release_lock(conn);
-            return make_sqlite3_error_tuple(env, rc, conn->db);
+    for (;;) {
+        json_skip_whitespace(parser);
+        if (!json_parse_string(parser, &key)) {
+            return 0;
         }
-    }
+
+        json_skip_whitespace(parser);
+        if (!json_expect(parser, ":") || !json_parse_value(parser, &value)) {
+            return 0;
+        }
+
+        if (!enif_make_map_put(parser->env, map, key, value, &map)) {
+            return 0;
+        }
+
+        json_skip_whitespace(parser);
+
+        if (parser->pos < parser->end && *parser->pos == ',') {
+            parser->pos++;
+            continue;
+        }
+
+        if (!json_expect(parser, "}")) {
+            return 0;
+        }
+
+        *out = map;
+        return 1;
+    }
+}
+
+static int
+json_parse_value(json_parser_t* parser, ERL_NIF_TERM* out)
+{
+    int ok;
+
+    json_skip_whitespace(parser);
+    if (parser->pos >= parser->end) {
+        return 0;
+    }
+
+    switch (*parser->pos) {
+        case '"':
+            return json_parse_string(parser, out);
+
+        case '[':
+        case '{':
+            if (++parser->depth > JSON_MAX_DEPTH) {
+                return 0;
+            }
+            ok = *parser->pos == '[' ? json_parse_array(parser, out) : json_parse_object(parser, out);
+            parser->depth--;
+            return ok;
+
+        case 't':
+            *out = am_true;
+            return json_expect(parser, "true");
+
+        case 'f':
+            *out = am_false;
+            return json_expect(parser, "false");
+
+        case 'n':
+            *out = am_nil;
+            return json_expect(parser, "null");
+
+        default:
+            return json_parse_number(parser, out);
+    }
+}
+
+static int
+decode_json(ErlNifEnv* env, const unsigned char* text, int size, ERL_NIF_TERM* out)
+{
+    json_parser_t parser = {env, text, text + size, 0};
+
+    if (!json_parse_value(&parser, out)) {
+        return 0;
+    }
+
+    json_skip_whitespace(&parser);
+    return parser.pos == parser.end;
+}
+
+// Applies `hint` to column `i` of the current row. Returns 0 when the value
+// should be returned as is.
+static int
+decode_cell(ErlNifEnv* env, sqlite3_stmt* statement, unsigned int i, int hint, ERL_NIF_TERM* out)
+{
+    int type = sqlite3_column_type(statement, i);
+
+    if (hint == DECODE_BOOLEAN) {
+        if (type != SQLITE_INTEGER) {
+            return 0;
+        }
+
+        *out = sqlite3_column_int64(statement, i) ? am_true : am_false;
+        return 1;
+    }
+
+    if (type != SQLITE_TEXT) {
+        return 0;
+    }
+
+    const unsigned char* text = sqlite3_column_text(statement, i);
+    int size                  = sqlite3_column_bytes(statement, i);
+
+    switch (hint) {
+        case DECODE_NAIVE_DATETIME:
+            return decode_naive_datetime(env, text, size, out);
+
+        case DECODE_DATE:
+            return decode_date(env, text, size, out);
+
+        case DECODE_JSON:
+            return decode_json(env, text, size, out);
+
+        case DECODE_ATOM_FROM_TEXT:
+            return decode_atom(env, text, size, out);
+
+        default:
+            return 0;
+    }
+}
+
+// Parses the row format argument, `list` or `tuple`.
+static int
+get_row_format(ErlNifEnv* env, ERL_NIF_TERM term, int* tuples)
+{
+    if (enif_is_identical(term, am_tuple)) {
+        *tuples = 1;
+        return 1;
+    }
+
+    if (enif_is_identical(term, am_list)) {
+        *tuples = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+// How rows are built: as lists or tuples, with optional decode hints.
+typedef struct row_options
+{
+    int tuples;
+    int* decode;
+    unsigned int decode_count;
+} row_options_t;
+
+// Parses the row format and decode hint arguments. Returns 0 if either is
+// invalid, with nothing left to free.
+static int
+get_row_options(ErlNifEnv* env, ERL_NIF_TERM format, ERL_NIF_TERM hints, row_options_t* options)
+{
+    memset(options, 0, sizeof(row_options_t));
+
+    return get_row_format(env, format, &options->tuples) && get_decode_hints(env, hints, &options->decode, &options->decode_count);
+}
+
+static int
+row_options_copy(row_options_t* dst, const row_options_t* src)
+{
+    *dst        = *src;
+    dst->decode = NULL;
+
+    if (src->decode_count == 0) {
+        return 1;
+    }
+
+    dst->decode = enif_alloc(sizeof(int) * src->decode_count);
+    if (!dst->decode) {
+        return 0;
+    }
+
+    memcpy(dst->decode, src->decode, sizeof(int) * src->decode_count);
+
+    return 1;
+}
+
+static int
+row_options_equal(const row_options_t* a, const row_options_t* b)
+{
+    if (a->tuples != b->tuples || a->decode_count != b->decode_count) {
+        return 0;
+    }
+
+    return a->decode_count == 0 || memcmp(a->decode, b->decode, sizeof(int) * a->decode_count) == 0;
+}
+
+static void
+row_options_free(row_options_t* options)
+{
+    if (options->decode) {
+        enif_free(options->decode);
+        options->decode = NULL;
+    }
+}
+
+//
+// Chunk decoding
+//
+// Rows stepped in one NIF call share a single arena binary for their TEXT and
+// BLOB values. Every value larger than a heap binary is appended to the arena
+// and handed out as a sub-binary once the chunk is complete, so a chunk costs
+// one refc binary allocation instead of one per cell. Values of at most
+// HEAP_BINARY_LIMIT bytes are copied straight onto the process heap.
+//
+// A sub-binary keeps its whole arena alive, same as any other sub-binary. So
+// that one value kept from a large fetch_all does not pin every value of the
+// timeslice, an arena is sealed once it would grow past CHUNK_ARENA_MAX_SIZE
+// and the following values go to a new one. A kept value therefore pins at
+// most CHUNK_ARENA_MAX_SIZE bytes, or its own size when it is larger.
+//
+
+#define HEAP_BINARY_LIMIT        64
+#define CHUNK_ARENA_INITIAL_SIZE 4096
+#define CHUNK_ARENA_MAX_SIZE     (256 * 1024)
+
+typedef struct arena_slice
+{
+    size_t cell;
+    size_t offset;
+    size_t size;
+} arena_slice_t;
+
+typedef struct chunk
+{
+    unsigned int columns; // cells per row
+    const row_options_t* options;
+    query_stats_t* stats; // NULL unless query stats are collected
+    size_t rows;
+    ERL_NIF_TERM* cells; // row major
+    size_t cells_capacity;
+    ErlNifBinary arena;
+    size_t arena_used;
+    arena_slice_t* slices; // cells to point into the arena once it is final
+    size_t slices_used;
+    size_t slices_capacity;
+} chunk_t;
+
+// The query stats of the connection, or NULL when they are not collected.
+// The connection lock must be held.
+static inline query_stats_t*
+connection_query_stats(connection_t* conn)
+{
+    return conn->query_stats.enabled ? &conn->query_stats : NULL;
+}
+
+// `stats` is where the chunk's work is counted, NULL to not count it.
+static void
+chunk_init(chunk_t* chunk, unsigned int columns, const row_options_t* options, query_stats_t* stats)
+{
+    memset(chunk, 0, sizeof(chunk_t));
+    chunk->columns = columns;
+    chunk->options = options;
+    chunk->stats   = stats;
+}
+
+// sqlite3_step, timed into the query stats when they are collected.
+static int
+chunk_step(chunk_t* chunk, sqlite3_stmt* statement)
+{
+    if (!chunk->stats) {
+        return sqlite3_step(statement);
+    }
+
+    ErlNifTime started = enif_monotonic_time(ERL_NIF_NSEC);
+    int rc             = sqlite3_step(statement);
+    chunk->stats->step_ns += enif_monotonic_time(ERL_NIF_NSEC) - started;
+
+    return rc;
+}
+
+static void
+chunk_free(chunk_t* chunk)
+{
+    if (chunk->cells) {
+        enif_free(chunk->cells);
+        chunk->cells = NULL;
+    }
+
+    if (chunk->slices) {
+        enif_free(chunk->slices);
+        chunk->slices = NULL;
+    }
+
+    if (chunk->arena.data) {
+        enif_release_binary(&chunk->arena);
+        chunk->arena.data = NULL;
+    }
+}
+
+// Grows `*items` to hold at least `needed` elements of `item_size` bytes.
+static int
+chunk_reserve(void** items, size_t* capacity, size_t needed, size_t item_size)
+{
+    if (needed <= *capacity) {
+        return 1;
+    }
+
+    size_t grown = *capacity ? *capacity * 2 : 16;
+    while (grown < needed) {
+        grown *= 2;
+    }
+
+    void* resized = *items ? enif_realloc(*items, grown * item_size) : enif_alloc(grown * item_size);
+    if (!resized) {
+        return 0;
+    }
+
+    *items    = resized;
+    *capacity = grown;
+
+    return 1;
+}
+
+// Turns the arena into a binary term and points its pending cells at it. The
+// next value larger than a heap binary starts a new arena.
+static void
+chunk_seal_arena(ErlNifEnv* env, chunk_t* chunk)
+{
+    if (!chunk->arena.data) {
+        return;
+    }
+
+    if (chunk->arena_used < chunk->arena.size) {
+        enif_realloc_binary(&chunk->arena, chunk->arena_used);
+    }
+
+    ERL_NIF_TERM arena = enif_make_binary(env, &chunk->arena);
+    chunk->arena.data  = NULL;
+
+    for (size_t i = 0; i < chunk->slices_used; i++) {
+        arena_slice_t* slice        = &chunk->slices[i];
+        chunk->cells[slice->cell] = enif_make_sub_binary(env, arena, slice->offset, slice->size);
+    }
+
+    chunk->arena_used  = 0;
+    chunk->slices_used = 0;
+}
+
+static int
+chunk_add_bytes(ErlNifEnv* env, chunk_t* chunk, size_t cell, const void* bytes, size_t size)
+{
+    if (chunk->stats) {
+        chunk->stats->bytes += size;
+    }
+
+    if (size <= HEAP_BINARY_LIMIT) {
+        unsigned char* data = enif_make_new_binary(env, size, &chunk->cells[cell]);
+        if (!data) {
+            return 0;
+        }
+        if (size > 0) {
+            memcpy(data, bytes, size);
+        }
+        return 1;
+    }
+
+    size_t needed = chunk->arena_used + size;
+    if (chunk->arena.data && needed > CHUNK_ARENA_MAX_SIZE) {
+        chunk_seal_arena(env, chunk);
+        needed = size;
+    }
+
+    if (!chunk->arena.data) {
+        if (!enif_alloc_binary(needed > CHUNK_ARENA_INITIAL_SIZE ? needed : CHUNK_ARENA_INITIAL_SIZE, &chunk->arena)) {
+            return 0;
+        }
+    } else if (needed > chunk->arena.size) {
+        size_t grown = chunk->arena.size * 2;
+        if (grown > CHUNK_ARENA_MAX_SIZE) {
+            grown = CHUNK_ARENA_MAX_SIZE;
+        }
+        if (!enif_realloc_binary(&chunk->arena, grown > needed ? grown : needed)) {
+            return 0;
+        }
+    }
+
+    if (!chunk_reserve((void**)&chunk->slices, &chunk->slices_capacity, chunk->slices_used + 1, sizeof(arena_slice_t))) {
+        return 0;
+    }
+
+    memcpy(chunk->arena.data + chunk->arena_used, bytes, size);
+
+    arena_slice_t* slice = &chunk->slices[chunk->slices_used++];
+    slice->cell          = cell;
+    slice->offset        = chunk->arena_used;
+    slice->size          = size;
+
+    chunk->arena_used  = needed;
+    chunk->cells[cell] = am_nil;
+
+    return 1;
+}
+
+// Copies the current row of `statement` into the chunk.
+static int
+chunk_add_row(ErlNifEnv* env, chunk_t* chunk, sqlite3_stmt* statement)
+{
+    size_t base = chunk->rows * chunk->columns;
+
+    if (!chunk_reserve((void**)&chunk->cells, &chunk->cells_capacity, base + chunk->columns, sizeof(ERL_NIF_TERM))) {
+        return 0;
+    }
+
+    const row_options_t* options = chunk->options;
+    ErlNifTime started           = chunk->stats ? enif_monotonic_time(ERL_NIF_NSEC) : 0;
+
+    for (unsigned int i = 0; i < chunk->columns; i++) {
+        size_t cell = base + i;
+
+        if (i < options->decode_count && options->decode[i] != DECODE_RAW && decode_cell(env, statement, i, options->decode[i], &chunk->cells[cell])) {
+            continue;
+        }
+
+        switch (sqlite3_column_type(statement, i)) {
+            case SQLITE_INTEGER:
+                chunk->cells[cell] = enif_make_int64(env, sqlite3_column_int64(statement, i));
+                break;
+
+            case SQLITE_FLOAT:
+                chunk->cells[cell] = enif_make_double(env, sqlite3_column_double(statement, i));
+                break;
+
+            case SQLITE_BLOB:
+                if (!chunk_add_bytes(env, chunk, cell, sqlite3_column_blob(statement, i), sqlite3_column_bytes(statement, i))) {
+                    return 0;
+                }
+                break;
+
+            case SQLITE_TEXT:
+                if (!chunk_add_bytes(env, chunk, cell, sqlite3_column_text(statement, i), sqlite3_column_bytes(statement, i))) {
+                    return 0;
+                }
+                break;
+
+            default:
+                chunk->cells[cell] = am_nil;
+                break;
+        }
+    }
+
+    chunk->rows++;
+
+    if (chunk->stats) {
+        chunk->stats->decode_ns += enif_monotonic_time(ERL_NIF_NSEC) - started;
+        chunk->stats->rows++;
+    }
+
+    return 1;
+}
+
+// Points the cells still pending at the last arena. Must be called once,
+// after the last row was added.
+static void
+chunk_finish(ErlNifEnv* env, chunk_t* chunk)
+{
+    chunk_seal_arena(env, chunk);
+}
+
+static ERL_NIF_TERM
+chunk_row(ErlNifEnv* env, chunk_t* chunk, size_t row)
+{
+    ERL_NIF_TERM* cells = chunk->cells + row * chunk->columns;
+
+    if (chunk->options->tuples) {
+        return enif_make_tuple_from_array(env, cells, chunk->columns);
+    }
+
+    return enif_make_list_from_array(env, cells, chunk->columns);
+}
+
+// Returns the rows of the chunk in order, followed by `tail`.
+static ERL_NIF_TERM
+chunk_rows(ErlNifEnv* env, chunk_t* chunk, ERL_NIF_TERM tail)
+{
+    for (size_t row = chunk->rows; row > 0; row--) {
+        tail = enif_make_list_cell(env, chunk_row(env, chunk, row - 1), tail);
+    }
+
+    return tail;
+}
+
+// Prepends the rows of the chunk to `rows`, so the last row ends up first.
+static ERL_NIF_TERM
+chunk_prepend_rows(ErlNifEnv* env, chunk_t* chunk, ERL_NIF_TERM rows)
+{
+    for (size_t row = 0; row < chunk->rows; row++) {
+        rows = enif_make_list_cell(env, chunk_row(env, chunk, row), rows);
+    }
+
+    return rows;
+}
+
+// ---------------------------------------------------------------------------
+// Write lock arbiter
+//
+// SQLite's busy handler can only retry after sleeping, so a waiter keeps
+// sleeping out its backoff long after the writer it waits on has committed,
+// and whoever retries first wins. Connections in this VM that share a
+// database file therefore share an arbiter. The commit and rollback hooks
+// note that a connection ended a write transaction, and once the SQLite call
+// that ended it returns, connection_release_lock wakes the oldest waiter.
+// Waiters queue in the order their busy handlers first ran and only the head
+// of the queue retries, so the lock is granted first come, first served.
+//
+// Only connections waiting to take the write lock queue. A reader blocked by
+// a writer's PENDING lock, or a writer that holds the write lock and waits for
+// readers to let go before it commits, could otherwise end up at the head of
+// the queue in front of the very connection it waits on. Those keep using the
+// plain backoff.
+// ---------------------------------------------------------------------------
+
+// Returns the arbiter for `path`, creating it on first use. In-memory and
+// temporary databases have no lock to share and get NULL, as does running out
+// of memory. Either way the busy handler falls back to its backoff.
+static write_arbiter_t*
+write_arbiter_acquire(const char* path)
+{
+    write_arbiter_t* arbiter = NULL;
+    size_t length;
+
+    if (path == NULL || path[0] == '\0') {
+        return NULL;
+    }
+
+    enif_mutex_lock(write_arbiters_mutex);
+
+    for (arbiter = write_arbiters; arbiter != NULL; arbiter = arbiter->next) {
+        if (strcmp(arbiter->path, path) == 0) {
+            arbiter->refs++;
+            break;
+        }
+    }
+
+    if (arbiter == NULL) {
+        length  = strlen(path);
+        arbiter = enif_alloc(sizeof(write_arbiter_t) + length + 1);
+        if (arbiter != NULL) {
+            memset(arbiter, 0, sizeof(write_arbiter_t));
+            arbiter->path = (char*)(arbiter + 1);
+            memcpy(arbiter->path, path, length + 1);
+            arbiter->refs = 1;
+            ARBITER_LOCK_INIT(&arbiter->lock);
+            ARBITER_COND_INIT(&arbiter->cond);
+
+            arbiter->next  = write_arbiters;
+            write_arbiters = arbiter;
+        }
+    }
+
+    enif_mutex_unlock(write_arbiters_mutex);
+
+    return arbiter;
+}
+
+static void
+write_arbiter_release(write_arbiter_t* arbiter)
+{
+    write_arbiter_t** link;
+
+    enif_mutex_lock(write_arbiters_mutex);
+
+    if (--arbiter->refs > 0) {
+        enif_mutex_unlock(write_arbiters_mutex);
+        return;
+    }
+
+    for (link = &write_arbiters; *link != arbiter; link = &(*link)->next) {
+    }
+    *link = arbiter->next;
+
+    enif_mutex_unlock(write_arbiters_mutex);
+
+    ARBITER_COND_DESTROY(&arbiter->cond);
+    ARBITER_LOCK_DESTROY(&arbiter->lock);
+    enif_free(arbiter);
+}
+
+// arbiter->lock must be held.
+static void
+write_arbiter_dequeue(write_arbiter_t* arbiter, connection_t* conn)
+{
+    connection_t** link = &arbiter->head;
+    connection_t* prev  = NULL;
+
+    while (*link != conn) {
+        prev = *link;
+        link = &(*link)->arbiter_next;
+    }
+
+    *link = conn->arbiter_next;
+    if (arbiter->tail == conn) {
+        arbiter->tail = prev;
+    }
+
+    conn->arbiter_next   = NULL;
+    conn->arbiter_queued = 0;
+    conn->arbiter_ready  = 0;
+}
+
+// Called from connection_release_lock, after the SQLite calls made under
+// conn->mutex have returned. Leaves the queue once the busy handler is done
+// waiting, and hands the lock to the next waiter when this connection left
+// the queue head or ended a write transaction.
+static void
+write_arbiter_leave(connection_t* conn)
+{
+    write_arbiter_t* arbiter = conn->arbiter;
+    int was_head             = 0;
+    int ended                = 0;
+
+    // An open transaction still holds the lock, even after a failed COMMIT.
+    if (conn->arbiter_wrote && (conn->db == NULL || sqlite3_get_autocommit(conn->db))) {
+        conn->arbiter_wrote = 0;
+        ended               = 1;
+    }
+
+    if (!ended && !conn->arbiter_queued) {
+        return;
+    }
+
+    ARBITER_LOCK(&arbiter->lock);
+
+    if (conn->arbiter_queued) {
+        was_head = arbiter->head == conn;
+        write_arbiter_dequeue(arbiter, conn);
+    }
+
+    if (arbiter->head != NULL && (ended || was_head)) {
+        arbiter->head->arbiter_ready = 1;
+        ARBITER_BROADCAST(&arbiter->cond);
+    }
+
+    ARBITER_UNLOCK(&arbiter->lock);
+}
+
+static int
+exqlite_commit_hook(void* arg)
+{
+    ((connection_t*)arg)->arbiter_wrote = 1;
+    return 0;
+}
+
+static void
+exqlite_rollback_hook(void* arg)
+{
+    ((connection_t*)arg)->arbiter_wrote = 1;
+}
+
+// Only measures the wait when the lock is actually contended, so the common
+// case costs one trylock.
+static inline void
+connection_acquire_lock(connection_t* conn)
+{
+    assert(conn);
+
+    ErlNifTime waited = 0;
+
+    if (enif_mutex_trylock(conn->mutex) != 0) {
+        ErlNifTime started = enif_monotonic_time(ERL_NIF_NSEC);
+        enif_mutex_lock(conn->mutex);
+        waited = enif_monotonic_time(ERL_NIF_NSEC) - started;
+    }
+
+    ATOMIC_ADD_INT64(&conn->stats.lock_acquisitions, 1);
+    if (waited > 0) {
+        ATOMIC_ADD_INT64(&conn->stats.lock_contended, 1);
+        ATOMIC_ADD_INT64(&conn->stats.lock_wait_ns, waited);
+        atomic_max_int64(&conn->stats.lock_max_wait_ns, waited);
+    }
+}
+
+// Like connection_acquire_lock for NIFs on a normal scheduler, which must not
+// wait for a query. Returns 0 without the lock when it is held elsewhere.
+static inline int
+connection_try_acquire_lock(connection_t* conn)
+{
+    assert(conn);
+
+    if (enif_mutex_trylock(conn->mutex) != 0) {
+        return 0;
+    }
+
+    ATOMIC_ADD_INT64(&conn->stats.lock_acquisitions, 1);
+
+    return 1;
+}
+
+static inline void
+connection_release_lock(connection_t* conn)
+{
+    assert(conn);
+
+    if (conn->arbiter) {
+        write_arbiter_leave(conn);
+    }
+
+    enif_mutex_unlock(conn->mutex);
+}
+
+static inline void
+statement_acquire_lock(statement_t* statement)
+{
+    assert(statement);
+    connection_acquire_lock(statement->conn);
+}
+
+// Returns the time a query phase started, when query stats are collected.
+static inline ErlNifTime
+query_stats_clock(connection_t* conn)
+{
+    return conn->query_stats.enabled ? enif_monotonic_time(ERL_NIF_NSEC) : 0;
+}
+
+// Adds the time since `started` to a query stats counter, when they are
+// collected. The connection lock must be held.
+static inline void
+query_stats_add(connection_t* conn, ErlNifUInt64* counter, ErlNifTime started)
+{
+    if (conn->query_stats.enabled) {
+        *counter += enif_monotonic_time(ERL_NIF_NSEC) - started;
+    }
+}
+
+// Counts a row decoded since `started` by a path that does not go through a
+// chunk, along with the bytes of its TEXT and BLOB values.
+static void
+query_stats_count_row(connection_t* conn, sqlite3_stmt* statement, int count, ErlNifTime started)
+{
+    if (!conn->query_stats.enabled) {
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int type = sqlite3_column_type(statement, i);
+        if (type == SQLITE_TEXT || type == SQLITE_BLOB) {
+            conn->query_stats.bytes += sqlite3_column_bytes(statement, i);
+        }
+    }
+
+    conn->query_stats.rows++;
+    query_stats_add(conn, &conn->query_stats.decode_ns, started);
+}
+
+// Credits work counted elsewhere, by a prefetch job, to the connection. The
+// connection lock must be held.
+static void
+query_stats_merge(connection_t* conn, const query_stats_t* stats)
+{
+    if (conn->query_stats.enabled) {
+        conn->query_stats.step_ns += stats->step_ns;
+        conn->query_stats.decode_ns += stats->decode_ns;
+        conn->query_stats.rows += stats->rows;
+        conn->query_stats.bytes += stats->bytes;
+    }
+}
+
+static inline void
+statement_release_lock(statement_t* statement)
+{
+    assert(statement);
+    connection_release_lock(statement->conn);
+}
+
+// Caches the column names, declared types and readonly flag of the statement.
+// The statement lock must be held.
+static int
+statement_cache_metadata(statement_t* statement)
+{
+    ERL_NIF_TERM* terms;
+    int count = sqlite3_column_count(statement->statement);
+
+    if (statement->env) {
+        enif_clear_env(statement->env);
+    } else {
+        statement->env = enif_alloc_env();
+        if (!statement->env) {
+            return 0;
+        }
+    }
+
+    // Invalidate first so a failure below is retried on the next call.
+    statement->reprepared = -1;
+
+    terms = enif_alloc(sizeof(ERL_NIF_TERM) * (count > 0 ? count * 2 : 1));
+    if (!terms) {
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const char* name     = sqlite3_column_name(statement->statement, i);
+        const char* declared = sqlite3_column_decltype(statement->statement, i);
+        if (!name) {
+            enif_free(terms);
+            return 0;
+        }
+
+        terms[i]         = make_binary(statement->env, name, strlen(name));
+        terms[count + i] = declared ? make_binary(statement->env, declared, strlen(declared)) : am_nil;
+    }
+
+    statement->columns      = enif_make_list_from_array(statement->env, terms, count);
+    statement->column_types = enif_make_list_from_array(statement->env, terms + count, count);
+    statement->readonly     = sqlite3_stmt_readonly(statement->statement);
+    statement->reprepared   = sqlite3_stmt_status(statement->statement, SQLITE_STMTSTATUS_REPREPARE, 0);
+
+    enif_free(terms);
+
+    return 1;
+}
+
+// Refreshes the cached metadata if SQLite recompiled the statement since it
+// was cached, for example after a schema change. The statement lock must be
+// held.
+static int
+statement_ensure_metadata(statement_t* statement)
+{
+    if (statement->reprepared == sqlite3_stmt_status(statement->statement, SQLITE_STMTSTATUS_REPREPARE, 0)) {
+        return 1;
+    }
+
+    return statement_cache_metadata(statement);
+}
+
+static inline void
+connection_configure_progress_handler(connection_t* conn)
+{
+    assert(conn);
+    assert(conn->db);
+
+    if (conn->progress_handler_steps < 1) {
+        sqlite3_progress_handler(conn->db, 0, NULL, NULL);
+        return;
+    }
+
+    sqlite3_progress_handler(
+      conn->db,
+      conn->progress_handler_steps,
+      exqlite_progress_handler,
+      conn);
+}
+
+// ---------------------------------------------------------------------------
+// Custom busy handler
+//
+// Replaces SQLite's default busy handler (which sleeps via sqlite3OsSleep and
+// cannot be interrupted) with one that polls conn->cancelled between each
+// sqlite3_sleep() call.  cancel() sets the flag and calls sqlite3_interrupt()
+// so disconnect() wakes within at most one sleep interval (~10ms).
+// It also gives up once the connection's or the running call's deadline has
+// passed, and never sleeps past it.
+// ---------------------------------------------------------------------------
+
+// The earlier of the connection's deadline and the one of the running call.
+static inline ErlNifSInt64
+connection_deadline(connection_t* conn)
+{
+    ErlNifSInt64 deadline      = ATOMIC_LOAD_INT64(&conn->deadline);
+    ErlNifSInt64 call_deadline = ATOMIC_LOAD_INT64(&conn->call_deadline);
+    return call_deadline < deadline ? call_deadline : deadline;
+}
+
+// Milliseconds left until the connection's deadline, INT_MAX without one.
+static int
+connection_deadline_remaining_ms(connection_t* conn)
+{
+    ErlNifSInt64 deadline = connection_deadline(conn);
+    if (deadline == NO_DEADLINE) {
+        return INT_MAX;
+    }
+
+    ErlNifSInt64 remaining = deadline - enif_monotonic_time(ERL_NIF_NSEC);
+    if (remaining <= 0) {
+        return 0;
+    }
+
+    remaining = (remaining + 999999) / 1000000;
+    return remaining > INT_MAX ? INT_MAX : (int)remaining;
+}
+
+// Whether the busy handler was called for a statement that needs the write
+// lock the connection does not hold yet, the only wait the arbiter orders.
+// BEGIN IMMEDIATE and BEGIN EXCLUSIVE are not readonly, unlike COMMIT.
+static int
+connection_awaits_write_lock(connection_t* conn)
+{
+    if (sqlite3_txn_state(conn->db, NULL) == SQLITE_TXN_WRITE) {
+        return 0;
+    }
+
+    for (sqlite3_stmt* stmt = sqlite3_next_stmt(conn->db, NULL); stmt != NULL; stmt = sqlite3_next_stmt(conn->db, stmt)) {
+        if (sqlite3_stmt_busy(stmt) && !sqlite3_stmt_readonly(stmt)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Busy handler for connections with a write lock arbiter. Queues the
+// connection and waits until it is the oldest waiter and the lock was
+// released, or, as the oldest waiter, until WRITE_ARBITER_POLL_MS pass.
+// Returns 1 to retry and 0 to give up, like the busy handler.
+static int
+write_arbiter_wait(connection_t* conn, int timeout_ms, ErlNifEnv* callback_env, ErlNifPid* caller_pid)
+{
+    write_arbiter_t* arbiter = conn->arbiter;
+    ErlNifTime entered       = enif_monotonic_time(ERL_NIF_MSEC);
+    int retry                = 0;
+    int timed_out            = 0;
+    int wait_ms;
+    int deadline_ms;
+
+    ARBITER_LOCK(&arbiter->lock);
+
+    if (!conn->arbiter_queued) {
+        conn->arbiter_next   = NULL;
+        conn->arbiter_queued = 1;
+        if (arbiter->tail) {
+            arbiter->tail->arbiter_next = conn;
+        } else {
+            arbiter->head = conn;
+        }
+        arbiter->tail = conn;
+
+        // The lock may have been released between SQLite's failed attempt and
+        // joining the queue, so a waiter that starts at the head retries once.
+        conn->arbiter_ready = arbiter->head == conn;
+    }
+
+    for (;;) {
+        if (ATOMIC_LOAD_INT64(&conn->cancelled)) {
+            break;
+        }
+
+        if (callback_env != NULL && !enif_is_process_alive(callback_env, caller_pid)) {
+            ATOMIC_STORE_INT64(&conn->cancelled, 1);
+            break;
+        }
+
+        if (conn->arbiter_ready) {
+            conn->arbiter_ready = 0;
+            retry               = 1;
+            break;
+        }
+
+        wait_ms     = timeout_ms - (int)(enif_monotonic_time(ERL_NIF_MSEC) - conn->busy_started);
+        deadline_ms = connection_deadline_remaining_ms(conn);
+        if (wait_ms <= 0 || deadline_ms == 0) {
+            timed_out = 1;
+            break;
+        }
+
+        if (wait_ms > deadline_ms) {
+            wait_ms = deadline_ms;
+        }
+        if (wait_ms > WRITE_ARBITER_POLL_MS) {
+            wait_ms = WRITE_ARBITER_POLL_MS;
+        }
+
+        ARBITER_TIMED_WAIT(&arbiter->cond, &arbiter->lock, wait_ms);
+
+        if (arbiter->head == conn) {
+            conn->arbiter_ready = 1;
+        }
+    }
+
+    ARBITER_UNLOCK(&arbiter->lock);
+
+    // The connection stays queued until connection_release_lock, also when
+    // giving up, so the next waiter is only woken once SQLite is done with it.
+    ATOMIC_ADD_INT64(&conn->stats.busy_sleep_ms, enif_monotonic_time(ERL_NIF_MSEC) - entered);
+    if (timed_out) {
+        ATOMIC_ADD_INT64(&conn->stats.busy_timeouts, 1);
+    }
+
+    return retry;
+}
+
+static int
+exqlite_busy_handler(void* arg, int count)
+{
+    connection_t* conn = (connection_t*)arg;
+    int timeout_ms;
+    int deadline_ms;
+    ErlNifEnv* callback_env;
+    ErlNifPid caller_pid;
+
+    enif_mutex_lock(conn->interrupt_mutex);
+    timeout_ms   = conn->busy_timeout_ms;
+    callback_env = conn->callback_env;
+    caller_pid   = conn->caller_pid;
+    enif_mutex_unlock(conn->interrupt_mutex);
+
+    ATOMIC_ADD_INT64(&conn->stats.busy_handler_calls, 1);
+
+    // Set whichever path handles the call, a wait can start polling and move
+    // to the arbiter once the statement holds a write lock request.
+    if (count == 0) {
+        conn->busy_started = enif_monotonic_time(ERL_NIF_MSEC);
+    }
+
+    if (ATOMIC_LOAD_INT64(&conn->cancelled)) {
+        return 0;
+    }
+
+    // Check if the calling process is still alive
+    if (callback_env != NULL && !enif_is_process_alive(callback_env, &caller_pid)) {
+        ATOMIC_STORE_INT64(&conn->cancelled, 1);
+        return 0;
+    }
+
+    deadline_ms = connection_deadline_remaining_ms(conn);
+
+    if (timeout_ms <= 0 || deadline_ms == 0) {
+        ATOMIC_ADD_INT64(&conn->stats.busy_timeouts, 1);
+        return 0;
+    }
+
+    if (conn->arbiter && connection_awaits_write_lock(conn)) {
+        return write_arbiter_wait(conn, timeout_ms, callback_env, &caller_pid);
+    }
+
+    static const int delays[] = {1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50};
+    static const int ndelay   = sizeof(delays) / sizeof(delays[0]);
+
+    int total_waited = 0;
+    for (int i = 0; i < count && i < ndelay; i++) {
+        total_waited += delays[i];
+    }
+    if (count >= ndelay) {
+        total_waited += (count - ndelay) * 50;
+    }
+
+    if (total_waited >= timeout_ms) {
+        ATOMIC_ADD_INT64(&conn->stats.busy_timeouts, 1);
+        return 0;
+    }
+
+    int sleep_ms  = (count < ndelay) ? delays[count] : 50;
+    int remaining = timeout_ms - total_waited;
+    if (sleep_ms > remaining) {
+        sleep_ms = remaining;
+    }
+    if (sleep_ms > deadline_ms) {
+        sleep_ms = deadline_ms;
+    }
+
+    sqlite3_sleep(sleep_ms);
+
+    ATOMIC_ADD_INT64(&conn->stats.busy_sleep_ms, sleep_ms);
+
+    return ATOMIC_LOAD_INT64(&conn->cancelled) ? 0 : 1;
+}
+
+// Progress handler: fires every N VDBE opcodes.
+// Returns non-zero to interrupt execution when cancelled or past the deadline.
+// Lock free, it runs in the middle of every long statement.
+static int
+exqlite_progress_handler(void* arg)
+{
+    connection_t* conn = (connection_t*)arg;
+
+    if (ATOMIC_LOAD_INT64(&conn->cancelled)) {
+        return 1;
+    }
+
+    ErlNifSInt64 deadline = connection_deadline(conn);
+    return deadline != NO_DEADLINE && enif_monotonic_time(ERL_NIF_NSEC) >= deadline;
+}
+
+// Stash the current env + caller pid before a db operation.
+// Calls run by the async worker have a process independent env and no caller
+// to watch, like connection_stash_thread.
+// Must be called while holding conn->mutex.
+static inline void
+connection_stash_caller(connection_t* conn, ErlNifEnv* env)
+{
+    enif_mutex_lock(conn->interrupt_mutex);
+    conn->callback_env = enif_self(env, &conn->caller_pid) ? env : NULL;
+    ATOMIC_STORE_INT64(&conn->cancelled, 0);
+    enif_mutex_unlock(conn->interrupt_mutex);
+}
+
+// Clear the stashed caller after a db operation completes.
+// Assumes that the `conn` has been locked for clearing the
+// caller.
+static inline void
+connection_clear_caller(connection_t* conn)
+{
+    enif_mutex_lock(conn->interrupt_mutex);
+    conn->callback_env = NULL;
+    enif_mutex_unlock(conn->interrupt_mutex);
+    ATOMIC_STORE_INT64(&conn->call_deadline, NO_DEADLINE);
+}
+
+// Arms the deadline of the call holding conn->mutex, after stashing the
+// caller. connection_clear_caller disarms it before the lock is released, so
+// it never reaches another call on the connection.
+static inline void
+connection_arm_deadline(connection_t* conn, ErlNifSInt64 deadline)
+{
+    ATOMIC_STORE_INT64(&conn->call_deadline, deadline);
+}
+
+// Reads the deadline argument of a call: an absolute monotonic time in ns, or
+// :infinity for none.
+static int
+get_deadline(ErlNifEnv* env, ERL_NIF_TERM term, ErlNifSInt64* deadline)
+{
+    if (enif_is_identical(term, am_infinity)) {
+        *deadline = NO_DEADLINE;
+        return 1;
+    }
+
+    return enif_get_int64(env, term, deadline);
+}
+
+// Like connection_stash_caller, for db operations run on a native thread.
+// There is no caller to watch, so only cancel/1 can interrupt them.
+// Must be called while holding conn->mutex.
+static inline void
+connection_stash_thread(connection_t* conn)
+{
+    enif_mutex_lock(conn->interrupt_mutex);
+    conn->callback_env = NULL;
+    ATOMIC_STORE_INT64(&conn->cancelled, 0);
+    enif_mutex_unlock(conn->interrupt_mutex);
+}
+
+// ---------------------------------------------------------------------------
+// Async worker
+//
+// A connection can own a native worker thread (see start_worker/1). Calls
+// queued with async_call/3 run the regular NIF functions on that thread with a
+// process independent env, and the result is sent back to the caller as
+// `{ref, result}`. async_call/3 itself only enqueues, so it runs on a normal
+// scheduler and no dirty scheduler is parked on conn->mutex or on disk I/O.
+//
+// The worker does not keep the connection alive, only the jobs in flight do,
+// so a handle dropped without close/1 is still collected. Its destructor stops
+// and joins the idle worker. When the last job in flight dropped the last
+// reference, the destructor runs on the worker itself, which then stops on its
+// own and is joined by the next start_worker/1 or when the NIF unloads.
+// ---------------------------------------------------------------------------
+
+typedef ERL_NIF_TERM (*nif_function_t)(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]);
+
+// Connection plus the arguments of the longest queueable call, multi_step/6.
+#define ASYNC_JOB_MAX_ARGS 6
+
+typedef struct async_job async_job_t;
+
+struct async_job
+{
+    async_job_t* next;
+    ErlNifEnv* env;
+    ErlNifPid caller;
+    ERL_NIF_TERM ref;
+    nif_function_t function;
+    int argc;
+    ERL_NIF_TERM argv[ASYNC_JOB_MAX_ARGS];
+};
+
+struct async_worker
+{
+    ErlNifTid tid;
+    ErlNifMutex* mutex;
+    ErlNifCond* cond;
+    async_job_t* head; // guarded by mutex
+    async_job_t* tail; // guarded by mutex
+    int stopping;      // guarded by mutex
+    int abandoned;     // guarded by mutex, the worker frees itself
+};
+
+// Worker threads that stopped on their own, waiting to be joined.
+typedef struct stopped_worker stopped_worker_t;
+
+struct stopped_worker
+{
+    ErlNifTid tid;
+    stopped_worker_t* next;
+};
+
+static stopped_worker_t* stopped_workers     = NULL;
+static ErlNifMutex* stopped_workers_mutex = NULL;
+
+static void
+async_job_free(async_job_t* job)
+{
+    if (job->env) {
+        enif_free_env(job->env);
+    }
+
+    enif_free(job);
+}
+
+static void
+async_job_reply(async_job_t* job, ERL_NIF_TERM result)
+{
+    enif_send(NULL, &job->caller, job->env, enif_make_tuple2(job->env, job->ref, result));
+    async_job_free(job);
+}
+
+static void*
+async_worker_run(void* arg)
+{
+    async_worker_t* worker = (async_worker_t*)arg;
+    async_job_t* job;
+    ERL_NIF_TERM result;
+    int stopping;
+
+    for (;;) {
+        enif_mutex_lock(worker->mutex);
+        while (worker->head == NULL && !worker->stopping) {
+            enif_cond_wait(worker->cond, worker->mutex);
+        }
+
+        job = worker->head;
+        if (job == NULL) {
+            enif_mutex_unlock(worker->mutex);
+            break;
+        }
+
+        worker->head = job->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        stopping = worker->stopping;
+        enif_mutex_unlock(worker->mutex);
+
+        // Jobs still queued when close/1 stops the worker are not run.
+        if (stopping) {
+            async_job_reply(job, make_error_tuple(job->env, am_connection_closed));
+            continue;
+        }
+
+        result = job->function(job->env, job->argc, job->argv);
+
+        // There is no process to raise in, report bad arguments instead.
+        if (enif_is_exception(job->env, result)) {
+            result = make_error_tuple(job->env, am_badarg);
+        }
+
+        async_job_reply(job, result);
+    }
+
+    enif_mutex_lock(worker->mutex);
+    int abandoned = worker->abandoned;
+    enif_mutex_unlock(worker->mutex);
+
+    if (abandoned) {
+        stopped_worker_t* stopped = enif_alloc(sizeof(stopped_worker_t));
+
+        // Without memory the thread is never joined, which only leaks it.
+        if (stopped) {
+            stopped->tid = worker->tid;
+            enif_mutex_lock(stopped_workers_mutex);
+            stopped->next   = stopped_workers;
+            stopped_workers = stopped;
+            enif_mutex_unlock(stopped_workers_mutex);
+        }
+
+        enif_cond_destroy(worker->cond);
+        enif_mutex_destroy(worker->mutex);
+        enif_free(worker);
+    }
+
+    return NULL;
+}
+
+// Joins the worker threads that stopped on their own.
+static void
+stopped_workers_join()
+{
+    enif_mutex_lock(stopped_workers_mutex);
+    stopped_worker_t* stopped = stopped_workers;
+    stopped_workers           = NULL;
+    enif_mutex_unlock(stopped_workers_mutex);
+
+    while (stopped) {
+        stopped_worker_t* next = stopped->next;
+        enif_thread_join(stopped->tid, NULL);
+        enif_free(stopped);
+        stopped = next;
+    }
+}
+
+static async_worker_t*
+async_worker_create()
+{
+    async_worker_t* worker = enif_alloc(sizeof(async_worker_t));
+    if (!worker) {
+        return NULL;
+    }
+
+    memset(worker, 0, sizeof(async_worker_t));
+
+    worker->mutex = enif_mutex_create("exqlite:worker");
+    worker->cond  = enif_cond_create("exqlite:worker");
+    if (!worker->mutex || !worker->cond) {
+        goto error;
+    }
+
+    if (enif_thread_create("exqlite_worker", &worker->tid, async_worker_run, worker, NULL) != 0) {
+        goto error;
+    }
+
+    return worker;
+
+error:
+    if (worker->cond) {
+        enif_cond_destroy(worker->cond);
+    }
+    if (worker->mutex) {
+        enif_mutex_destroy(worker->mutex);
+    }
+    enif_free(worker);
+    return NULL;
+}
+
+// Answers the queued jobs with {:error, :connection_closed}, waits for the
+// running one and frees the worker. Must not be called with conn->mutex held,
+// the running job may be waiting for it. On the worker thread itself, the
+// worker is only told to stop and frees itself once the current job returns.
+static void
+async_worker_stop(async_worker_t* worker)
+{
+    int self = enif_equal_tids(enif_thread_self(), worker->tid);
+
+    enif_mutex_lock(worker->mutex);
+    worker->stopping  = 1;
+    worker->abandoned = self;
+    enif_cond_signal(worker->cond);
+    enif_mutex_unlock(worker->mutex);
+
+    if (self) {
+        return;
+    }
+
+    enif_thread_join(worker->tid, NULL);
+
+    enif_cond_destroy(worker->cond);
+    enif_mutex_destroy(worker->mutex);
+    enif_free(worker);
+}
+
+///
+/// Opens a new SQLite database
+///
+ERL_NIF_TERM
+exqlite_open(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    int flags;
+    int rc             = 0;
+    int size           = 0;
+    connection_t* conn = NULL;
+    sqlite3* db        = NULL;
+    ErlNifMutex* mutex = NULL;
+    ERL_NIF_TERM result;
+    ErlNifBinary bin;
+
+    ERL_NIF_TERM eos = enif_make_int(env, 0);
+
+    if (argc != 2) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_inspect_iolist_as_binary(env, enif_make_list2(env, argv[0], eos), &bin)) {
+        return make_error_tuple(env, am_invalid_filename);
+    }
+
+    if (!enif_get_int(env, argv[1], &flags)) {
+        return make_error_tuple(env, am_invalid_flags);
+    }
+
+    rc = sqlite3_open_v2((char*)bin.data, &db, flags, NULL);
+    if (rc != SQLITE_OK) {
+        sqlite3_close_v2(db);
+        return make_error_tuple(env, am_database_open_failed);
+    }
+
+    mutex = enif_mutex_create("exqlite:connection");
+    if (mutex == NULL) {
+        sqlite3_close_v2(db);
+        return make_error_tuple(env, am_failed_to_create_mutex);
+    }
+
+    conn = enif_alloc_resource(connection_type, sizeof(connection_t));
+    if (!conn) {
+        sqlite3_close_v2(db);
+        enif_mutex_destroy(mutex);
+        return make_error_tuple(env, am_out_of_memory);
+    }
+    conn->db              = db;
+    conn->mutex           = mutex;
+    conn->interrupt_mutex = NULL;
+    memset(conn->authorizer_deny, 0, sizeof(conn->authorizer_deny));
+
+    // Initialize busy handler fields
+    conn->cancelled              = 0;
+    conn->deadline               = NO_DEADLINE;
+    conn->call_deadline          = NO_DEADLINE;
+    conn->busy_timeout_ms        = 2000; // default matches sqlite3_busy_timeout(db, 2000)
+    conn->progress_handler_steps = 1000;
+    conn->callback_env           = NULL;
+    conn->worker                 = NULL;
+    memset(&conn->stats, 0, sizeof(conn->stats));
+    memset(&conn->query_stats, 0, sizeof(conn->query_stats));
+
+    conn->arbiter        = NULL;
+    conn->arbiter_wrote  = 0;
+    conn->arbiter_queued = 0;
+    conn->arbiter_ready  = 0;
+    conn->arbiter_next   = NULL;
+    conn->busy_started   = 0;
+
+    conn->interrupt_mutex = enif_mutex_create("exqlite:interrupt");
+    if (conn->interrupt_mutex == NULL) {
+        enif_release_resource(conn);
+        return make_error_tuple(env, am_failed_to_create_mutex);
+    }
+
+    // Install our custom busy handler + progress handler
+    sqlite3_busy_handler(db, exqlite_busy_handler, conn);
+    connection_configure_progress_handler(conn);
+
+    conn->arbiter = write_arbiter_acquire(sqlite3_db_filename(db, "main"));
+    if (conn->arbiter) {
+        sqlite3_commit_hook(db, exqlite_commit_hook, conn);
+        sqlite3_rollback_hook(db, exqlite_rollback_hook, conn);
+    }
+
+    result = enif_make_resource(env, conn);
+    enif_release_resource(conn);
+
+    return make_ok_tuple(env, result);
+}
+
+///
+/// Closes an SQLite database
+///
+ERL_NIF_TERM
+exqlite_close(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    connection_t* conn     = NULL;
+    async_worker_t* worker = NULL;
+    int rc                 = SQLITE_OK;
+
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    // Stop the async worker before taking conn->mutex, its running job may be
+    // waiting for it.
+    enif_mutex_lock(conn->interrupt_mutex);
+    worker       = conn->worker;
+    conn->worker = NULL;
+    enif_mutex_unlock(conn->interrupt_mutex);
+
+    if (worker) {
+        async_worker_stop(worker);
+    }
+
+    // close connection in critical section to avoid race-condition
+    // cases. Cases such as query timeout and connection pooling
+    // attempting to close the connection
+    connection_acquire_lock(conn);
+    connection_stash_caller(conn, env);
+
+    // DB is already closed, nothing to do here.
+    if (conn->db == NULL) {
+        connection_clear_caller(conn);
+        connection_release_lock(conn);
+        return am_ok;
+    }
+
+    int autocommit = sqlite3_get_autocommit(conn->db);
+    if (autocommit == 0) {
+        rc = sqlite3_exec(conn->db, "ROLLBACK;", NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            connection_clear_caller(conn);
+            connection_release_lock(conn);
+            return make_sqlite3_error_tuple(env, rc, conn->db);
+        }
+    }
 
     // Hold interrupt_mutex across close+NULL so that any concurrent
     // exqlite_interrupt() either completes its sqlite3_interrupt() call
@@ -561,31 +3021,1149 @@ exqlite_close(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
     if (rc != SQLITE_OK) {
         enif_mutex_unlock(conn->interrupt_mutex);
         connection_release_lock(conn);
-        return make_sqlite3_error_tuple(env, rc, conn->db);
+        return make_sqlite3_error_tuple(env, rc, conn->db);
+    }
+    conn->db = NULL;
+    enif_mutex_unlock(conn->interrupt_mutex);
+
+    connection_clear_caller(conn);
+    connection_release_lock(conn);
+
+    return am_ok;
+}
+
+///
+/// Executes an SQL string.
+///
+ERL_NIF_TERM
+exqlite_execute(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    ErlNifBinary bin;
+    connection_t* conn = NULL;
+    ERL_NIF_TERM eos   = enif_make_int(env, 0);
+    int rc             = SQLITE_OK;
+    ErlNifSInt64 deadline;
+
+    if (argc != 3) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    if (!enif_inspect_iolist_as_binary(env, enif_make_list2(env, argv[1], eos), &bin)) {
+        return make_error_tuple(env, am_sql_not_iolist);
+    }
+
+    if (!get_deadline(env, argv[2], &deadline)) {
+        return raise_badarg(env, argv[2]);
+    }
+
+    connection_acquire_lock(conn);
+    connection_stash_caller(conn, env);
+    connection_arm_deadline(conn, deadline);
+
+    if (conn->db == NULL) {
+        connection_clear_caller(conn);
+        connection_release_lock(conn);
+        return make_error_tuple(env, am_connection_closed);
+    }
+
+    // Compiling the script is part of running it, so it is all step time.
+    ErlNifTime started = query_stats_clock(conn);
+    rc                 = sqlite3_exec(conn->db, (char*)bin.data, NULL, NULL, NULL);
+    query_stats_add(conn, &conn->query_stats.step_ns, started);
+    if (rc != SQLITE_OK) {
+        connection_clear_caller(conn);
+        connection_release_lock(conn);
+        return make_sqlite3_error_tuple(env, rc, conn->db);
+    }
+
+    connection_clear_caller(conn);
+    connection_release_lock(conn);
+
+    return am_ok;
+}
+
+///
+/// Get the number of changes recently done to the database.
+///
+ERL_NIF_TERM
+exqlite_changes(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    connection_t* conn = NULL;
+
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    connection_acquire_lock(conn);
+    if (conn->db == NULL) {
+        connection_release_lock(conn);
+        return make_error_tuple(env, am_connection_closed);
+    }
+    int changes = sqlite3_changes(conn->db);
+    connection_release_lock(conn);
+    return make_ok_tuple(env, enif_make_int(env, changes));
+}
+
+///
+/// Prepares an Sqlite3 statement for execution
+///
+ERL_NIF_TERM
+exqlite_prepare(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    ErlNifBinary bin;
+    connection_t* conn     = NULL;
+    statement_t* statement = NULL;
+    ERL_NIF_TERM result;
+    int rc;
+    ERL_NIF_TERM eos = enif_make_int(env, 0);
+
+    if (argc != 2) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    if (!enif_inspect_iolist_as_binary(env, enif_make_list2(env, argv[1], eos), &bin)) {
+        return make_error_tuple(env, am_sql_not_iolist);
+    }
+
+    statement = enif_alloc_resource(statement_type, sizeof(statement_t));
+    if (!statement) {
+        return make_error_tuple(env, am_out_of_memory);
+    }
+    statement->statement    = NULL;
+    statement->prefetch     = NULL;
+    statement->env          = NULL;
+    statement->columns      = 0;
+    statement->column_types = 0;
+    statement->readonly     = 0;
+    statement->reprepared   = -1;
+
+    enif_keep_resource(conn);
+    statement->conn = conn;
+
+    // ensure connection is not getting closed by parallel thread
+    connection_acquire_lock(conn);
+    connection_stash_caller(conn, env);
+    if (conn->db == NULL) {
+        connection_clear_caller(conn);
+        connection_release_lock(conn);
+        enif_release_resource(statement);
+        return make_error_tuple(env, am_connection_closed);
+    }
+
+    ErlNifTime started = query_stats_clock(conn);
+    rc                 = sqlite3_prepare_v3(conn->db, (char*)bin.data, bin.size, 0, &statement->statement, NULL);
+    query_stats_add(conn, &conn->query_stats.prepare_ns, started);
+
+    if (rc != SQLITE_OK) {
+        result = make_sqlite3_error_tuple(env, rc, conn->db);
+        connection_clear_caller(conn);
+        connection_release_lock(conn);
+        enif_release_resource(statement);
+        return result;
+    }
+
+    if (!statement_cache_metadata(statement)) {
+        connection_clear_caller(conn);
+        connection_release_lock(conn);
+        enif_release_resource(statement);
+        return make_error_tuple(env, am_out_of_memory);
+    }
+
+    connection_clear_caller(conn);
+    connection_release_lock(conn);
+
+    result = enif_make_resource(env, statement);
+    enif_release_resource(statement);
+
+    return make_ok_tuple(env, result);
+}
+
+///
+/// Reset the prepared statement
+///
+ERL_NIF_TERM
+exqlite_reset(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    statement_t* statement;
+    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
+        return raise_badarg(env, argv[0]);
+    }
+
+    statement_acquire_lock(statement);
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+    prefetch_job_t* job = statement_prefetch_detach(statement);
+    sqlite3_reset(statement->statement);
+    statement_release_lock(statement);
+    prefetch_job_reap(job);
+    return am_ok;
+}
+
+///
+/// Get the bind parameter count
+///
+ERL_NIF_TERM
+exqlite_bind_parameter_count(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    statement_t* statement;
+    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
+        return raise_badarg(env, argv[0]);
+    }
+
+    statement_acquire_lock(statement);
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+    int bind_parameter_count = sqlite3_bind_parameter_count(statement->statement);
+    statement_release_lock(statement);
+    return enif_make_int(env, bind_parameter_count);
+}
+
+///
+/// Get the bind parameter index
+///
+ERL_NIF_TERM
+exqlite_bind_parameter_index(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    statement_t* statement;
+    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
+        return raise_badarg(env, argv[0]);
+    }
+
+    ERL_NIF_TERM eos = enif_make_int(env, 0);
+    ErlNifBinary name;
+
+    if (!enif_inspect_iolist_as_binary(env, enif_make_list2(env, argv[1], eos), &name)) {
+        return raise_badarg(env, argv[1]);
+    }
+
+    statement_acquire_lock(statement);
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+    int index = sqlite3_bind_parameter_index(statement->statement, (const char*)name.data);
+    statement_release_lock(statement);
+    return enif_make_int(env, index);
+}
+
+///
+/// Binds a text parameter
+///
+ERL_NIF_TERM
+exqlite_bind_text(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    statement_t* statement;
+    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
+        return raise_badarg(env, argv[0]);
+    }
+
+    unsigned int idx;
+    if (!enif_get_uint(env, argv[1], &idx)) {
+        return raise_badarg(env, argv[1]);
+    }
+
+    ErlNifBinary text;
+    if (!enif_inspect_binary(env, argv[2], &text)) {
+        return raise_badarg(env, argv[2]);
+    }
+
+    statement_acquire_lock(statement);
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+    int rc = sqlite3_bind_text(statement->statement, idx, (char*)text.data, text.size, SQLITE_TRANSIENT);
+    statement_release_lock(statement);
+    return enif_make_int(env, rc);
+}
+
+///
+/// Binds a blob parameter
+///
+ERL_NIF_TERM
+exqlite_bind_blob(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    statement_t* statement;
+    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
+        return raise_badarg(env, argv[0]);
+    }
+
+    unsigned int idx;
+    if (!enif_get_uint(env, argv[1], &idx)) {
+        return raise_badarg(env, argv[1]);
+    }
+
+    ErlNifBinary blob;
+    if (!enif_inspect_binary(env, argv[2], &blob)) {
+        return raise_badarg(env, argv[2]);
+    }
+
+    statement_acquire_lock(statement);
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+    int rc = sqlite3_bind_blob(statement->statement, idx, (char*)blob.data, blob.size, SQLITE_TRANSIENT);
+    statement_release_lock(statement);
+    return enif_make_int(env, rc);
+}
+
+///
+/// Binds an integer parameter
+///
+ERL_NIF_TERM
+exqlite_bind_integer(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    statement_t* statement;
+    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
+        return raise_badarg(env, argv[0]);
+    }
+
+    unsigned int idx;
+    if (!enif_get_uint(env, argv[1], &idx)) {
+        return raise_badarg(env, argv[1]);
+    }
+
+    ErlNifSInt64 i;
+    if (!enif_get_int64(env, argv[2], &i)) {
+        return raise_badarg(env, argv[2]);
+    }
+
+    statement_acquire_lock(statement);
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+    int rc = sqlite3_bind_int64(statement->statement, idx, i);
+    statement_release_lock(statement);
+    return enif_make_int(env, rc);
+}
+
+///
+/// Binds a float parameter
+///
+ERL_NIF_TERM
+exqlite_bind_float(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    statement_t* statement;
+    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
+        return raise_badarg(env, argv[0]);
+    }
+
+    unsigned int idx;
+    if (!enif_get_uint(env, argv[1], &idx)) {
+        return raise_badarg(env, argv[1]);
+    }
+
+    double f;
+    if (!enif_get_double(env, argv[2], &f)) {
+        return raise_badarg(env, argv[2]);
+    }
+
+    statement_acquire_lock(statement);
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+    int rc = sqlite3_bind_double(statement->statement, idx, f);
+    statement_release_lock(statement);
+    return enif_make_int(env, rc);
+}
+
+///
+/// Binds a null parameter
+///
+ERL_NIF_TERM
+exqlite_bind_null(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    statement_t* statement;
+    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
+        return raise_badarg(env, argv[0]);
+    }
+
+    unsigned int idx;
+    if (!enif_get_uint(env, argv[1], &idx)) {
+        return raise_badarg(env, argv[1]);
+    }
+
+    statement_acquire_lock(statement);
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+    int rc = sqlite3_bind_null(statement->statement, idx);
+    statement_release_lock(statement);
+    return enif_make_int(env, rc);
+}
+
+// Copies the text of an atom into `buf` as a NUL terminated UTF-8 string.
+// Returns the length in bytes, or -1 if it does not fit.
+static int
+get_atom_text(ErlNifEnv* env, ERL_NIF_TERM atom, char* buf, unsigned int size)
+{
+#ifdef EXQLITE_HAS_UTF8_ATOMS
+    int len = enif_get_atom(env, atom, buf, size, ERL_NIF_UTF8);
+    return len > 0 ? len - 1 : -1;
+#else
+    // Older runtimes only hand atoms out as latin1, which we widen to UTF-8.
+    char latin1[256];
+    int len = enif_get_atom(env, atom, latin1, sizeof(latin1), ERL_NIF_LATIN1);
+    if (len <= 0) {
+        return -1;
+    }
+
+    unsigned int out = 0;
+    for (int i = 0; i < len - 1; i++) {
+        unsigned char c = (unsigned char)latin1[i];
+        if (c < 0x80) {
+            if (out + 1 >= size) {
+                return -1;
+            }
+            buf[out++] = c;
+        } else {
+            if (out + 2 >= size) {
+                return -1;
+            }
+            buf[out++] = 0xC0 | (c >> 6);
+            buf[out++] = 0x80 | (c & 0x3F);
+        }
+    }
+    buf[out] = 0;
+
+    return out;
+#endif
+}
+
+// Binds a single parameter, mirroring the type dispatch that
+// Exqlite.Sqlite3.bind/2 used to do with one bind_* call per value.
+// Returns 0 if the term has no SQLite representation, otherwise 1 with the
+// sqlite3_bind_* result code stored in `rc`.
+static int
+bind_term(ErlNifEnv* env, sqlite3_stmt* statement, int idx, ERL_NIF_TERM term, int* rc)
+{
+    ErlNifSInt64 i;
+    double f;
+    ErlNifBinary bin;
+    int arity;
+    const ERL_NIF_TERM* tuple;
+    char atom[ATOM_TEXT_SIZE];
+
+    if (enif_get_int64(env, term, &i)) {
+        *rc = sqlite3_bind_int64(statement, idx, i);
+        return 1;
+    }
+
+    if (enif_get_double(env, term, &f)) {
+        *rc = sqlite3_bind_double(statement, idx, f);
+        return 1;
+    }
+
+    if (enif_inspect_binary(env, term, &bin)) {
+        *rc = sqlite3_bind_text(statement, idx, (char*)bin.data, bin.size, SQLITE_TRANSIENT);
+        return 1;
+    }
+
+    if (enif_is_list(env, term)) {
+        if (!enif_inspect_iolist_as_binary(env, term, &bin)) {
+            return 0;
+        }
+        *rc = sqlite3_bind_text(statement, idx, (char*)bin.data, bin.size, SQLITE_TRANSIENT);
+        return 1;
+    }
+
+    if (enif_is_atom(env, term)) {
+        if (enif_is_identical(term, am_nil) || enif_is_identical(term, am_undefined)) {
+            *rc = sqlite3_bind_null(statement, idx);
+            return 1;
+        }
+
+        int len = get_atom_text(env, term, atom, sizeof(atom));
+        if (len < 0) {
+            return 0;
+        }
+        *rc = sqlite3_bind_text(statement, idx, atom, len, SQLITE_TRANSIENT);
+        return 1;
+    }
+
+    if (enif_get_tuple(env, term, &arity, &tuple) && arity == 2 && enif_is_identical(tuple[0], am_blob)) {
+        if (!enif_inspect_binary(env, tuple[1], &bin)) {
+            if (!enif_is_list(env, tuple[1]) || !enif_inspect_iolist_as_binary(env, tuple[1], &bin)) {
+                return 0;
+            }
+        }
+        *rc = sqlite3_bind_blob(statement, idx, (char*)bin.data, bin.size, SQLITE_TRANSIENT);
+        return 1;
+    }
+
+    return 0;
+}
+
+static ERL_NIF_TERM
+make_bind_error(ErlNifEnv* env, ERL_NIF_TERM reason, ERL_NIF_TERM detail)
+{
+    return make_error_tuple(env, enif_make_tuple2(env, reason, detail));
+}
+
+static ERL_NIF_TERM
+make_bind_failed(ErlNifEnv* env, sqlite3_stmt* statement, int rc)
+{
+    const char* msg = sqlite3_errmsg(sqlite3_db_handle(statement));
+    if (!msg) {
+        msg = sqlite3_errstr(rc);
+    }
+
+    return make_error_tuple(env, make_binary(env, msg, strlen(msg)));
+}
+
+static ERL_NIF_TERM
+bind_positional(ErlNifEnv* env, sqlite3_stmt* statement, ERL_NIF_TERM params)
+{
+    unsigned int count;
+    if (!enif_get_list_length(env, params, &count)) {
+        return raise_badarg(env, params);
+    }
+
+    int expected = sqlite3_bind_parameter_count(statement);
+    if ((int)count != expected) {
+        return make_bind_error(env, am_invalid_parameter_count, enif_make_int(env, expected));
+    }
+
+    ERL_NIF_TERM head;
+    ERL_NIF_TERM tail = params;
+    for (int idx = 1; enif_get_list_cell(env, tail, &head, &tail); idx++) {
+        int rc;
+        if (!bind_term(env, statement, idx, head, &rc)) {
+            return make_bind_error(env, am_unsupported_type, enif_make_int(env, idx));
+        }
+
+        if (rc != SQLITE_OK) {
+            return make_bind_failed(env, statement, rc);
+        }
+    }
+
+    return am_ok;
+}
+
+// Resolves a named parameter key (binary, charlist or atom) to its index.
+// Returns 0 when the statement has no parameter with that name.
+static int
+named_parameter_index(ErlNifEnv* env, sqlite3_stmt* statement, ERL_NIF_TERM key)
+{
+    ErlNifBinary name;
+    char atom[ATOM_TEXT_SIZE];
+
+    if (enif_is_atom(env, key)) {
+        if (get_atom_text(env, key, atom, sizeof(atom)) < 0) {
+            return 0;
+        }
+        return sqlite3_bind_parameter_index(statement, atom);
+    }
+
+    if (!enif_is_binary(env, key) && !enif_is_list(env, key)) {
+        return 0;
+    }
+
+    ERL_NIF_TERM eos = enif_make_int(env, 0);
+    if (!enif_inspect_iolist_as_binary(env, enif_make_list2(env, key, eos), &name)) {
+        return 0;
+    }
+
+    return sqlite3_bind_parameter_index(statement, (const char*)name.data);
+}
+
+static ERL_NIF_TERM
+bind_named(ErlNifEnv* env, sqlite3_stmt* statement, ERL_NIF_TERM params)
+{
+    size_t count;
+    ErlNifMapIterator iter;
+    ERL_NIF_TERM key;
+    ERL_NIF_TERM value;
+    ERL_NIF_TERM result = am_ok;
+
+    enif_get_map_size(env, params, &count);
+
+    int expected = sqlite3_bind_parameter_count(statement);
+    if (count != (size_t)expected) {
+        return make_bind_error(env, am_invalid_parameter_count, enif_make_int(env, expected));
+    }
+
+    if (!enif_map_iterator_create(env, params, &iter, ERL_NIF_MAP_ITERATOR_FIRST)) {
+        return raise_badarg(env, params);
+    }
+
+    while (enif_map_iterator_get_pair(env, &iter, &key, &value)) {
+        int rc;
+        int idx = named_parameter_index(env, statement, key);
+        if (idx == 0) {
+            result = make_bind_error(env, am_unknown_parameter, key);
+            break;
+        }
+
+        if (!bind_term(env, statement, idx, value, &rc)) {
+            result = make_bind_error(env, am_unsupported_type, key);
+            break;
+        }
+
+        if (rc != SQLITE_OK) {
+            result = make_bind_failed(env, statement, rc);
+            break;
+        }
+
+        enif_map_iterator_next(env, &iter);
+    }
+
+    enif_map_iterator_destroy(env, &iter);
+
+    return result;
+}
+
+// Binds a list of positional parameters or a map of named parameters.
+static ERL_NIF_TERM
+bind_params(ErlNifEnv* env, sqlite3_stmt* statement, ERL_NIF_TERM params)
+{
+    if (enif_is_map(env, params)) {
+        return bind_named(env, statement, params);
+    }
+
+    if (enif_is_list(env, params)) {
+        return bind_positional(env, statement, params);
+    }
+
+    return raise_badarg(env, params);
+}
+
+///
+/// Resets the statement and binds a list of positional parameters or a map
+/// of named parameters.
+///
+/// Doing the whole bind under one lock acquisition avoids a NIF call and a
+/// mutex round-trip per parameter.
+///
+/// Runs on a normal scheduler. While a query or a prefetch job holds the
+/// connection lock it reschedules itself on a dirty IO scheduler and waits
+/// there.
+///
+ERL_NIF_TERM
+exqlite_bind_all(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    statement_t* statement;
+    prefetch_job_t* job;
+    ERL_NIF_TERM result;
+
+    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
+        return raise_badarg(env, argv[0]);
+    }
+
+    if (!enif_is_list(env, argv[1]) && !enif_is_map(env, argv[1])) {
+        return raise_badarg(env, argv[1]);
+    }
+
+    if (enif_thread_type() != ERL_NIF_THR_NORMAL_SCHEDULER) {
+        statement_acquire_lock(statement);
+    } else if (!connection_try_acquire_lock(statement->conn)) {
+        return enif_schedule_nif(env, "bind_all", ERL_NIF_DIRTY_JOB_IO_BOUND, exqlite_bind_all, argc, argv);
+    }
+
+    // A pending job can't be stepping while we hold the lock, it only has to
+    // see that it was discarded. Orphan it rather than wait for that.
+    job = statement_prefetch_detach(statement);
+
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        prefetch_job_orphan(job);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    // Statements are reused across executions (e.g. by the connection's
+    // statement cache), so start from a clean slate every time.
+    ErlNifTime started = query_stats_clock(statement->conn);
+
+    sqlite3_reset(statement->statement);
+    sqlite3_clear_bindings(statement->statement);
+
+    result = bind_params(env, statement->statement, argv[1]);
+    query_stats_add(statement->conn, &statement->conn->query_stats.bind_ns, started);
+
+    statement_release_lock(statement);
+
+    // Also joins the jobs orphaned by earlier binds, which have finished by
+    // now unless they are still waiting for the lock.
+    if (job) {
+        prefetch_job_orphan(job);
+        prefetch_orphans_reap(0);
+    }
+
+    return result;
+}
+
+// Steps the statement up to `chunk_size` times and returns the multi_step
+// result, building the terms in `env` and counting the work in `stats`, if
+// any. `more` is set when the statement has rows left. The statement lock
+// must be held.
+static ERL_NIF_TERM
+statement_step_chunk(ErlNifEnv* env, statement_t* statement, int chunk_size, const row_options_t* options, query_stats_t* stats, int* more)
+{
+    chunk_t chunk;
+    ERL_NIF_TERM tag = am_rows;
+    ERL_NIF_TERM rows;
+
+    chunk_init(&chunk, sqlite3_column_count(statement->statement), options, stats);
+
+    for (int i = 0; i < chunk_size && tag == am_rows; i++) {
+        int rc = chunk_step(&chunk, statement->statement);
+        switch (rc) {
+            case SQLITE_ROW:
+                if (!chunk_add_row(env, &chunk, statement->statement)) {
+                    chunk_free(&chunk);
+                    return make_error_tuple(env, am_out_of_memory);
+                }
+                break;
+
+            case SQLITE_DONE:
+                sqlite3_reset(statement->statement);
+                tag = am_done;
+                break;
+
+            case SQLITE_BUSY:
+                sqlite3_reset(statement->statement);
+                chunk_free(&chunk);
+                return am_busy;
+
+            default:
+                sqlite3_reset(statement->statement);
+                chunk_free(&chunk);
+                return make_sqlite3_error_tuple(env, rc, statement->conn->db);
+        }
+    }
+
+    chunk_finish(env, &chunk);
+    rows = chunk_rows(env, &chunk, enif_make_list(env, 0));
+    chunk_free(&chunk);
+
+    if (more) {
+        *more = tag == am_rows;
+    }
+
+    return enif_make_tuple2(env, tag, rows);
+}
+
+///
+/// Steps the sqlite prepared statement multiple times.
+///
+/// This is to reduce the back and forth between the BEAM and sqlite in
+/// fetching data. Without using this, throughput can suffer. Rows are
+/// returned in order, as lists or tuples depending on the row format, with
+/// the decode hints applied.
+///
+ERL_NIF_TERM
+exqlite_multi_step(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    statement_t* statement = NULL;
+    connection_t* conn     = NULL;
+    row_options_t options;
+    int chunk_size;
+    ErlNifSInt64 deadline;
+
+    if (argc != 6) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    if (!enif_get_resource(env, argv[1], statement_type, (void**)&statement)) {
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    if (!statement || !statement->statement) {
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    if (!enif_get_int(env, argv[2], &chunk_size)) {
+        return make_error_tuple(env, am_invalid_chunk_size);
+    }
+
+    if (chunk_size < 1) {
+        return make_error_tuple(env, am_invalid_chunk_size);
+    }
+
+    if (conn != statement->conn) {
+        return enif_raise_exception(env, enif_make_atom(env, "cross_connection_call"));
+    }
+
+    if (!get_deadline(env, argv[5], &deadline)) {
+        return raise_badarg(env, argv[5]);
+    }
+
+    if (!get_row_options(env, argv[3], argv[4], &options)) {
+        return raise_badarg(env, enif_make_tuple2(env, argv[3], argv[4]));
+    }
+
+    connection_acquire_lock(conn);
+    statement_prefetch_discard(statement);
+    connection_stash_caller(conn, env);
+    connection_arm_deadline(conn, deadline);
+
+    if (statement->statement == NULL) {
+        connection_clear_caller(conn);
+        connection_release_lock(conn);
+        row_options_free(&options);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    ERL_NIF_TERM result = statement_step_chunk(env, statement, chunk_size, &options, connection_query_stats(conn), NULL);
+
+    connection_clear_caller(conn);
+    connection_release_lock(conn);
+    row_options_free(&options);
+
+    return result;
+}
+
+//
+// Prefetching
+//
+// multi_step_prefetch overlaps SQLite with the caller: after returning a chunk
+// that has rows left, it starts a native thread that steps the next chunk into
+// a process-independent env. The next call joins that thread and copies the
+// chunk out instead of stepping. Large TEXT/BLOB values are refc sub-binaries
+// of the chunk arena, so the copy does not duplicate them.
+//
+// A statement has at most one job in flight, tracked under conn->mutex. Every
+// call that binds, resets, steps or releases the statement detaches the job
+// and marks it discarded, so a chunk stepped before a rebind is never handed
+// out, and so does a multi_step_prefetch call whose chunk size, row format or
+// decode hints differ from the ones the job stepped with; the thread checks that flag once it holds the lock and then leaves the
+// statement alone. The statement destructor must not block on the thread, so
+// it hands the job to the orphan list instead, which later calls join.
+//
+
+struct prefetch_job
+{
+    ErlNifTid tid;
+    statement_t* statement;
+    connection_t* conn;
+    ErlNifEnv* env;
+    ERL_NIF_TERM result;
+    int chunk_size;
+    row_options_t options;
+    int more;
+    query_stats_t stats;   // work done for the chunk, if stats are collected
+    int discarded;         // guarded by conn->mutex
+    ErlNifSInt64 finished; // atomic, set once the thread no longer runs
+    prefetch_job_t* next;  // guarded by prefetch_orphans_mutex
+};
+
+// Jobs detached by statement destructors, joined once they finished.
+static prefetch_job_t* prefetch_orphans     = NULL;
+static ErlNifMutex* prefetch_orphans_mutex = NULL;
+
+static void
+prefetch_job_free(prefetch_job_t* job)
+{
+    if (job->env) {
+        enif_free_env(job->env);
+    }
+
+    row_options_free(&job->options);
+    enif_release_resource(job->conn);
+    enif_free(job);
+}
+
+static void*
+prefetch_job_run(void* arg)
+{
+    prefetch_job_t* job = (prefetch_job_t*)arg;
+
+    connection_acquire_lock(job->conn);
+
+    if (!job->discarded) {
+        query_stats_t* stats = job->conn->query_stats.enabled ? &job->stats : NULL;
+
+        connection_stash_thread(job->conn);
+        job->result = statement_step_chunk(job->env, job->statement, job->chunk_size, &job->options, stats, &job->more);
+        connection_clear_caller(job->conn);
+    }
+
+    connection_release_lock(job->conn);
+    ATOMIC_STORE_INT64(&job->finished, 1);
+
+    return NULL;
+}
+
+// Starts stepping the next chunk in the background. Failing to start the job
+// is not an error, the next call simply steps synchronously.
+// The statement lock must be held.
+static void
+statement_prefetch_start(statement_t* statement, int chunk_size, const row_options_t* options)
+{
+    prefetch_job_t* job = enif_alloc(sizeof(prefetch_job_t));
+    if (!job) {
+        return;
+    }
+
+    memset(job, 0, sizeof(prefetch_job_t));
+    job->statement  = statement;
+    job->conn       = statement->conn;
+    job->chunk_size = chunk_size;
+
+    // The thread may outlive the statement, and with it the statement's
+    // reference to the connection.
+    enif_keep_resource(job->conn);
+
+    if (!row_options_copy(&job->options, options)) {
+        prefetch_job_free(job);
+        return;
+    }
+
+    job->env = enif_alloc_env();
+    if (!job->env) {
+        prefetch_job_free(job);
+        return;
+    }
+
+    if (enif_thread_create("exqlite_prefetch", &job->tid, prefetch_job_run, job, NULL) != 0) {
+        prefetch_job_free(job);
+        return;
+    }
+
+    statement->prefetch = job;
+}
+
+// Detaches the statement's job, if any, so it won't touch the statement
+// anymore. The statement lock must be held. Pass the job to
+// prefetch_job_reap once the lock is released.
+static prefetch_job_t*
+statement_prefetch_detach(statement_t* statement)
+{
+    prefetch_job_t* job = statement->prefetch;
+
+    if (job) {
+        job->discarded      = 1;
+        statement->prefetch = NULL;
+    }
+
+    return job;
+}
+
+// Waits for a detached job to finish and frees it. Must not be called with
+// the statement lock held.
+static void
+prefetch_job_reap(prefetch_job_t* job)
+{
+    if (job) {
+        enif_thread_join(job->tid, NULL);
+        prefetch_job_free(job);
+    }
+}
+
+// Detaches and reaps the statement's job, if any, before the caller binds,
+// resets or steps the statement. Called with the statement lock held, which
+// is released while the job finishes.
+static void
+statement_prefetch_discard(statement_t* statement)
+{
+    prefetch_job_t* job;
+
+    while ((job = statement_prefetch_detach(statement))) {
+        statement_release_lock(statement);
+        prefetch_job_reap(job);
+        statement_acquire_lock(statement);
+    }
+}
+
+// Whether a job stepped its chunk the way a call with these arguments would.
+static int
+prefetch_job_matches(const prefetch_job_t* job, int chunk_size, const row_options_t* options)
+{
+    return job->chunk_size == chunk_size && row_options_equal(&job->options, options);
+}
+
+// Queues a detached job to be joined later, for callers that must not wait.
+static void
+prefetch_job_orphan(prefetch_job_t* job)
+{
+    if (job) {
+        enif_mutex_lock(prefetch_orphans_mutex);
+        job->next        = prefetch_orphans;
+        prefetch_orphans = job;
+        enif_mutex_unlock(prefetch_orphans_mutex);
+    }
+}
+
+// Joins the orphaned jobs whose thread finished, or all of them when `all` is
+// set. Must not be called with a connection lock held.
+static void
+prefetch_orphans_reap(int all)
+{
+    prefetch_job_t* finished = NULL;
+
+    enif_mutex_lock(prefetch_orphans_mutex);
+    for (prefetch_job_t** link = &prefetch_orphans; *link;) {
+        prefetch_job_t* job = *link;
+
+        if (all || ATOMIC_LOAD_INT64(&job->finished)) {
+            *link     = job->next;
+            job->next = finished;
+            finished  = job;
+        } else {
+            link = &job->next;
+        }
+    }
+    enif_mutex_unlock(prefetch_orphans_mutex);
+
+    while (finished) {
+        prefetch_job_t* job = finished;
+        finished            = job->next;
+        prefetch_job_reap(job);
+    }
+}
+
+///
+/// Steps the prepared statement like multi_step, prefetching the next chunk
+/// on a background thread. See the "Prefetching" notes above.
+///
+ERL_NIF_TERM
+exqlite_multi_step_prefetch(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    statement_t* statement = NULL;
+    connection_t* conn     = NULL;
+    prefetch_job_t* job    = NULL;
+    query_stats_t prefetched;
+    ERL_NIF_TERM result;
+    row_options_t options;
+    int chunk_size;
+    int more = 0;
+    ErlNifSInt64 deadline;
+
+    if (argc != 6) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    if (!enif_get_resource(env, argv[1], statement_type, (void**)&statement)) {
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    if (!enif_get_int(env, argv[2], &chunk_size) || chunk_size < 1) {
+        return make_error_tuple(env, am_invalid_chunk_size);
+    }
+
+    if (conn != statement->conn) {
+        return enif_raise_exception(env, enif_make_atom(env, "cross_connection_call"));
+    }
+
+    if (!get_deadline(env, argv[5], &deadline)) {
+        return raise_badarg(env, argv[5]);
+    }
+
+    if (!get_row_options(env, argv[3], argv[4], &options)) {
+        return raise_badarg(env, enif_make_tuple2(env, argv[3], argv[4]));
+    }
+
+    prefetch_orphans_reap(0);
+
+    connection_acquire_lock(conn);
+
+    if (statement->prefetch && !prefetch_job_matches(statement->prefetch, chunk_size, &options)) {
+        statement_prefetch_discard(statement);
+    }
+
+    job = statement->prefetch;
+    if (job) {
+        // The job needs the lock to finish.
+        statement->prefetch = NULL;
+        connection_release_lock(conn);
+
+        enif_thread_join(job->tid, NULL);
+        result     = enif_make_copy(env, job->result);
+        more       = job->more;
+        prefetched = job->stats;
+        prefetch_job_free(job);
+
+        connection_acquire_lock(conn);
+        query_stats_merge(conn, &prefetched);
+    } else {
+        connection_stash_caller(conn, env);
+        connection_arm_deadline(conn, deadline);
+
+        if (statement->statement == NULL) {
+            connection_clear_caller(conn);
+            connection_release_lock(conn);
+            row_options_free(&options);
+            return make_error_tuple(env, am_invalid_statement);
+        }
+
+        result = statement_step_chunk(env, statement, chunk_size, &options, connection_query_stats(conn), &more);
+        connection_clear_caller(conn);
+    }
+
+    if (more && statement->statement && !statement->prefetch) {
+        statement_prefetch_start(statement, chunk_size, &options);
     }
-    conn->db = NULL;
-    enif_mutex_unlock(conn->interrupt_mutex);
 
-    connection_clear_caller(conn);
     connection_release_lock(conn);
+    row_options_free(&options);
 
-    return am_ok;
+    return result;
 }
 
 ///
-/// Executes an SQL string.
+/// Steps the prepared statement to completion and returns every row, in
+/// order.
+///
+/// Rows are accumulated in reverse and flipped once at the end. The NIF gives
+/// up the connection lock and reschedules itself via enif_schedule_nif every
+/// FETCH_ALL_TIMESLICE_NS, carrying the rows collected so far, so a large
+/// result set doesn't monopolize a dirty scheduler. `chunk_size` is the number
+/// of rows stepped between timeslice checks. Rows are lists or tuples
+/// depending on the row format.
 ///
 ERL_NIF_TERM
-exqlite_execute(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+exqlite_fetch_all(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 {
     assert(env);
 
-    ErlNifBinary bin;
-    connection_t* conn = NULL;
-    ERL_NIF_TERM eos   = enif_make_int(env, 0);
-    int rc             = SQLITE_OK;
+    statement_t* statement = NULL;
+    connection_t* conn     = NULL;
+    ERL_NIF_TERM result;
+    ERL_NIF_TERM rows;
+    row_options_t options;
+    int chunk_size;
+    ErlNifSInt64 deadline;
 
-    if (argc != 2) {
+    // The seventh argument only exists when we rescheduled ourselves.
+    if (argc != 6 && argc != 7) {
         return enif_make_badarg(env);
     }
 
@@ -593,76 +4171,154 @@ exqlite_execute(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
         return make_error_tuple(env, am_invalid_connection);
     }
 
-    if (!enif_inspect_iolist_as_binary(env, enif_make_list2(env, argv[1], eos), &bin)) {
-        return make_error_tuple(env, am_sql_not_iolist);
+    if (!enif_get_resource(env, argv[1], statement_type, (void**)&statement)) {
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    if (!enif_get_int(env, argv[2], &chunk_size) || chunk_size < 1) {
+        return make_error_tuple(env, am_invalid_chunk_size);
+    }
+
+    if (conn != statement->conn) {
+        return enif_raise_exception(env, enif_make_atom(env, "cross_connection_call"));
     }
 
+    if (!get_deadline(env, argv[5], &deadline)) {
+        return raise_badarg(env, argv[5]);
+    }
+
+    rows = argc == 7 ? argv[6] : enif_make_list(env, 0);
+
     connection_acquire_lock(conn);
+    statement_prefetch_discard(statement);
     connection_stash_caller(conn, env);
+    connection_arm_deadline(conn, deadline);
 
-    if (conn->db == NULL) {
+    if (statement->statement == NULL) {
         connection_clear_caller(conn);
         connection_release_lock(conn);
-        return make_error_tuple(env, am_connection_closed);
+        return make_error_tuple(env, am_invalid_statement);
     }
 
-    rc = sqlite3_exec(conn->db, (char*)bin.data, NULL, NULL, NULL);
-    if (rc != SQLITE_OK) {
+    if (!get_row_options(env, argv[3], argv[4], &options)) {
         connection_clear_caller(conn);
         connection_release_lock(conn);
-        return make_sqlite3_error_tuple(env, rc, conn->db);
-    }
+        return raise_badarg(env, enif_make_tuple2(env, argv[3], argv[4]));
+    }
+
+    chunk_t chunk;
+    chunk_init(&chunk, sqlite3_column_count(statement->statement), &options, connection_query_stats(conn));
+
+    ErlNifTime started = enif_monotonic_time(ERL_NIF_NSEC);
+    do {
+        for (int i = 0; i < chunk_size; i++) {
+            int rc = chunk_step(&chunk, statement->statement);
+            switch (rc) {
+                case SQLITE_ROW:
+                    if (!chunk_add_row(env, &chunk, statement->statement)) {
+                        chunk_free(&chunk);
+                        row_options_free(&options);
+                        connection_clear_caller(conn);
+                        connection_release_lock(conn);
+                        return make_error_tuple(env, am_out_of_memory);
+                    }
+                    break;
+
+                case SQLITE_DONE:
+                    sqlite3_reset(statement->statement);
+                    connection_clear_caller(conn);
+                    connection_release_lock(conn);
+                    chunk_finish(env, &chunk);
+                    rows = chunk_prepend_rows(env, &chunk, rows);
+                    chunk_free(&chunk);
+                    row_options_free(&options);
+                    enif_make_reverse_list(env, rows, &rows);
+                    return make_ok_tuple(env, rows);
+
+                case SQLITE_BUSY:
+                    sqlite3_reset(statement->statement);
+                    chunk_free(&chunk);
+                    row_options_free(&options);
+                    connection_clear_caller(conn);
+                    connection_release_lock(conn);
+                    return am_busy;
+
+                default:
+                    sqlite3_reset(statement->statement);
+                    chunk_free(&chunk);
+                    row_options_free(&options);
+                    result = make_sqlite3_error_tuple(env, rc, conn->db);
+                    connection_clear_caller(conn);
+                    connection_release_lock(conn);
+                    return result;
+            }
+        }
+    } while (enif_monotonic_time(ERL_NIF_NSEC) - started < FETCH_ALL_TIMESLICE_NS);
 
     connection_clear_caller(conn);
     connection_release_lock(conn);
 
-    return am_ok;
+    chunk_finish(env, &chunk);
+    rows = chunk_prepend_rows(env, &chunk, rows);
+    chunk_free(&chunk);
+    row_options_free(&options);
+
+    ERL_NIF_TERM args[] = {argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], rows};
+    return enif_schedule_nif(env, "fetch_all", ERL_NIF_DIRTY_JOB_IO_BOUND, exqlite_fetch_all, 7, args);
 }
 
-///
-/// Get the number of changes recently done to the database.
-///
-ERL_NIF_TERM
-exqlite_changes(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+// Ends the transaction execute_many opened, if any. Returns the sqlite3 result
+// code of the COMMIT or ROLLBACK.
+static int
+execute_many_finish(connection_t* conn, int began, int commit)
 {
-    assert(env);
-
-    connection_t* conn = NULL;
-
-    if (argc != 1) {
-        return enif_make_badarg(env);
-    }
-
-    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
-        return make_error_tuple(env, am_invalid_connection);
+    if (!began) {
+        return SQLITE_OK;
     }
 
-    connection_acquire_lock(conn);
-    if (conn->db == NULL) {
-        connection_release_lock(conn);
-        return make_error_tuple(env, am_connection_closed);
-    }
-    int changes = sqlite3_changes(conn->db);
-    connection_release_lock(conn);
-    return make_ok_tuple(env, enif_make_int(env, changes));
+    return sqlite3_exec(conn->db, commit ? "COMMIT" : "ROLLBACK", NULL, NULL, NULL);
 }
 
 ///
-/// Prepares an Sqlite3 statement for execution
+/// Binds and steps the prepared statement once per parameter row.
+///
+/// Arguments are the connection, the statement, the list of parameter rows
+/// (each a list or a map, as for bind_all), whether to wrap the rows in a
+/// transaction and whether to collect the rowid of every row. A transaction
+/// is only opened when the connection is not in one already; it is committed
+/// once every row went through, and rolled back on the first error.
+///
+/// Like fetch_all, the NIF releases the connection lock and reschedules
+/// itself every EXECUTE_MANY_TIMESLICE_NS, unless it opened the transaction:
+/// other calls on the connection would then run inside it, and a caller killed
+/// between slices would leave it open, so such a batch holds the lock on the
+/// dirty scheduler until it is done. The extra arguments carry the changes so
+/// far, the reversed rowids and the index of the next row.
+///
+/// Returns `{:ok, changes}` or `{:ok, changes, rowids}`. A row that fails to
+/// bind returns `{:error, {:bind, index, reason}}` with `reason` as returned
+/// by bind_all and a 0-based `index`.
 ///
 ERL_NIF_TERM
-exqlite_prepare(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+exqlite_execute_many(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 {
     assert(env);
 
-    ErlNifBinary bin;
-    connection_t* conn     = NULL;
     statement_t* statement = NULL;
+    connection_t* conn     = NULL;
+    ERL_NIF_TERM params;
+    ERL_NIF_TERM rows;
+    ERL_NIF_TERM rowids;
     ERL_NIF_TERM result;
+    ErlNifSInt64 changes = 0;
+    int transaction;
+    int collect_rowids;
+    int began = 0;
+    int index = 0;
     int rc;
-    ERL_NIF_TERM eos = enif_make_int(env, 0);
 
-    if (argc != 2) {
+    // The last three arguments only exist when we rescheduled ourselves.
+    if (argc != 5 && argc != 8) {
         return enif_make_badarg(env);
     }
 
@@ -670,281 +4326,465 @@ exqlite_prepare(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
         return make_error_tuple(env, am_invalid_connection);
     }
 
-    if (!enif_inspect_iolist_as_binary(env, enif_make_list2(env, argv[1], eos), &bin)) {
-        return make_error_tuple(env, am_sql_not_iolist);
+    if (!enif_get_resource(env, argv[1], statement_type, (void**)&statement)) {
+        return make_error_tuple(env, am_invalid_statement);
     }
 
-    statement = enif_alloc_resource(statement_type, sizeof(statement_t));
-    if (!statement) {
-        return make_error_tuple(env, am_out_of_memory);
+    if (!enif_is_list(env, argv[2])) {
+        return raise_badarg(env, argv[2]);
     }
-    statement->statement = NULL;
 
-    enif_keep_resource(conn);
-    statement->conn = conn;
+    transaction    = enif_is_identical(argv[3], am_true);
+    collect_rowids = enif_is_identical(argv[4], am_true);
+    rows           = argv[2];
+    rowids         = enif_make_list(env, 0);
+
+    if (argc == 8) {
+        if (!enif_get_int64(env, argv[5], &changes) || !enif_get_int(env, argv[7], &index)) {
+            return enif_make_badarg(env);
+        }
+        rowids = argv[6];
+    }
+
+    if (conn != statement->conn) {
+        return enif_raise_exception(env, enif_make_atom(env, "cross_connection_call"));
+    }
 
-    // ensure connection is not getting closed by parallel thread
     connection_acquire_lock(conn);
+    statement_prefetch_discard(statement);
     connection_stash_caller(conn, env);
-    if (conn->db == NULL) {
+
+    if (statement->statement == NULL) {
         connection_clear_caller(conn);
         connection_release_lock(conn);
-        enif_release_resource(statement);
-        return make_error_tuple(env, am_connection_closed);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    if (argc == 5) {
+        sqlite3_reset(statement->statement);
+
+        if (transaction && sqlite3_get_autocommit(conn->db)) {
+            rc = sqlite3_exec(conn->db, "BEGIN", NULL, NULL, NULL);
+            if (rc != SQLITE_OK) {
+                result = make_sqlite3_error_tuple(env, rc, conn->db);
+                connection_clear_caller(conn);
+                connection_release_lock(conn);
+                return result;
+            }
+            began = 1;
+        }
+    }
+
+    ErlNifTime started = enif_monotonic_time(ERL_NIF_NSEC);
+    while (enif_get_list_cell(env, rows, &params, &rows)) {
+        ErlNifTime phase = query_stats_clock(conn);
+        result           = bind_params(env, statement->statement, params);
+        query_stats_add(conn, &conn->query_stats.bind_ns, phase);
+
+        if (result != am_ok) {
+            const ERL_NIF_TERM* error;
+            int arity;
+
+            sqlite3_clear_bindings(statement->statement);
+            execute_many_finish(conn, began, 0);
+            connection_clear_caller(conn);
+            connection_release_lock(conn);
+
+            // bind_params raised badarg, or returned {:error, reason}.
+            if (enif_is_exception(env, result) || !enif_get_tuple(env, result, &arity, &error) || arity != 2) {
+                return result;
+            }
+
+            return make_error_tuple(env, enif_make_tuple3(env, am_bind, enif_make_int(env, index), error[1]));
+        }
+
+        // sqlite3_changes keeps the count of the last DML statement, so it is
+        // stale for rows that are not one.
+        sqlite3_int64 total_changes = sqlite3_total_changes64(conn->db);
+
+        // Drain RETURNING rows, if any.
+        phase = query_stats_clock(conn);
+        do {
+            rc = sqlite3_step(statement->statement);
+        } while (rc == SQLITE_ROW);
+        query_stats_add(conn, &conn->query_stats.step_ns, phase);
+
+        if (rc != SQLITE_DONE) {
+            result = rc == SQLITE_BUSY ? am_busy : make_sqlite3_error_tuple(env, rc, conn->db);
+            sqlite3_reset(statement->statement);
+            sqlite3_clear_bindings(statement->statement);
+            execute_many_finish(conn, began, 0);
+            connection_clear_caller(conn);
+            connection_release_lock(conn);
+            return result;
+        }
+
+        changes += sqlite3_total_changes64(conn->db) - total_changes;
+        if (collect_rowids) {
+            rowids = enif_make_list_cell(env, enif_make_int64(env, sqlite3_last_insert_rowid(conn->db)), rowids);
+        }
+
+        sqlite3_reset(statement->statement);
+        index++;
+
+        if (!began && !enif_is_empty_list(env, rows) && enif_monotonic_time(ERL_NIF_NSEC) - started >= EXECUTE_MANY_TIMESLICE_NS) {
+            connection_clear_caller(conn);
+            connection_release_lock(conn);
+
+            ERL_NIF_TERM args[] = {
+              argv[0],
+              argv[1],
+              rows,
+              argv[3],
+              argv[4],
+              enif_make_int64(env, changes),
+              rowids,
+              enif_make_int(env, index),
+            };
+            return enif_schedule_nif(env, "execute_many", ERL_NIF_DIRTY_JOB_IO_BOUND, exqlite_execute_many, 8, args);
+        }
     }
 
-    rc = sqlite3_prepare_v3(conn->db, (char*)bin.data, bin.size, 0, &statement->statement, NULL);
+    sqlite3_clear_bindings(statement->statement);
 
+    rc = execute_many_finish(conn, began, 1);
     if (rc != SQLITE_OK) {
         result = make_sqlite3_error_tuple(env, rc, conn->db);
+        execute_many_finish(conn, began, 0);
         connection_clear_caller(conn);
         connection_release_lock(conn);
-        enif_release_resource(statement);
         return result;
     }
 
     connection_clear_caller(conn);
     connection_release_lock(conn);
 
-    result = enif_make_resource(env, statement);
-    enif_release_resource(statement);
+    if (!collect_rowids) {
+        return make_ok_tuple(env, enif_make_int64(env, changes));
+    }
 
-    return make_ok_tuple(env, result);
+    enif_make_reverse_list(env, rowids, &rowids);
+    return enif_make_tuple3(env, am_ok, enif_make_int64(env, changes), rowids);
 }
 
-///
-/// Reset the prepared statement
-///
-ERL_NIF_TERM
-exqlite_reset(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
-{
-    statement_t* statement;
-    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
-        return raise_badarg(env, argv[0]);
-    }
+//
+// Columnar results
+//
+// multi_step_columnar packs each column of a chunk into a few binaries
+// instead of building a term per cell. A column takes the storage class of its
+// first non-NULL value. INTEGER and REAL columns are packed as native-endian
+// 64-bit values, TEXT and BLOB columns as (rows + 1) native-endian 64-bit
+// offsets into a single data binary. Every column also carries a bitmap with
+// bit `row % 8` of byte `row / 8` set when the value is NULL. Should a column
+// hold more than one storage class within a chunk, it falls back to a plain
+// list of cells.
+//
 
-    statement_acquire_lock(statement);
-    if (statement->statement == NULL) {
-        statement_release_lock(statement);
-        return make_error_tuple(env, am_invalid_statement);
-    }
-    sqlite3_reset(statement->statement);
-    statement_release_lock(statement);
-    return am_ok;
-}
+#define COLUMN_MIXED -1
+#define COLUMN_DATA_INITIAL_SIZE 256
 
-///
-/// Get the bind parameter count
-///
-ERL_NIF_TERM
-exqlite_bind_parameter_count(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+typedef struct column_buffer
 {
-    statement_t* statement;
-    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
-        return raise_badarg(env, argv[0]);
-    }
+    int type;              // SQLITE_NULL until the first non-NULL value, or COLUMN_MIXED
+    ErlNifBinary values;   // packed values, or TEXT/BLOB bytes
+    size_t values_size;    // bytes of `values` in use
+    ErlNifBinary offsets;  // TEXT/BLOB offsets into `values`
+    ErlNifBinary nulls;    // NULL bitmap
+    ERL_NIF_TERM* cells;   // per row terms once the column is mixed
+} column_buffer_t;
 
-    statement_acquire_lock(statement);
-    if (statement->statement == NULL) {
-        statement_release_lock(statement);
-        return make_error_tuple(env, am_invalid_statement);
+static void
+column_buffers_free(column_buffer_t* columns, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (columns[i].values.data) {
+            enif_release_binary(&columns[i].values);
+        }
+        if (columns[i].offsets.data) {
+            enif_release_binary(&columns[i].offsets);
+        }
+        if (columns[i].nulls.data) {
+            enif_release_binary(&columns[i].nulls);
+        }
+        if (columns[i].cells) {
+            enif_free(columns[i].cells);
+        }
     }
-    int bind_parameter_count = sqlite3_bind_parameter_count(statement->statement);
-    statement_release_lock(statement);
-    return enif_make_int(env, bind_parameter_count);
+
+    enif_free(columns);
 }
 
-///
-/// Get the bind parameter index
-///
-ERL_NIF_TERM
-exqlite_bind_parameter_index(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+static column_buffer_t*
+column_buffers_alloc(int count, size_t capacity)
 {
-    statement_t* statement;
-    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
-        return raise_badarg(env, argv[0]);
+    size_t size              = sizeof(column_buffer_t) * (count > 0 ? count : 1);
+    column_buffer_t* columns = enif_alloc(size);
+    if (!columns) {
+        return NULL;
     }
+    memset(columns, 0, size);
 
-    ERL_NIF_TERM eos = enif_make_int(env, 0);
-    ErlNifBinary name;
+    for (int i = 0; i < count; i++) {
+        columns[i].type = SQLITE_NULL;
 
-    if (!enif_inspect_iolist_as_binary(env, enif_make_list2(env, argv[1], eos), &name)) {
-        return raise_badarg(env, argv[1]);
+        if (!enif_alloc_binary((capacity + 7) / 8, &columns[i].nulls)) {
+            column_buffers_free(columns, count);
+            return NULL;
+        }
+        memset(columns[i].nulls.data, 0, columns[i].nulls.size);
     }
 
-    statement_acquire_lock(statement);
-    if (statement->statement == NULL) {
-        statement_release_lock(statement);
-        return make_error_tuple(env, am_invalid_statement);
-    }
-    int index = sqlite3_bind_parameter_index(statement->statement, (const char*)name.data);
-    statement_release_lock(statement);
-    return enif_make_int(env, index);
+    return columns;
 }
 
-///
-/// Binds a text parameter
-///
-ERL_NIF_TERM
-exqlite_bind_text(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+static inline int
+column_is_null(column_buffer_t* column, size_t row)
 {
-    statement_t* statement;
-    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
-        return raise_badarg(env, argv[0]);
-    }
-
-    unsigned int idx;
-    if (!enif_get_uint(env, argv[1], &idx)) {
-        return raise_badarg(env, argv[1]);
-    }
-
-    ErlNifBinary text;
-    if (!enif_inspect_binary(env, argv[2], &text)) {
-        return raise_badarg(env, argv[2]);
-    }
+    return column->nulls.data[row / 8] & (1 << (row % 8));
+}
 
-    statement_acquire_lock(statement);
-    if (statement->statement == NULL) {
-        statement_release_lock(statement);
-        return make_error_tuple(env, am_invalid_statement);
-    }
-    int rc = sqlite3_bind_text(statement->statement, idx, (char*)text.data, text.size, SQLITE_TRANSIENT);
-    statement_release_lock(statement);
-    return enif_make_int(env, rc);
+static inline sqlite3_int64
+column_offset(column_buffer_t* column, size_t row)
+{
+    sqlite3_int64 offset;
+    memcpy(&offset, column->offsets.data + row * sizeof(offset), sizeof(offset));
+    return offset;
 }
 
-///
-/// Binds a blob parameter
-///
-ERL_NIF_TERM
-exqlite_bind_blob(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+// Sizes the buffers once the storage class of a column is known. Rows seen so
+// far were all NULL, which zeroed buffers already represent.
+static int
+column_buffer_init(column_buffer_t* column, int type, size_t capacity)
 {
-    statement_t* statement;
-    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
-        return raise_badarg(env, argv[0]);
+    column->type = type;
+
+    if (type == SQLITE_INTEGER || type == SQLITE_FLOAT) {
+        if (!enif_alloc_binary(capacity * 8, &column->values)) {
+            return 0;
+        }
+        memset(column->values.data, 0, column->values.size);
+        return 1;
     }
 
-    unsigned int idx;
-    if (!enif_get_uint(env, argv[1], &idx)) {
-        return raise_badarg(env, argv[1]);
+    if (!enif_alloc_binary((capacity + 1) * 8, &column->offsets)) {
+        return 0;
     }
+    memset(column->offsets.data, 0, column->offsets.size);
 
-    ErlNifBinary blob;
-    if (!enif_inspect_binary(env, argv[2], &blob)) {
-        return raise_badarg(env, argv[2]);
+    return enif_alloc_binary(COLUMN_DATA_INITIAL_SIZE, &column->values);
+}
+
+// Converts the packed rows collected so far into terms, for a column whose
+// storage class changed part way through the chunk.
+static int
+column_buffer_make_mixed(ErlNifEnv* env, column_buffer_t* column, size_t rows, size_t capacity)
+{
+    column->cells = enif_alloc(sizeof(ERL_NIF_TERM) * capacity);
+    if (!column->cells) {
+        return 0;
     }
 
-    statement_acquire_lock(statement);
-    if (statement->statement == NULL) {
-        statement_release_lock(statement);
-        return make_error_tuple(env, am_invalid_statement);
+    for (size_t row = 0; row < rows; row++) {
+        if (column_is_null(column, row)) {
+            column->cells[row] = am_nil;
+            continue;
+        }
+
+        switch (column->type) {
+            case SQLITE_INTEGER: {
+                sqlite3_int64 i;
+                memcpy(&i, column->values.data + row * 8, 8);
+                column->cells[row] = enif_make_int64(env, i);
+                break;
+            }
+
+            case SQLITE_FLOAT: {
+                double f;
+                memcpy(&f, column->values.data + row * 8, 8);
+                column->cells[row] = enif_make_double(env, f);
+                break;
+            }
+
+            default: {
+                sqlite3_int64 start = column_offset(column, row);
+                sqlite3_int64 end   = column_offset(column, row + 1);
+                column->cells[row]  = make_binary(env, column->values.data + start, end - start);
+                break;
+            }
+        }
     }
-    int rc = sqlite3_bind_blob(statement->statement, idx, (char*)blob.data, blob.size, SQLITE_TRANSIENT);
-    statement_release_lock(statement);
-    return enif_make_int(env, rc);
+
+    if (column->values.data) {
+        enif_release_binary(&column->values);
+        column->values.data = NULL;
+    }
+    if (column->offsets.data) {
+        enif_release_binary(&column->offsets);
+        column->offsets.data = NULL;
+    }
+
+    column->type = COLUMN_MIXED;
+
+    return 1;
 }
 
-///
-/// Binds an integer parameter
-///
-ERL_NIF_TERM
-exqlite_bind_integer(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+static int
+column_buffer_append(ErlNifEnv* env, column_buffer_t* column, sqlite3_stmt* statement, int i, size_t row, size_t capacity)
 {
-    statement_t* statement;
-    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
-        return raise_badarg(env, argv[0]);
-    }
+    int type = sqlite3_column_type(statement, i);
 
-    unsigned int idx;
-    if (!enif_get_uint(env, argv[1], &idx)) {
-        return raise_badarg(env, argv[1]);
+    if (type == SQLITE_NULL) {
+        column->nulls.data[row / 8] |= 1 << (row % 8);
+
+        if (column->type == COLUMN_MIXED) {
+            column->cells[row] = am_nil;
+        } else if (column->type == SQLITE_TEXT || column->type == SQLITE_BLOB) {
+            sqlite3_int64 offset = column_offset(column, row);
+            memcpy(column->offsets.data + (row + 1) * 8, &offset, 8);
+        }
+
+        return 1;
     }
 
-    ErlNifSInt64 i;
-    if (!enif_get_int64(env, argv[2], &i)) {
-        return raise_badarg(env, argv[2]);
+    if (column->type == SQLITE_NULL) {
+        if (!column_buffer_init(column, type, capacity)) {
+            return 0;
+        }
+    } else if (column->type != type && column->type != COLUMN_MIXED) {
+        if (!column_buffer_make_mixed(env, column, row, capacity)) {
+            return 0;
+        }
     }
 
-    statement_acquire_lock(statement);
-    if (statement->statement == NULL) {
-        statement_release_lock(statement);
-        return make_error_tuple(env, am_invalid_statement);
+    switch (column->type) {
+        case SQLITE_INTEGER: {
+            sqlite3_int64 value = sqlite3_column_int64(statement, i);
+            memcpy(column->values.data + row * 8, &value, 8);
+            return 1;
+        }
+
+        case SQLITE_FLOAT: {
+            double value = sqlite3_column_double(statement, i);
+            memcpy(column->values.data + row * 8, &value, 8);
+            return 1;
+        }
+
+        case COLUMN_MIXED:
+            column->cells[row] = make_cell(env, statement, i);
+            return 1;
+
+        default: {
+            const void* bytes = type == SQLITE_TEXT
+                                  ? (const void*)sqlite3_column_text(statement, i)
+                                  : sqlite3_column_blob(statement, i);
+            size_t size       = sqlite3_column_bytes(statement, i);
+            size_t needed     = column->values_size + size;
+
+            if (needed > column->values.size) {
+                size_t grown = column->values.size * 2;
+                if (grown < needed) {
+                    grown = needed;
+                }
+                if (!enif_realloc_binary(&column->values, grown)) {
+                    return 0;
+                }
+            }
+
+            if (size > 0) {
+                memcpy(column->values.data + column->values_size, bytes, size);
+            }
+            column->values_size = needed;
+
+            sqlite3_int64 offset = needed;
+            memcpy(column->offsets.data + (row + 1) * 8, &offset, 8);
+            return 1;
+        }
     }
-    int rc = sqlite3_bind_int64(statement->statement, idx, i);
-    statement_release_lock(statement);
-    return enif_make_int(env, rc);
 }
 
-///
-/// Binds a float parameter
-///
-ERL_NIF_TERM
-exqlite_bind_float(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+// Hands the buffers over to terms, trimmed to the number of rows stepped.
+static ERL_NIF_TERM
+column_buffer_to_term(ErlNifEnv* env, column_buffer_t* column, size_t rows)
 {
-    statement_t* statement;
-    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
-        return raise_badarg(env, argv[0]);
-    }
+    ERL_NIF_TERM values;
+    ERL_NIF_TERM offsets;
+    ERL_NIF_TERM nulls;
 
-    unsigned int idx;
-    if (!enif_get_uint(env, argv[1], &idx)) {
-        return raise_badarg(env, argv[1]);
+    if (column->type == COLUMN_MIXED) {
+        values = enif_make_list_from_array(env, column->cells, rows);
+        return enif_make_tuple2(env, am_mixed, values);
     }
 
-    double f;
-    if (!enif_get_double(env, argv[2], &f)) {
-        return raise_badarg(env, argv[2]);
-    }
+    enif_realloc_binary(&column->nulls, (rows + 7) / 8);
+    nulls              = enif_make_binary(env, &column->nulls);
+    column->nulls.data = NULL;
 
-    statement_acquire_lock(statement);
-    if (statement->statement == NULL) {
-        statement_release_lock(statement);
-        return make_error_tuple(env, am_invalid_statement);
+    switch (column->type) {
+        case SQLITE_NULL:
+            return enif_make_tuple2(env, am_null, nulls);
+
+        case SQLITE_INTEGER:
+        case SQLITE_FLOAT:
+            enif_realloc_binary(&column->values, rows * 8);
+            values              = enif_make_binary(env, &column->values);
+            column->values.data = NULL;
+            return enif_make_tuple3(
+              env,
+              column->type == SQLITE_INTEGER ? am_integer : am_float,
+              values,
+              nulls);
+
+        default:
+            enif_realloc_binary(&column->offsets, (rows + 1) * 8);
+            offsets              = enif_make_binary(env, &column->offsets);
+            column->offsets.data = NULL;
+
+            enif_realloc_binary(&column->values, column->values_size);
+            values              = enif_make_binary(env, &column->values);
+            column->values.data = NULL;
+
+            return enif_make_tuple4(
+              env,
+              column->type == SQLITE_TEXT ? am_text : am_blob,
+              offsets,
+              values,
+              nulls);
     }
-    int rc = sqlite3_bind_double(statement->statement, idx, f);
-    statement_release_lock(statement);
-    return enif_make_int(env, rc);
 }
 
-///
-/// Binds a null parameter
-///
-ERL_NIF_TERM
-exqlite_bind_null(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+static ERL_NIF_TERM
+make_columnar_chunk(ErlNifEnv* env, ERL_NIF_TERM tag, column_buffer_t* columns, int count, size_t rows)
 {
-    statement_t* statement;
-    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
-        return raise_badarg(env, argv[0]);
+    ERL_NIF_TERM* terms = enif_alloc(sizeof(ERL_NIF_TERM) * (count > 0 ? count : 1));
+    if (!terms) {
+        column_buffers_free(columns, count);
+        return make_error_tuple(env, am_out_of_memory);
     }
 
-    unsigned int idx;
-    if (!enif_get_uint(env, argv[1], &idx)) {
-        return raise_badarg(env, argv[1]);
+    for (int i = 0; i < count; i++) {
+        terms[i] = column_buffer_to_term(env, &columns[i], rows);
     }
 
-    statement_acquire_lock(statement);
-    if (statement->statement == NULL) {
-        statement_release_lock(statement);
-        return make_error_tuple(env, am_invalid_statement);
-    }
-    int rc = sqlite3_bind_null(statement->statement, idx);
-    statement_release_lock(statement);
-    return enif_make_int(env, rc);
+    ERL_NIF_TERM list = enif_make_list_from_array(env, terms, count);
+    enif_free(terms);
+    column_buffers_free(columns, count);
+
+    return enif_make_tuple3(env, tag, enif_make_uint64(env, rows), list);
 }
 
 ///
-/// Steps the sqlite prepared statement multiple times.
-///
-/// This is to reduce the back and forth between the BEAM and sqlite in
-/// fetching data. Without using this, throughput can suffer.
+/// Steps the prepared statement up to `chunk_size` times and returns the
+/// rows as packed columns. See the "Columnar results" notes above.
 ///
 ERL_NIF_TERM
-exqlite_multi_step(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+exqlite_multi_step_columnar(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 {
     assert(env);
 
     statement_t* statement = NULL;
     connection_t* conn     = NULL;
+    column_buffer_t* columns;
+    ERL_NIF_TERM result;
     int chunk_size;
 
     if (argc != 3) {
@@ -959,15 +4799,7 @@ exqlite_multi_step(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
         return make_error_tuple(env, am_invalid_statement);
     }
 
-    if (!statement || !statement->statement) {
-        return make_error_tuple(env, am_invalid_statement);
-    }
-
-    if (!enif_get_int(env, argv[2], &chunk_size)) {
-        return make_error_tuple(env, am_invalid_chunk_size);
-    }
-
-    if (chunk_size < 1) {
+    if (!enif_get_int(env, argv[2], &chunk_size) || chunk_size < 1) {
         return make_error_tuple(env, am_invalid_chunk_size);
     }
 
@@ -976,6 +4808,7 @@ exqlite_multi_step(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
     }
 
     connection_acquire_lock(conn);
+    statement_prefetch_discard(statement);
     connection_stash_caller(conn, env);
 
     if (statement->statement == NULL) {
@@ -984,41 +4817,60 @@ exqlite_multi_step(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
         return make_error_tuple(env, am_invalid_statement);
     }
 
-    ERL_NIF_TERM rows = enif_make_list_from_array(env, NULL, 0);
-    for (int i = 0; i < chunk_size; i++) {
-        ERL_NIF_TERM row;
+    int count = sqlite3_column_count(statement->statement);
+    columns   = column_buffers_alloc(count, chunk_size);
+    if (!columns) {
+        connection_clear_caller(conn);
+        connection_release_lock(conn);
+        return make_error_tuple(env, am_out_of_memory);
+    }
+
+    for (size_t row = 0; row < (size_t)chunk_size; row++) {
+        ErlNifTime phase = query_stats_clock(conn);
+        int rc           = sqlite3_step(statement->statement);
+        query_stats_add(conn, &conn->query_stats.step_ns, phase);
 
-        int rc = sqlite3_step(statement->statement);
         switch (rc) {
-            case SQLITE_BUSY:
+            case SQLITE_ROW:
+                phase = query_stats_clock(conn);
+                for (int i = 0; i < count; i++) {
+                    if (!column_buffer_append(env, &columns[i], statement->statement, i, row, chunk_size)) {
+                        column_buffers_free(columns, count);
+                        connection_clear_caller(conn);
+                        connection_release_lock(conn);
+                        return make_error_tuple(env, am_out_of_memory);
+                    }
+                }
+                query_stats_count_row(conn, statement->statement, count, phase);
+                break;
+
+            case SQLITE_DONE:
                 sqlite3_reset(statement->statement);
                 connection_clear_caller(conn);
                 connection_release_lock(conn);
-                return am_busy;
+                return make_columnar_chunk(env, am_done, columns, count, row);
 
-            case SQLITE_DONE:
+            case SQLITE_BUSY:
                 sqlite3_reset(statement->statement);
+                column_buffers_free(columns, count);
                 connection_clear_caller(conn);
                 connection_release_lock(conn);
-                return enif_make_tuple2(env, am_done, rows);
-
-            case SQLITE_ROW:
-                row  = make_row(env, statement->statement);
-                rows = enif_make_list_cell(env, row, rows);
-                break;
+                return am_busy;
 
             default:
                 sqlite3_reset(statement->statement);
+                column_buffers_free(columns, count);
+                result = make_sqlite3_error_tuple(env, rc, conn->db);
                 connection_clear_caller(conn);
                 connection_release_lock(conn);
-                return make_sqlite3_error_tuple(env, rc, conn->db);
+                return result;
         }
     }
 
     connection_clear_caller(conn);
     connection_release_lock(conn);
 
-    return enif_make_tuple2(env, am_rows, rows);
+    return make_columnar_chunk(env, am_rows, columns, count, chunk_size);
 }
 
 ///
@@ -1034,8 +4886,10 @@ exqlite_step(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
     ERL_NIF_TERM result;
     statement_t* statement = NULL;
     connection_t* conn     = NULL;
+    row_options_t options = {0};
+    ErlNifSInt64 deadline;
 
-    if (argc != 2) {
+    if (argc != 4) {
         return enif_make_badarg(env);
     }
 
@@ -1047,12 +4901,22 @@ exqlite_step(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
         return make_error_tuple(env, am_invalid_statement);
     }
 
+    if (!get_row_format(env, argv[2], &options.tuples)) {
+        return raise_badarg(env, argv[2]);
+    }
+
     if (conn != statement->conn) {
         return enif_raise_exception(env, enif_make_atom(env, "cross_connection_call"));
     }
 
+    if (!get_deadline(env, argv[3], &deadline)) {
+        return raise_badarg(env, argv[3]);
+    }
+
     connection_acquire_lock(conn);
+    statement_prefetch_discard(statement);
     connection_stash_caller(conn, env);
+    connection_arm_deadline(conn, deadline);
 
     if (statement->statement == NULL) {
         connection_clear_caller(conn);
@@ -1060,47 +4924,202 @@ exqlite_step(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
         return make_error_tuple(env, am_invalid_statement);
     }
 
-    int rc = sqlite3_step(statement->statement);
-    switch (rc) {
-        case SQLITE_ROW:
-            result = enif_make_tuple2(env, am_row, make_row(env, statement->statement));
-            connection_clear_caller(conn);
-            connection_release_lock(conn);
-            return result;
-        case SQLITE_BUSY:
-            sqlite3_reset(statement->statement);
-            connection_clear_caller(conn);
-            connection_release_lock(conn);
-            return am_busy;
-        case SQLITE_DONE:
-            sqlite3_reset(statement->statement);
-            connection_clear_caller(conn);
-            connection_release_lock(conn);
-            return am_done;
-        default:
-            sqlite3_reset(statement->statement);
-            result = make_sqlite3_error_tuple(env, rc, conn->db);
-            connection_clear_caller(conn);
-            connection_release_lock(conn);
-            return result;
+    ErlNifTime started = query_stats_clock(conn);
+    int rc             = sqlite3_step(statement->statement);
+    query_stats_add(conn, &conn->query_stats.step_ns, started);
+
+    switch (rc) {
+        case SQLITE_ROW: {
+            chunk_t chunk;
+            chunk_init(&chunk, sqlite3_column_count(statement->statement), &options, connection_query_stats(conn));
+
+            if (!chunk_add_row(env, &chunk, statement->statement)) {
+                result = make_error_tuple(env, am_out_of_memory);
+            } else {
+                chunk_finish(env, &chunk);
+                result = enif_make_tuple2(env, am_row, chunk_row(env, &chunk, 0));
+            }
+
+            chunk_free(&chunk);
+            connection_clear_caller(conn);
+            connection_release_lock(conn);
+            return result;
+        }
+        case SQLITE_BUSY:
+            sqlite3_reset(statement->statement);
+            connection_clear_caller(conn);
+            connection_release_lock(conn);
+            return am_busy;
+        case SQLITE_DONE:
+            sqlite3_reset(statement->statement);
+            connection_clear_caller(conn);
+            connection_release_lock(conn);
+            return am_done;
+        default:
+            sqlite3_reset(statement->statement);
+            result = make_sqlite3_error_tuple(env, rc, conn->db);
+            connection_clear_caller(conn);
+            connection_release_lock(conn);
+            return result;
+    }
+}
+
+typedef enum statement_metadata_field
+{
+    METADATA_COLUMNS,
+    METADATA_COLUMN_TYPES,
+    METADATA_READONLY,
+} statement_metadata_field_t;
+
+// Returns a piece of metadata cached on the statement. The lists are copied
+// from the statement's env onto the caller's heap, which is cheaper than
+// asking SQLite again but still allocates.
+//
+// Runs on a normal scheduler. While a query holds the connection lock it
+// reschedules itself as `nif` on a dirty IO scheduler and waits there.
+static ERL_NIF_TERM
+statement_metadata(ErlNifEnv* env,
+                   int argc,
+                   const ERL_NIF_TERM argv[],
+                   statement_metadata_field_t field,
+                   const char* name,
+                   nif_function_t nif)
+{
+    statement_t* statement = NULL;
+    connection_t* conn     = NULL;
+    ERL_NIF_TERM result;
+
+    if (argc != 2) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    if (!enif_get_resource(env, argv[1], statement_type, (void**)&statement)) {
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    if (conn != statement->conn) {
+        return enif_raise_exception(env, enif_make_atom(env, "cross_connection_call"));
+    }
+
+    if (enif_thread_type() != ERL_NIF_THR_NORMAL_SCHEDULER) {
+        statement_acquire_lock(statement);
+    } else if (!connection_try_acquire_lock(conn)) {
+        return enif_schedule_nif(env, name, ERL_NIF_DIRTY_JOB_IO_BOUND, nif, argc, argv);
+    }
+
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    if (!statement_ensure_metadata(statement)) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_out_of_memory);
+    }
+
+    switch (field) {
+        case METADATA_COLUMNS:
+            result = enif_make_copy(env, statement->columns);
+            break;
+
+        case METADATA_COLUMN_TYPES:
+            result = enif_make_copy(env, statement->column_types);
+            break;
+
+        default:
+            result = statement->readonly ? am_true : am_false;
+            break;
+    }
+
+    statement_release_lock(statement);
+
+    return make_ok_tuple(env, result);
+}
+
+///
+/// Starts the connection's async worker thread, if it is not running yet.
+///
+ERL_NIF_TERM
+exqlite_start_worker(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    connection_t* conn  = NULL;
+    ERL_NIF_TERM result = am_ok;
+
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    stopped_workers_join();
+
+    enif_mutex_lock(conn->interrupt_mutex);
+
+    if (conn->db == NULL) {
+        result = make_error_tuple(env, am_connection_closed);
+    } else if (conn->worker == NULL) {
+        conn->worker = async_worker_create();
+        if (!conn->worker) {
+            result = make_error_tuple(env, am_failed_to_create_thread);
+        }
+    }
+
+    enif_mutex_unlock(conn->interrupt_mutex);
+
+    return result;
+}
+
+static int
+get_async_function(ERL_NIF_TERM name, nif_function_t* function, int* arity)
+{
+    if (enif_is_identical(name, am_execute)) {
+        *function = exqlite_execute;
+        *arity    = 3;
+    } else if (enif_is_identical(name, am_prepare)) {
+        *function = exqlite_prepare;
+        *arity    = 2;
+    } else if (enif_is_identical(name, am_step)) {
+        *function = exqlite_step;
+        *arity    = 4;
+    } else if (enif_is_identical(name, am_multi_step)) {
+        *function = exqlite_multi_step;
+        *arity    = 6;
+    } else {
+        return 0;
     }
+
+    return 1;
 }
 
 ///
-/// Get the columns requested in a prepared statement
+/// Queues `function(conn, args...)` on the connection's async worker. Returns
+/// {:ok, ref} right away, the worker sends {ref, result} to the caller once
+/// the call has run.
 ///
 ERL_NIF_TERM
-exqlite_columns(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+exqlite_async_call(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 {
     assert(env);
 
-    int size               = 0;
-    statement_t* statement = NULL;
     connection_t* conn     = NULL;
-    ERL_NIF_TERM* columns;
-    ERL_NIF_TERM result;
+    statement_t* statement = NULL;
+    async_job_t* job       = NULL;
+    nif_function_t function;
+    ERL_NIF_TERM head;
+    ERL_NIF_TERM tail;
+    ERL_NIF_TERM ref;
+    unsigned int length;
+    int arity;
 
-    if (argc != 2) {
+    if (argc != 3) {
         return enif_make_badarg(env);
     }
 
@@ -1108,52 +5127,102 @@ exqlite_columns(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
         return make_error_tuple(env, am_invalid_connection);
     }
 
-    if (!enif_get_resource(env, argv[1], statement_type, (void**)&statement)) {
-        return make_error_tuple(env, am_invalid_statement);
+    if (!get_async_function(argv[1], &function, &arity)) {
+        return raise_badarg(env, argv[1]);
     }
 
-    if (conn != statement->conn) {
-        return enif_raise_exception(env, enif_make_atom(env, "cross_connection_call"));
+    if (!enif_get_list_length(env, argv[2], &length) || length != (unsigned int)(arity - 1)) {
+        return raise_badarg(env, argv[2]);
     }
 
-    statement_acquire_lock(statement);
-    if (statement->statement == NULL) {
-        statement_release_lock(statement);
-        return make_error_tuple(env, am_invalid_statement);
+    // The worker has no process to raise in, so check this one up front.
+    enif_get_list_cell(env, argv[2], &head, &tail);
+    if (enif_get_resource(env, head, statement_type, (void**)&statement) && statement->conn != conn) {
+        return enif_raise_exception(env, enif_make_atom(env, "cross_connection_call"));
     }
-    size = sqlite3_column_count(statement->statement);
 
-    if (size == 0) {
-        statement_release_lock(statement);
-        return make_ok_tuple(env, enif_make_list(env, 0));
-    } else if (size < 0) {
-        statement_release_lock(statement);
-        return make_error_tuple(env, am_invalid_column_count);
+    job = enif_alloc(sizeof(async_job_t));
+    if (!job) {
+        return make_error_tuple(env, am_out_of_memory);
     }
 
-    columns = enif_alloc(sizeof(ERL_NIF_TERM) * size);
-    if (!columns) {
-        statement_release_lock(statement);
+    memset(job, 0, sizeof(async_job_t));
+    job->function = function;
+    job->argc     = arity;
+
+    job->env = enif_alloc_env();
+    if (!job->env) {
+        async_job_free(job);
         return make_error_tuple(env, am_out_of_memory);
     }
 
-    for (int i = 0; i < size; i++) {
-        const char* name = sqlite3_column_name(statement->statement, i);
-        if (!name) {
-            enif_free(columns);
-            statement_release_lock(statement);
-            return make_error_tuple(env, am_out_of_memory);
-        }
+    ref      = enif_make_ref(env);
+    job->ref = enif_make_copy(job->env, ref);
+    enif_self(env, &job->caller);
 
-        columns[i] = make_binary(env, name, strlen(name));
+    job->argv[0] = enif_make_copy(job->env, argv[0]);
+    tail         = argv[2];
+    for (int i = 1; i < arity; i++) {
+        enif_get_list_cell(env, tail, &head, &tail);
+        job->argv[i] = enif_make_copy(job->env, head);
     }
 
-    statement_release_lock(statement);
+    // Enqueue under interrupt_mutex so close/1 cannot stop and free the
+    // worker in between.
+    enif_mutex_lock(conn->interrupt_mutex);
 
-    result = enif_make_list_from_array(env, columns, size);
-    enif_free(columns);
+    if (conn->worker == NULL) {
+        enif_mutex_unlock(conn->interrupt_mutex);
+        async_job_free(job);
+        return make_error_tuple(env, am_no_worker);
+    }
 
-    return make_ok_tuple(env, result);
+    enif_mutex_lock(conn->worker->mutex);
+    if (conn->worker->tail) {
+        conn->worker->tail->next = job;
+    } else {
+        conn->worker->head = job;
+    }
+    conn->worker->tail = job;
+    enif_cond_signal(conn->worker->cond);
+    enif_mutex_unlock(conn->worker->mutex);
+
+    enif_mutex_unlock(conn->interrupt_mutex);
+
+    return make_ok_tuple(env, ref);
+}
+
+///
+/// Get the columns requested in a prepared statement
+///
+ERL_NIF_TERM
+exqlite_columns(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    return statement_metadata(env, argc, argv, METADATA_COLUMNS, "columns", exqlite_columns);
+}
+
+///
+/// Get the declared types of the columns in a prepared statement
+///
+ERL_NIF_TERM
+exqlite_column_types(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    return statement_metadata(env, argc, argv, METADATA_COLUMN_TYPES, "column_types", exqlite_column_types);
+}
+
+///
+/// Checks whether a prepared statement leaves the database unchanged
+///
+ERL_NIF_TERM
+exqlite_statement_readonly(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    return statement_metadata(env, argc, argv, METADATA_READONLY, "statement_readonly", exqlite_statement_readonly);
 }
 
 ///
@@ -1322,6 +5391,168 @@ exqlite_deserialize(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
     return am_ok;
 }
 
+#ifdef SQLITE_ENABLE_SNAPSHOT
+
+///
+/// Records the state of the main database the connection currently reads.
+///
+ERL_NIF_TERM
+exqlite_snapshot_get(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    connection_t* conn     = NULL;
+    snapshot_t* snapshot   = NULL;
+    sqlite3_snapshot* snap = NULL;
+    ERL_NIF_TERM result;
+    int rc = 0;
+
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    connection_acquire_lock(conn);
+
+    if (conn->db == NULL) {
+        connection_release_lock(conn);
+        return make_error_tuple(env, am_connection_closed);
+    }
+
+    rc = sqlite3_snapshot_get(conn->db, "main", &snap);
+    if (rc != SQLITE_OK) {
+        result = make_sqlite3_error_tuple(env, rc, conn->db);
+        connection_release_lock(conn);
+        return result;
+    }
+
+    connection_release_lock(conn);
+
+    snapshot = enif_alloc_resource(snapshot_type, sizeof(snapshot_t));
+    if (!snapshot) {
+        sqlite3_snapshot_free(snap);
+        return make_error_tuple(env, am_out_of_memory);
+    }
+
+    snapshot->snapshot = snap;
+    snapshot->mutex    = enif_mutex_create("exqlite:snapshot");
+    if (!snapshot->mutex) {
+        enif_release_resource(snapshot);
+        return make_error_tuple(env, am_out_of_memory);
+    }
+
+    result = enif_make_resource(env, snapshot);
+    enif_release_resource(snapshot);
+
+    return make_ok_tuple(env, result);
+}
+
+///
+/// Moves the read transaction of the connection onto a snapshot.
+///
+ERL_NIF_TERM
+exqlite_snapshot_open(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    connection_t* conn   = NULL;
+    snapshot_t* snapshot = NULL;
+    ERL_NIF_TERM result;
+    int rc = 0;
+
+    if (argc != 2) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    if (!enif_get_resource(env, argv[1], snapshot_type, (void**)&snapshot)) {
+        return make_error_tuple(env, am_invalid_snapshot);
+    }
+
+    connection_acquire_lock(conn);
+
+    if (conn->db == NULL) {
+        connection_release_lock(conn);
+        return make_error_tuple(env, am_connection_closed);
+    }
+
+    enif_mutex_lock(snapshot->mutex);
+
+    if (snapshot->snapshot == NULL) {
+        enif_mutex_unlock(snapshot->mutex);
+        connection_release_lock(conn);
+        return make_error_tuple(env, am_invalid_snapshot);
+    }
+
+    rc = sqlite3_snapshot_open(conn->db, "main", snapshot->snapshot);
+    enif_mutex_unlock(snapshot->mutex);
+
+    if (rc != SQLITE_OK) {
+        result = make_sqlite3_error_tuple(env, rc, conn->db);
+        connection_release_lock(conn);
+        return result;
+    }
+
+    connection_release_lock(conn);
+    return am_ok;
+}
+
+///
+/// Frees a snapshot ahead of garbage collection.
+///
+ERL_NIF_TERM
+exqlite_snapshot_free(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    snapshot_t* snapshot = NULL;
+
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], snapshot_type, (void**)&snapshot)) {
+        return make_error_tuple(env, am_invalid_snapshot);
+    }
+
+    enif_mutex_lock(snapshot->mutex);
+    if (snapshot->snapshot) {
+        sqlite3_snapshot_free(snapshot->snapshot);
+        snapshot->snapshot = NULL;
+    }
+    enif_mutex_unlock(snapshot->mutex);
+
+    return am_ok;
+}
+
+#else
+
+ERL_NIF_TERM
+exqlite_snapshot_get(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return make_error_tuple(env, am_snapshots_not_supported);
+}
+
+ERL_NIF_TERM
+exqlite_snapshot_open(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return make_error_tuple(env, am_snapshots_not_supported);
+}
+
+ERL_NIF_TERM
+exqlite_snapshot_free(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    return make_error_tuple(env, am_snapshots_not_supported);
+}
+
+#endif
+
 ///
 /// Releases a prepared statement's consumed memory and allows the system to
 /// reclaim it.
@@ -1348,12 +5579,15 @@ exqlite_release(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 
     statement_acquire_lock(statement);
 
+    prefetch_job_t* job = statement_prefetch_detach(statement);
+
     if (statement->statement) {
         sqlite3_finalize(statement->statement);
         statement->statement = NULL;
     }
 
     statement_release_lock(statement);
+    prefetch_job_reap(job);
 
     return am_ok;
 }
@@ -1366,6 +5600,12 @@ connection_type_destructor(ErlNifEnv* env, void* arg)
 
     connection_t* conn = (connection_t*)arg;
 
+    // No job is in flight, each holds a reference, so the worker is idle.
+    if (conn->worker) {
+        async_worker_stop(conn->worker);
+        conn->worker = NULL;
+    }
+
     if (conn->mutex) {
         connection_acquire_lock(conn);
     }
@@ -1374,7 +5614,7 @@ connection_type_destructor(ErlNifEnv* env, void* arg)
         enif_mutex_lock(conn->interrupt_mutex);
         // Signal cancel to wake any busy handler that might still be sleeping,
         // so it returns and releases SQLite's db->mutex before we close.
-        conn->cancelled = 1;
+        ATOMIC_STORE_INT64(&conn->cancelled, 1);
     }
 
     if (conn->db) {
@@ -1390,6 +5630,11 @@ connection_type_destructor(ErlNifEnv* env, void* arg)
         connection_release_lock(conn);
     }
 
+    if (conn->arbiter) {
+        write_arbiter_release(conn->arbiter);
+        conn->arbiter = NULL;
+    }
+
     if (conn->mutex) {
         enif_mutex_destroy(conn->mutex);
         conn->mutex = NULL;
@@ -1410,14 +5655,43 @@ statement_type_destructor(ErlNifEnv* env, void* arg)
     statement_t* statement = (statement_t*)arg;
     statement_acquire_lock(statement);
 
+    prefetch_job_t* job = statement_prefetch_detach(statement);
+
     if (statement->statement) {
         sqlite3_finalize(statement->statement);
         statement->statement = NULL;
     }
 
     statement_release_lock(statement);
+    prefetch_job_orphan(job);
     enif_release_resource(statement->conn);
     statement->conn = NULL;
+
+    if (statement->env) {
+        enif_free_env(statement->env);
+        statement->env = NULL;
+    }
+}
+
+void
+snapshot_type_destructor(ErlNifEnv* env, void* arg)
+{
+    assert(env);
+    assert(arg);
+
+    snapshot_t* snapshot = (snapshot_t*)arg;
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    if (snapshot->snapshot) {
+        sqlite3_snapshot_free(snapshot->snapshot);
+        snapshot->snapshot = NULL;
+    }
+#endif
+
+    if (snapshot->mutex) {
+        enif_mutex_destroy(snapshot->mutex);
+        snapshot->mutex = NULL;
+    }
 }
 
 int
@@ -1435,8 +5709,46 @@ on_load(ErlNifEnv* env, void** priv, ERL_NIF_TERM info)
       exqlite_mem_shutdown,
       0};
 
+    static const sqlite3_mem_methods pool_methods = {
+      exqlite_pool_malloc,
+      exqlite_pool_free,
+      exqlite_pool_realloc,
+      exqlite_mem_size,
+      exqlite_mem_round_up,
+      exqlite_mem_init,
+      exqlite_mem_shutdown,
+      0};
+
+    char allocator[16];
+    size_t allocator_size = sizeof(allocator);
+
+    static const sqlite3_pcache_methods2 pcache_methods = {
+      1,
+      &default_pcache_methods,
+      budget_cache_init,
+      budget_cache_shutdown,
+      budget_cache_create,
+      budget_cache_cachesize,
+      budget_cache_pagecount,
+      budget_cache_fetch,
+      budget_cache_unpin,
+      budget_cache_rekey,
+      budget_cache_truncate,
+      budget_cache_destroy,
+      budget_cache_shrink};
+
+    if (enif_getenv("EXQLITE_ALLOCATOR", allocator, &allocator_size) == 0 && strcmp(allocator, "pool") == 0) {
+        if (!exqlite_pool_init()) {
+            exqlite_pool_shutdown();
+            return -1;
+        }
+        pool_allocator_enabled = 1;
+    }
+
     sqlite3_config(SQLITE_CONFIG_GETMALLOC, &default_alloc_methods);
-    sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+    sqlite3_config(SQLITE_CONFIG_MALLOC, pool_allocator_enabled ? &pool_methods : &methods);
+    sqlite3_config(SQLITE_CONFIG_GETPCACHE2, &default_pcache_methods);
+    sqlite3_config(SQLITE_CONFIG_PCACHE2, &pcache_methods);
 
     am_ok                                  = enif_make_atom(env, "ok");
     am_error                               = enif_make_atom(env, "error");
@@ -1454,6 +5766,8 @@ on_load(ErlNifEnv* env, void** priv, ERL_NIF_TERM info)
     am_sql_not_iolist                      = enif_make_atom(env, "sql_not_iolist");
     am_connection_closed                   = enif_make_atom(env, "connection_closed");
     am_invalid_statement                   = enif_make_atom(env, "invalid_statement");
+    am_invalid_snapshot                    = enif_make_atom(env, "invalid_snapshot");
+    am_snapshots_not_supported             = enif_make_atom(env, "snapshots_not_supported");
     am_invalid_chunk_size                  = enif_make_atom(env, "invalid_chunk_size");
     am_busy                                = enif_make_atom(env, "busy");
     am_invalid_column_count                = enif_make_atom(env, "invalid_column_count");
@@ -1468,6 +5782,104 @@ on_load(ErlNifEnv* env, void** priv, ERL_NIF_TERM info)
     am_update                              = enif_make_atom(env, "update");
     am_invalid_pid                         = enif_make_atom(env, "invalid_pid");
     am_log                                 = enif_make_atom(env, "log");
+    am_blob                                = enif_make_atom(env, "blob");
+    am_undefined                           = enif_make_atom(env, "undefined");
+    am_invalid_parameter_count             = enif_make_atom(env, "invalid_parameter_count");
+    am_unknown_parameter                   = enif_make_atom(env, "unknown_parameter");
+    am_unsupported_type                    = enif_make_atom(env, "unsupported_type");
+    am_integer                             = enif_make_atom(env, "integer");
+    am_float                               = enif_make_atom(env, "float");
+    am_text                                = enif_make_atom(env, "text");
+    am_null                                = enif_make_atom(env, "null");
+    am_mixed                               = enif_make_atom(env, "mixed");
+    am_true                                = enif_make_atom(env, "true");
+    am_false                               = enif_make_atom(env, "false");
+    am_list                                = enif_make_atom(env, "list");
+    am_tuple                               = enif_make_atom(env, "tuple");
+    am_bind                                = enif_make_atom(env, "bind");
+    am_raw                                 = enif_make_atom(env, "raw");
+    am_boolean                             = enif_make_atom(env, "boolean");
+    am_naive_datetime                      = enif_make_atom(env, "naive_datetime");
+    am_date                                = enif_make_atom(env, "date");
+    am_json                                = enif_make_atom(env, "json");
+    am_atom_from_text                      = enif_make_atom(env, "atom_from_text");
+    am_calendar                            = enif_make_atom(env, "calendar");
+    am_year                                = enif_make_atom(env, "year");
+    am_month                               = enif_make_atom(env, "month");
+    am_day                                 = enif_make_atom(env, "day");
+    am_hour                                = enif_make_atom(env, "hour");
+    am_minute                              = enif_make_atom(env, "minute");
+    am_second                              = enif_make_atom(env, "second");
+    am_microsecond                         = enif_make_atom(env, "microsecond");
+    am___struct__                          = enif_make_atom(env, "__struct__");
+    am_calendar_iso                        = enif_make_atom(env, "Elixir.Calendar.ISO");
+    am_elixir_date                         = enif_make_atom(env, "Elixir.Date");
+    am_elixir_naive_datetime               = enif_make_atom(env, "Elixir.NaiveDateTime");
+    am_execute                             = enif_make_atom(env, "execute");
+    am_prepare                             = enif_make_atom(env, "prepare");
+    am_step                                = enif_make_atom(env, "step");
+    am_multi_step                          = enif_make_atom(env, "multi_step");
+    am_no_worker                           = enif_make_atom(env, "no_worker");
+    am_failed_to_create_thread             = enif_make_atom(env, "failed_to_create_thread");
+    am_lock_acquisitions                   = enif_make_atom(env, "lock_acquisitions");
+    am_lock_contended                      = enif_make_atom(env, "lock_contended");
+    am_lock_wait_ns                        = enif_make_atom(env, "lock_wait_ns");
+    am_lock_max_wait_ns                    = enif_make_atom(env, "lock_max_wait_ns");
+    am_busy_handler_calls                  = enif_make_atom(env, "busy_handler_calls");
+    am_busy_sleep_ms                       = enif_make_atom(env, "busy_sleep_ms");
+    am_busy_timeouts                       = enif_make_atom(env, "busy_timeouts");
+    am_infinity                            = enif_make_atom(env, "infinity");
+    am_allocator                           = enif_make_atom(env, "allocator");
+    am_default                             = enif_make_atom(env, "default");
+    am_pool                                = enif_make_atom(env, "pool");
+    am_classes                             = enif_make_atom(env, "classes");
+    am_size                                = enif_make_atom(env, "size");
+    am_allocations                         = enif_make_atom(env, "allocations");
+    am_reused                              = enif_make_atom(env, "reused");
+    am_in_use                              = enif_make_atom(env, "in_use");
+    am_high_water                          = enif_make_atom(env, "high_water");
+    am_cached                              = enif_make_atom(env, "cached");
+    am_prepare_ns                          = enif_make_atom(env, "prepare_ns");
+    am_bind_ns                             = enif_make_atom(env, "bind_ns");
+    am_step_ns                             = enif_make_atom(env, "step_ns");
+    am_decode_ns                           = enif_make_atom(env, "decode_ns");
+    am_rows_returned                       = enif_make_atom(env, "rows_returned");
+    am_bytes_returned                      = enif_make_atom(env, "bytes_returned");
+    am_fullscan_step                       = enif_make_atom(env, "fullscan_step");
+    am_sort                                = enif_make_atom(env, "sort");
+    am_autoindex                           = enif_make_atom(env, "autoindex");
+    am_vm_step                             = enif_make_atom(env, "vm_step");
+    am_reprepare                           = enif_make_atom(env, "reprepare");
+    am_run                                 = enif_make_atom(env, "run");
+    am_filter_miss                         = enif_make_atom(env, "filter_miss");
+    am_filter_hit                          = enif_make_atom(env, "filter_hit");
+    am_memused                             = enif_make_atom(env, "memused");
+    am_lookaside_used                      = enif_make_atom(env, "lookaside_used");
+    am_lookaside_used_highwater            = enif_make_atom(env, "lookaside_used_highwater");
+    am_lookaside_hit                       = enif_make_atom(env, "lookaside_hit");
+    am_lookaside_miss_size                 = enif_make_atom(env, "lookaside_miss_size");
+    am_lookaside_miss_full                 = enif_make_atom(env, "lookaside_miss_full");
+    am_cache_used                          = enif_make_atom(env, "cache_used");
+    am_cache_used_shared                   = enif_make_atom(env, "cache_used_shared");
+    am_cache_hit                           = enif_make_atom(env, "cache_hit");
+    am_cache_miss                          = enif_make_atom(env, "cache_miss");
+    am_cache_write                         = enif_make_atom(env, "cache_write");
+    am_cache_spill                         = enif_make_atom(env, "cache_spill");
+    am_schema_used                         = enif_make_atom(env, "schema_used");
+    am_stmt_used                           = enif_make_atom(env, "stmt_used");
+    am_deferred_fks                        = enif_make_atom(env, "deferred_fks");
+    am_tempbuf_spill                       = enif_make_atom(env, "tempbuf_spill");
+    am_memory_used                         = enif_make_atom(env, "memory_used");
+    am_memory_used_highwater               = enif_make_atom(env, "memory_used_highwater");
+    am_malloc_count                        = enif_make_atom(env, "malloc_count");
+    am_malloc_count_highwater              = enif_make_atom(env, "malloc_count_highwater");
+    am_malloc_size_highwater               = enif_make_atom(env, "malloc_size_highwater");
+    am_pagecache_used                      = enif_make_atom(env, "pagecache_used");
+    am_pagecache_used_highwater            = enif_make_atom(env, "pagecache_used_highwater");
+    am_pagecache_overflow                  = enif_make_atom(env, "pagecache_overflow");
+    am_pagecache_overflow_highwater        = enif_make_atom(env, "pagecache_overflow_highwater");
+    am_pagecache_size_highwater            = enif_make_atom(env, "pagecache_size_highwater");
+    am_parser_stack_highwater              = enif_make_atom(env, "parser_stack_highwater");
 
     connection_type = enif_open_resource_type(
       env,
@@ -1491,11 +5903,37 @@ on_load(ErlNifEnv* env, void** priv, ERL_NIF_TERM info)
         return -1;
     }
 
+    snapshot_type = enif_open_resource_type(
+      env,
+      NULL,
+      "snapshot_type",
+      snapshot_type_destructor,
+      ERL_NIF_RT_CREATE,
+      NULL);
+    if (!snapshot_type) {
+        return -1;
+    }
+
     log_hook_mutex = enif_mutex_create("exqlite:log_hook");
     if (!log_hook_mutex) {
         return -1;
     }
 
+    stopped_workers_mutex = enif_mutex_create("exqlite:stopped_workers");
+    if (!stopped_workers_mutex) {
+        return -1;
+    }
+
+    prefetch_orphans_mutex = enif_mutex_create("exqlite:prefetch_orphans");
+    if (!prefetch_orphans_mutex) {
+        return -1;
+    }
+
+    write_arbiters_mutex = enif_mutex_create("exqlite:write_arbiters");
+    if (!write_arbiters_mutex) {
+        return -1;
+    }
+
     return 0;
 }
 
@@ -1505,7 +5943,17 @@ on_unload(ErlNifEnv* caller_env, void* priv_data)
     assert(caller_env);
 
     sqlite3_config(SQLITE_CONFIG_MALLOC, &default_alloc_methods);
+    sqlite3_config(SQLITE_CONFIG_PCACHE2, &default_pcache_methods);
     enif_mutex_destroy(log_hook_mutex);
+    enif_mutex_destroy(write_arbiters_mutex);
+    prefetch_orphans_reap(1);
+    enif_mutex_destroy(prefetch_orphans_mutex);
+    stopped_workers_join();
+    enif_mutex_destroy(stopped_workers_mutex);
+
+    if (pool_allocator_enabled) {
+        exqlite_pool_shutdown();
+    }
 }
 
 // We don't need to upgrade anything yet
@@ -1851,6 +6299,31 @@ log_callback(void* arg, int iErrCode, const char* zMsg)
     enif_free_env(msg_env);
 }
 
+///
+/// Sets the memory budget, in bytes, that the page caches of all file
+/// databases share. 0 removes the budget.
+///
+ERL_NIF_TERM
+exqlite_set_page_cache_budget(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    ErlNifSInt64 budget;
+
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_int64(env, argv[0], &budget) || budget < 0) {
+        return raise_badarg(env, argv[0]);
+    }
+
+    ATOMIC_STORE_INT64(&page_cache_budget, budget);
+    ATOMIC_ADD_INT64(&page_cache_generation, 1);
+
+    return am_ok;
+}
+
 ERL_NIF_TERM
 exqlite_set_log_hook(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 {
@@ -2014,15 +6487,473 @@ exqlite_cancel(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
     // We deliberately avoid conn->mutex here: the running query holds it for
     // the duration of the SQLite call, so taking it would block cancellation.
     enif_mutex_lock(conn->interrupt_mutex);
-    conn->cancelled = 1;
+    ATOMIC_STORE_INT64(&conn->cancelled, 1);
     if (conn->db != NULL) {
         sqlite3_interrupt(conn->db);
     }
     enif_mutex_unlock(conn->interrupt_mutex);
 
+    // Wake the busy handler if it waits on the write lock arbiter.
+    if (conn->arbiter) {
+        ARBITER_LOCK(&conn->arbiter->lock);
+        ARBITER_BROADCAST(&conn->arbiter->cond);
+        ARBITER_UNLOCK(&conn->arbiter->lock);
+    }
+
+    return am_ok;
+}
+
+///
+/// Sets the monotonic time, in nanoseconds, after which the progress handler
+/// interrupts and the busy handler stops waiting, for every call on the
+/// connection. :infinity clears it. Deadlines of single calls are passed to
+/// the call instead and do not touch this one.
+/// A single atomic store, it neither takes a lock nor wakes anything up.
+///
+ERL_NIF_TERM
+exqlite_set_deadline(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    connection_t* conn = NULL;
+    ErlNifSInt64 deadline;
+
+    if (argc != 2) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    if (!get_deadline(env, argv[1], &deadline)) {
+        return raise_badarg(env, argv[1]);
+    }
+
+    ATOMIC_STORE_INT64(&conn->deadline, deadline);
+
+    return am_ok;
+}
+
+///
+/// Returns the connection's lock and busy handler counters as a map.
+/// Like cancel/1 it avoids conn->mutex, so it answers while a query runs, and
+/// the counters are atomics, so it takes no other lock either.
+///
+ERL_NIF_TERM
+exqlite_lock_stats(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    connection_t* conn = NULL;
+    connection_stats_t* stats;
+    ERL_NIF_TERM result;
+
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    // Each counter is read on its own, so they may be a call apart.
+    stats = &conn->stats;
+
+    ERL_NIF_TERM keys[] = {
+      am_lock_acquisitions,
+      am_lock_contended,
+      am_lock_wait_ns,
+      am_lock_max_wait_ns,
+      am_busy_handler_calls,
+      am_busy_sleep_ms,
+      am_busy_timeouts,
+    };
+    ERL_NIF_TERM values[] = {
+      enif_make_uint64(env, ATOMIC_LOAD_INT64(&stats->lock_acquisitions)),
+      enif_make_uint64(env, ATOMIC_LOAD_INT64(&stats->lock_contended)),
+      enif_make_uint64(env, ATOMIC_LOAD_INT64(&stats->lock_wait_ns)),
+      enif_make_uint64(env, ATOMIC_LOAD_INT64(&stats->lock_max_wait_ns)),
+      enif_make_uint64(env, ATOMIC_LOAD_INT64(&stats->busy_handler_calls)),
+      enif_make_uint64(env, ATOMIC_LOAD_INT64(&stats->busy_sleep_ms)),
+      enif_make_uint64(env, ATOMIC_LOAD_INT64(&stats->busy_timeouts)),
+    };
+
+    enif_make_map_from_arrays(env, keys, values, sizeof(keys) / sizeof(keys[0]), &result);
+
+    return make_ok_tuple(env, result);
+}
+
+///
+/// Turns collecting query stats on the connection on or off. Turning them off
+/// also clears them.
+///
+ERL_NIF_TERM
+exqlite_set_query_stats(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    connection_t* conn = NULL;
+
+    if (argc != 2) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    if (!enif_is_identical(argv[1], am_true) && !enif_is_identical(argv[1], am_false)) {
+        return raise_badarg(env, argv[1]);
+    }
+
+    connection_acquire_lock(conn);
+    if (!enif_is_identical(argv[1], am_true)) {
+        memset(&conn->query_stats, 0, sizeof(conn->query_stats));
+    }
+    conn->query_stats.enabled = enif_is_identical(argv[1], am_true);
+    connection_release_lock(conn);
+
     return am_ok;
 }
 
+///
+/// Returns the query stats collected since they were last taken as a map and
+/// clears them.
+///
+ERL_NIF_TERM
+exqlite_take_query_stats(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    connection_t* conn = NULL;
+    query_stats_t stats;
+    ERL_NIF_TERM result;
+
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    connection_acquire_lock(conn);
+    stats = conn->query_stats;
+    memset(&conn->query_stats, 0, sizeof(conn->query_stats));
+    conn->query_stats.enabled = stats.enabled;
+    connection_release_lock(conn);
+
+    ERL_NIF_TERM keys[] = {
+      am_prepare_ns,
+      am_bind_ns,
+      am_step_ns,
+      am_decode_ns,
+      am_rows_returned,
+      am_bytes_returned,
+    };
+    ERL_NIF_TERM values[] = {
+      enif_make_uint64(env, stats.prepare_ns),
+      enif_make_uint64(env, stats.bind_ns),
+      enif_make_uint64(env, stats.step_ns),
+      enif_make_uint64(env, stats.decode_ns),
+      enif_make_uint64(env, stats.rows),
+      enif_make_uint64(env, stats.bytes),
+    };
+
+    enif_make_map_from_arrays(env, keys, values, sizeof(keys) / sizeof(keys[0]), &result);
+
+    return make_ok_tuple(env, result);
+}
+
+// A sqlite3_status or sqlite3_db_status counter and the keys its current and
+// highwater values are reported under, NULL for values that mean nothing.
+typedef struct status_counter
+{
+    int op;
+    ERL_NIF_TERM* current;
+    ERL_NIF_TERM* highwater;
+} status_counter_t;
+
+static const status_counter_t db_status_counters[] = {
+  {SQLITE_DBSTATUS_LOOKASIDE_USED, &am_lookaside_used, &am_lookaside_used_highwater},
+  {SQLITE_DBSTATUS_LOOKASIDE_HIT, NULL, &am_lookaside_hit},
+  {SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, NULL, &am_lookaside_miss_size},
+  {SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, NULL, &am_lookaside_miss_full},
+  {SQLITE_DBSTATUS_CACHE_USED, &am_cache_used, NULL},
+  {SQLITE_DBSTATUS_CACHE_USED_SHARED, &am_cache_used_shared, NULL},
+  {SQLITE_DBSTATUS_CACHE_HIT, &am_cache_hit, NULL},
+  {SQLITE_DBSTATUS_CACHE_MISS, &am_cache_miss, NULL},
+  {SQLITE_DBSTATUS_CACHE_WRITE, &am_cache_write, NULL},
+  {SQLITE_DBSTATUS_CACHE_SPILL, &am_cache_spill, NULL},
+  {SQLITE_DBSTATUS_SCHEMA_USED, &am_schema_used, NULL},
+  {SQLITE_DBSTATUS_STMT_USED, &am_stmt_used, NULL},
+  {SQLITE_DBSTATUS_DEFERRED_FKS, &am_deferred_fks, NULL},
+#ifdef SQLITE_DBSTATUS_TEMPBUF_SPILL
+  {SQLITE_DBSTATUS_TEMPBUF_SPILL, &am_tempbuf_spill, NULL},
+#endif
+};
+
+static const status_counter_t status_counters[] = {
+  {SQLITE_STATUS_MEMORY_USED, &am_memory_used, &am_memory_used_highwater},
+  {SQLITE_STATUS_MALLOC_COUNT, &am_malloc_count, &am_malloc_count_highwater},
+  {SQLITE_STATUS_MALLOC_SIZE, NULL, &am_malloc_size_highwater},
+  {SQLITE_STATUS_PAGECACHE_USED, &am_pagecache_used, &am_pagecache_used_highwater},
+  {SQLITE_STATUS_PAGECACHE_OVERFLOW, &am_pagecache_overflow, &am_pagecache_overflow_highwater},
+  {SQLITE_STATUS_PAGECACHE_SIZE, NULL, &am_pagecache_size_highwater},
+  {SQLITE_STATUS_PARSER_STACK, NULL, &am_parser_stack_highwater},
+};
+
+// The sqlite3_stmt_status counters, the newer ones only when the SQLite
+// library knows them.
+static const status_counter_t stmt_status_counters[] = {
+  {SQLITE_STMTSTATUS_FULLSCAN_STEP, &am_fullscan_step, NULL},
+  {SQLITE_STMTSTATUS_SORT, &am_sort, NULL},
+  {SQLITE_STMTSTATUS_AUTOINDEX, &am_autoindex, NULL},
+  {SQLITE_STMTSTATUS_VM_STEP, &am_vm_step, NULL},
+#ifdef SQLITE_STMTSTATUS_REPREPARE
+  {SQLITE_STMTSTATUS_REPREPARE, &am_reprepare, NULL},
+#endif
+#ifdef SQLITE_STMTSTATUS_RUN
+  {SQLITE_STMTSTATUS_RUN, &am_run, NULL},
+#endif
+#ifdef SQLITE_STMTSTATUS_FILTER_MISS
+  {SQLITE_STMTSTATUS_FILTER_MISS, &am_filter_miss, NULL},
+#endif
+#ifdef SQLITE_STMTSTATUS_FILTER_HIT
+  {SQLITE_STMTSTATUS_FILTER_HIT, &am_filter_hit, NULL},
+#endif
+#ifdef SQLITE_STMTSTATUS_MEMUSED
+  {SQLITE_STMTSTATUS_MEMUSED, &am_memused, NULL},
+#endif
+};
+
+#define STATUS_COUNTERS_MAX 32
+
+// Adds the current and highwater values of a counter to keys and values.
+static int
+put_status_counter(ERL_NIF_TERM* keys, ERL_NIF_TERM* values, int count, ErlNifEnv* env, const status_counter_t* counter, sqlite3_int64 current, sqlite3_int64 highwater)
+{
+    if (counter->current) {
+        keys[count]   = *counter->current;
+        values[count] = enif_make_int64(env, current);
+        count++;
+    }
+
+    if (counter->highwater) {
+        keys[count]   = *counter->highwater;
+        values[count] = enif_make_int64(env, highwater);
+        count++;
+    }
+
+    return count;
+}
+
+///
+/// Returns the sqlite3_db_status counters of a connection as a map.
+///
+ERL_NIF_TERM
+exqlite_db_status(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    connection_t* conn = NULL;
+    ERL_NIF_TERM keys[STATUS_COUNTERS_MAX];
+    ERL_NIF_TERM values[STATUS_COUNTERS_MAX];
+    ERL_NIF_TERM result;
+    int count = 0;
+
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], connection_type, (void**)&conn)) {
+        return make_error_tuple(env, am_invalid_connection);
+    }
+
+    connection_acquire_lock(conn);
+
+    if (conn->db == NULL) {
+        connection_release_lock(conn);
+        return make_error_tuple(env, am_connection_closed);
+    }
+
+    for (size_t i = 0; i < sizeof(db_status_counters) / sizeof(db_status_counters[0]); i++) {
+        const status_counter_t* counter = &db_status_counters[i];
+        int current                     = 0;
+        int highwater                   = 0;
+
+        if (sqlite3_db_status(conn->db, counter->op, &current, &highwater, 0) == SQLITE_OK) {
+            count = put_status_counter(keys, values, count, env, counter, current, highwater);
+        }
+    }
+
+    connection_release_lock(conn);
+
+    enif_make_map_from_arrays(env, keys, values, count, &result);
+
+    return make_ok_tuple(env, result);
+}
+
+///
+/// Returns the sqlite3_stmt_status counters of a statement as a map, resetting
+/// them when the second argument is true.
+///
+ERL_NIF_TERM
+exqlite_stmt_status(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    statement_t* statement = NULL;
+    ERL_NIF_TERM keys[STATUS_COUNTERS_MAX];
+    ERL_NIF_TERM values[STATUS_COUNTERS_MAX];
+    ERL_NIF_TERM result;
+    int count = 0;
+    int reset = 0;
+
+    if (argc != 2) {
+        return enif_make_badarg(env);
+    }
+
+    if (!enif_get_resource(env, argv[0], statement_type, (void**)&statement)) {
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    if (enif_is_identical(argv[1], am_true)) {
+        reset = 1;
+    } else if (!enif_is_identical(argv[1], am_false)) {
+        return raise_badarg(env, argv[1]);
+    }
+
+    statement_acquire_lock(statement);
+
+    if (statement->statement == NULL) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_invalid_statement);
+    }
+
+    // The cached metadata is compared against the REPREPARE counter, so it is
+    // brought up to date before the reset and then follows the counter to 0.
+    if (reset && !statement_ensure_metadata(statement)) {
+        statement_release_lock(statement);
+        return make_error_tuple(env, am_out_of_memory);
+    }
+
+    for (size_t i = 0; i < sizeof(stmt_status_counters) / sizeof(stmt_status_counters[0]); i++) {
+        const status_counter_t* counter = &stmt_status_counters[i];
+        int value                       = sqlite3_stmt_status(statement->statement, counter->op, reset);
+
+        count = put_status_counter(keys, values, count, env, counter, value, 0);
+    }
+
+    if (reset) {
+        statement->reprepared = 0;
+    }
+
+    statement_release_lock(statement);
+
+    enif_make_map_from_arrays(env, keys, values, count, &result);
+
+    return make_ok_tuple(env, result);
+}
+
+///
+/// Returns the process wide sqlite3_status64 counters as a map.
+///
+ERL_NIF_TERM
+exqlite_status(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    ERL_NIF_TERM keys[STATUS_COUNTERS_MAX];
+    ERL_NIF_TERM values[STATUS_COUNTERS_MAX];
+    ERL_NIF_TERM result;
+    int count = 0;
+
+    if (argc != 0) {
+        return enif_make_badarg(env);
+    }
+
+    for (size_t i = 0; i < sizeof(status_counters) / sizeof(status_counters[0]); i++) {
+        const status_counter_t* counter = &status_counters[i];
+        sqlite3_int64 current           = 0;
+        sqlite3_int64 highwater         = 0;
+
+        if (sqlite3_status64(counter->op, &current, &highwater, 0) == SQLITE_OK) {
+            count = put_status_counter(keys, values, count, env, counter, current, highwater);
+        }
+    }
+
+    enif_make_map_from_arrays(env, keys, values, count, &result);
+
+    return make_ok_tuple(env, result);
+}
+
+///
+/// Returns the counters of the pool allocator, one map per size class.
+///
+ERL_NIF_TERM
+exqlite_allocator_stats(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
+{
+    assert(env);
+
+    ERL_NIF_TERM classes = enif_make_list(env, 0);
+    ERL_NIF_TERM result;
+
+    if (argc != 0) {
+        return enif_make_badarg(env);
+    }
+
+    for (int i = pool_allocator_enabled ? POOL_CLASSES - 1 : -1; i >= 0; i--) {
+        pool_class_t* size_class = &pool_classes[i];
+        ErlNifUInt64 allocations = 0;
+        ErlNifUInt64 reused      = 0;
+        ErlNifUInt64 cached      = 0;
+        ERL_NIF_TERM stats;
+
+        for (int j = 0; j < POOL_SHARDS; j++) {
+            pool_shard_t* shard = &size_class->shards[j];
+
+            enif_mutex_lock(shard->mutex);
+            allocations += shard->allocations;
+            reused      += shard->reused;
+            cached      += shard->cached;
+            enif_mutex_unlock(shard->mutex);
+        }
+
+        // Read after the shards, so a block counted in them is in here too.
+        ErlNifSInt64 in_use     = ATOMIC_LOAD_INT64(&size_class->in_use);
+        ErlNifSInt64 high_water = ATOMIC_LOAD_INT64(&size_class->high_water);
+
+        ERL_NIF_TERM keys[] = {
+          am_size,
+          am_allocations,
+          am_reused,
+          am_in_use,
+          am_high_water,
+          am_cached,
+        };
+        ERL_NIF_TERM values[] = {
+          enif_make_uint64(env, size_class->size),
+          enif_make_uint64(env, allocations),
+          enif_make_uint64(env, reused),
+          enif_make_uint64(env, in_use > 0 ? in_use : 0),
+          enif_make_uint64(env, high_water > in_use ? high_water : in_use),
+          enif_make_uint64(env, cached),
+        };
+
+        enif_make_map_from_arrays(env, keys, values, sizeof(keys) / sizeof(keys[0]), &stats);
+        classes = enif_make_list_cell(env, stats, classes);
+    }
+
+    ERL_NIF_TERM keys[]   = {am_allocator, am_classes};
+    ERL_NIF_TERM values[] = {pool_allocator_enabled ? am_pool : am_default, classes};
+
+    enif_make_map_from_arrays(env, keys, values, 2, &result);
+
+    return make_ok_tuple(env, result);
+}
+
 ERL_NIF_TERM
 exqlite_errmsg(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 {
@@ -2076,7 +7007,7 @@ exqlite_errstr(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
 static ErlNifFunc nif_funcs[] = {
   {"open", 2, exqlite_open, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"close", 1, exqlite_close, ERL_NIF_DIRTY_JOB_IO_BOUND},
-  {"execute", 2, exqlite_execute, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"execute", 3, exqlite_execute, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"changes", 1, exqlite_changes, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"prepare", 2, exqlite_prepare, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"reset", 1, exqlite_reset, ERL_NIF_DIRTY_JOB_CPU_BOUND},
@@ -2087,22 +7018,43 @@ static ErlNifFunc nif_funcs[] = {
   {"bind_integer", 3, exqlite_bind_integer},
   {"bind_float", 3, exqlite_bind_float},
   {"bind_null", 2, exqlite_bind_null},
-  {"step", 2, exqlite_step, ERL_NIF_DIRTY_JOB_IO_BOUND},
-  {"multi_step", 3, exqlite_multi_step, ERL_NIF_DIRTY_JOB_IO_BOUND},
-  {"columns", 2, exqlite_columns, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"bind_all", 2, exqlite_bind_all},
+  {"step", 4, exqlite_step, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"multi_step", 6, exqlite_multi_step, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"multi_step_prefetch", 6, exqlite_multi_step_prefetch, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"fetch_all", 6, exqlite_fetch_all, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"execute_many", 5, exqlite_execute_many, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"multi_step_columnar", 3, exqlite_multi_step_columnar, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"columns", 2, exqlite_columns, 0},
+  {"column_types", 2, exqlite_column_types, 0},
+  {"statement_readonly", 2, exqlite_statement_readonly, 0},
   {"last_insert_rowid", 1, exqlite_last_insert_rowid, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"transaction_status", 1, exqlite_transaction_status, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"serialize", 2, exqlite_serialize, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"deserialize", 3, exqlite_deserialize, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"release", 2, exqlite_release, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"snapshot_get", 1, exqlite_snapshot_get, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"snapshot_open", 2, exqlite_snapshot_open, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"snapshot_free", 1, exqlite_snapshot_free, 0},
   {"enable_load_extension", 2, exqlite_enable_load_extension, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"set_update_hook", 2, exqlite_set_update_hook, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"set_authorizer", 2, exqlite_set_authorizer, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"set_log_hook", 1, exqlite_set_log_hook, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"set_page_cache_budget", 1, exqlite_set_page_cache_budget, 0},
+  {"allocator_stats", 0, exqlite_allocator_stats, 0},
+  {"db_status", 1, exqlite_db_status, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"status", 0, exqlite_status, 0},
+  {"stmt_status", 2, exqlite_stmt_status, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"interrupt", 1, exqlite_interrupt, ERL_NIF_DIRTY_JOB_IO_BOUND},
   {"set_busy_timeout", 2, exqlite_set_busy_timeout, 0},
   {"set_progress_handler_steps", 2, exqlite_set_progress_handler_steps, 0},
   {"cancel", 1, exqlite_cancel, 0},
+  {"start_worker", 1, exqlite_start_worker, 0},
+  {"async_call", 3, exqlite_async_call, 0},
+  {"lock_stats", 1, exqlite_lock_stats, 0},
+  {"set_query_stats", 2, exqlite_set_query_stats, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"take_query_stats", 1, exqlite_take_query_stats, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"set_deadline", 2, exqlite_set_deadline, 0},
   {"errmsg", 1, exqlite_errmsg},
   {"errstr", 1, exqlite_errstr},
 };
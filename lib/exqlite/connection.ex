@@ -16,6 +16,28 @@ defmodule Exqlite.Connection do
     database may be stored on a network volume which would cause potential
     issues.
 
+  ## Streaming
+
+  Streams step their statement one chunk of `:chunk_size` rows per fetch. Pass
+  `prefetch: true` to `DBConnection.stream/4` to have SQLite step the next
+  chunk on a background thread while the current one is consumed. See
+  `Exqlite.Sqlite3.multi_step/4`.
+
+  ## Telemetry
+
+  With the `:query_stats` or `:stmt_status` options every execute and fetch
+  emits a `[:exqlite, :query]` event once it returns.
+
+    * Measurements: with `:query_stats`, the time spent in each phase as
+      measured inside the NIFs, see `Exqlite.Sqlite3.take_query_stats/1`:
+      `:prepare_time`, `:bind_time`, `:step_time` and `:decode_time` in
+      `:native` time units, plus `:rows` and `:bytes` returned. Queries served
+      from the statement cache have no prepare time. With `:stmt_status`, the
+      counters of `Exqlite.Sqlite3.stmt_status/2` for this call, such as
+      `:fullscan_step` and `:autoindex`, which catch queries missing an index.
+    * Metadata: the `:query`, the `:call`, either `:execute` or `:fetch`, and
+      the `:status` the callback returned, such as `:ok`, `:halt` or `:error`.
+
   Notes:
     - we try to closely follow structure and naming convention of myxql.
     - sqlite thrives when there are many small conventions, so we may not implement
@@ -28,6 +50,7 @@ defmodule Exqlite.Connection do
   alias Exqlite.Query
   alias Exqlite.Result
   alias Exqlite.Sqlite3
+  alias Exqlite.StatementCache
   require Logger
 
   defstruct [
@@ -38,7 +61,12 @@ defmodule Exqlite.Connection do
     :transaction_status,
     :status,
     :chunk_size,
-    :before_disconnect
+    :before_disconnect,
+    :statement_cache,
+    :query_timeout,
+    async: false,
+    query_stats: false,
+    stmt_status: false
   ]
 
   @type t() :: %__MODULE__{
@@ -48,7 +76,12 @@ defmodule Exqlite.Connection do
           transaction_status: :idle | :transaction,
           status: :idle | :busy,
           chunk_size: integer(),
-          before_disconnect: (Exception.t(), t -> any) | {module, atom, [any]} | nil
+          before_disconnect: (Exception.t(), t -> any) | {module, atom, [any]} | nil,
+          statement_cache: StatementCache.t() | nil,
+          query_timeout: timeout() | nil,
+          async: boolean(),
+          query_stats: boolean(),
+          stmt_status: boolean()
         }
 
   @type journal_mode() :: :delete | :truncate | :persist | :memory | :wal | :off
@@ -76,6 +109,11 @@ defmodule Exqlite.Connection do
           | {:busy_timeout, integer()}
           | {:progress_handler_steps, integer()}
           | {:chunk_size, integer()}
+          | {:statement_cache_size, non_neg_integer()}
+          | {:async, boolean()}
+          | {:query_timeout, timeout()}
+          | {:query_stats, boolean()}
+          | {:stmt_status, boolean()}
           | {:journal_size_limit, integer()}
           | {:soft_heap_limit, integer()}
           | {:hard_heap_limit, integer()}
@@ -145,6 +183,32 @@ defmodule Exqlite.Connection do
       `interrupt/1` and `cancel/1` only take effect once SQLite returns from the
       current call.
     * `:chunk_size` - The chunk size for bulk fetching. Defaults to `50`.
+    * `:statement_cache_size` - The number of prepared statements to keep per
+      connection, keyed by SQL text. When the same SQL is executed again the
+      cached statement is reset and rebound instead of being prepared from
+      scratch. The least recently used statement is released once the cache
+      is full. Defaults to `0`, which disables the cache.
+    * `:async` - When `true` the connection starts a native worker thread and
+      runs prepares, queries and fetches on it instead of on a dirty IO
+      scheduler, see `Exqlite.Sqlite3.start_worker/1`. Useful with many busy
+      connections, which would otherwise hold every dirty IO scheduler while
+      they wait on SQLite locks or the disk. Defaults to `false`.
+    * `:query_timeout` - The time in milliseconds a query or fetch may run
+      before SQLite interrupts it, failing with "query deadline exceeded". It
+      covers stepping the statement, including waits on database locks, and
+      is passed as the `:query_timeout` of those `Exqlite.Sqlite3` calls, so
+      a deadline set with `Exqlite.Sqlite3.set_deadline/2` on the handle
+      stays in place. Can be overridden per call with the same option.
+      Interrupting running statements relies on the progress handler, so it
+      needs `:progress_handler_steps` of at least `1`. Defaults to
+      `:infinity`.
+    * `:query_stats` - When `true` the connection times prepare, bind, step and
+      decode inside the NIFs and emits them in a `[:exqlite, :query]` telemetry
+      event, see the Telemetry section of the module docs. Defaults to `false`.
+    * `:stmt_status` - When `true` the `[:exqlite, :query]` telemetry event
+      carries the full scan, sort, automatic index and other counters SQLite
+      kept for the statement during the call, see
+      `Exqlite.Sqlite3.stmt_status/2`. Defaults to `false`.
     * `:key` - Optional key to set during database initialization. This PRAGMA
       is often used to set up database level encryption.
     * `:journal_size_limit` - The size limit in bytes of the journal.
@@ -238,6 +302,7 @@ defmodule Exqlite.Connection do
     # This is a superset of the old Sqlite3.interrupt(db) call.
     # See: https://github.com/elixir-sqlite/exqlite/issues/192
     Sqlite3.cancel(db)
+    release_cached_statements(state)
 
     case Sqlite3.close(db) do
       :ok -> :ok
@@ -263,16 +328,17 @@ defmodule Exqlite.Connection do
 
   @impl true
   def handle_prepare(%Query{} = query, options, state) do
-    with {:ok, query} <- prepare(query, options, state) do
-      {:ok, query, state}
-    end
+    prepare(query, options, state)
   end
 
   @impl true
   def handle_execute(%Query{} = query, params, options, state) do
-    with {:ok, query} <- prepare(query, options, state) do
-      execute(:execute, query, params, state)
-    end
+    with_query_timeout(options, state, fn deadline ->
+      with {:ok, query, state} <- prepare(query, options, state) do
+        execute(:execute, query, params, state, deadline)
+      end
+    end)
+    |> emit_query_event(:execute, query, state)
   end
 
   @doc """
@@ -367,7 +433,14 @@ defmodule Exqlite.Connection do
   """
   @impl true
   def handle_close(query, _opts, state) do
-    Sqlite3.release(state.db, query.ref)
+    # Statements owned by the cache are shared by every query with the same
+    # SQL text, so they are only released on eviction or disconnect.
+    cache = state.statement_cache
+
+    unless StatementCache.cached?(cache, query_sql(query), query.ref) do
+      Sqlite3.release(state.db, query.ref)
+    end
+
     {:ok, nil, state}
   end
 
@@ -375,7 +448,10 @@ defmodule Exqlite.Connection do
   def handle_declare(%Query{} = query, params, opts, state) do
     # We emulate cursor functionality by just using a prepared statement and
     # step through it. Thus we just return the query ref as the cursor.
-    with {:ok, query} <- prepare(query, opts, state),
+    #
+    # Cursors hold on to the statement between fetches, so they never share
+    # one from the statement cache.
+    with {:ok, query} <- prepare_uncached(query, opts, state),
          {:ok, query} <- bind_params(query, params, state) do
       {:ok, query, query.ref, state}
     end
@@ -388,22 +464,28 @@ defmodule Exqlite.Connection do
   end
 
   @impl true
-  def handle_fetch(%Query{statement: statement}, cursor, opts, state) do
+  def handle_fetch(%Query{statement: statement} = query, cursor, opts, state) do
     chunk_size = opts[:chunk_size] || opts[:max_rows] || state.chunk_size
+    prefetch = Keyword.get(opts, :prefetch, false)
 
-    case Sqlite3.multi_step(state.db, cursor, chunk_size) do
-      {:done, rows} ->
-        {:halt, %Result{rows: rows, command: :fetch, num_rows: length(rows)}, state}
+    with_query_timeout(opts, state, fn deadline ->
+      step_opts = [{:prefetch, prefetch} | step_opts(state, deadline)]
 
-      {:rows, rows} ->
-        {:cont, %Result{rows: rows, command: :fetch, num_rows: chunk_size}, state}
+      case Sqlite3.multi_step(state.db, cursor, chunk_size, step_opts) do
+        {:done, rows} ->
+          {:halt, %Result{rows: rows, command: :fetch, num_rows: length(rows)}, state}
 
-      {:error, reason} ->
-        {:error, %Error{message: to_string(reason), statement: statement}, state}
+        {:rows, rows} ->
+          {:cont, %Result{rows: rows, command: :fetch, num_rows: chunk_size}, state}
 
-      :busy ->
-        {:error, %Error{message: "Database is busy", statement: statement}, state}
-    end
+        {:error, reason} ->
+          {:error, %Error{message: to_string(reason), statement: statement}, state}
+
+        :busy ->
+          {:error, %Error{message: "Database is busy", statement: statement}, state}
+      end
+    end)
+    |> emit_query_event(:fetch, query, state)
   end
 
   @impl true
@@ -547,6 +629,99 @@ defmodule Exqlite.Connection do
     )
   end
 
+  # The deadline is absolute, so it spans every stepping call the query makes,
+  # each of which gets the time left as its own `:query_timeout`. The deadline
+  # is armed by the NIFs for the call only, so one set on the handle with
+  # `Exqlite.Sqlite3.set_deadline/2` stays in place.
+  defp with_query_timeout(options, state, fun) do
+    case Keyword.get(options, :query_timeout, state.query_timeout) do
+      timeout when timeout in [nil, :infinity] ->
+        fun.(:infinity)
+
+      timeout when is_integer(timeout) and timeout >= 0 ->
+        fun.(
+          System.monotonic_time(:nanosecond) +
+            System.convert_time_unit(timeout, :millisecond, :nanosecond)
+        )
+    end
+  end
+
+  # Options for the stepping `Exqlite.Sqlite3` calls made until `deadline`.
+  defp step_opts(state, :infinity), do: [async: state.async]
+
+  defp step_opts(state, deadline) do
+    remaining = deadline - System.monotonic_time(:nanosecond)
+    timeout = System.convert_time_unit(max(remaining, 0), :nanosecond, :millisecond)
+
+    [async: state.async, query_timeout: timeout]
+  end
+
+  # Emits the `[:exqlite, :query]` event for the callback that just returned
+  # `result`, see the `:query_stats` and `:stmt_status` options.
+  defp emit_query_event(result, call, query, state) do
+    if state.query_stats or state.stmt_status do
+      # Executes return the prepared query, whose statement the counters are on.
+      query =
+        case result do
+          {:ok, %Query{} = prepared, _result, _state} -> prepared
+          _ -> query
+        end
+
+      measurements = Map.merge(query_stats(state), stmt_status(query, state))
+      metadata = %{query: query, call: call, status: elem(result, 0)}
+      :telemetry.execute([:exqlite, :query], measurements, metadata)
+    end
+
+    result
+  end
+
+  defp query_stats(%{query_stats: false}), do: %{}
+
+  defp query_stats(state) do
+    case Sqlite3.take_query_stats(state.db) do
+      {:ok, stats} ->
+        %{
+          prepare_time: native_time(stats.prepare_ns),
+          bind_time: native_time(stats.bind_ns),
+          step_time: native_time(stats.step_ns),
+          decode_time: native_time(stats.decode_ns),
+          rows: stats.rows_returned,
+          bytes: stats.bytes_returned
+        }
+
+      {:error, _reason} ->
+        %{}
+    end
+  end
+
+  # The counters are reset once read, so each event only covers its own call.
+  defp stmt_status(%Query{ref: ref}, %{stmt_status: true}) when ref != nil do
+    case Sqlite3.stmt_status(ref, true) do
+      {:ok, status} -> status
+      {:error, _reason} -> %{}
+    end
+  end
+
+  defp stmt_status(_query, _state), do: %{}
+
+  defp native_time(ns), do: System.convert_time_unit(ns, :nanosecond, :native)
+
+  defp maybe_set_query_stats(db, options) do
+    if Keyword.get(options, :query_stats, false) do
+      Sqlite3.set_query_stats(db, true)
+    else
+      :ok
+    end
+  end
+
+  defp maybe_start_worker(db, options) do
+    if Keyword.get(options, :async, false) do
+      Sqlite3.start_worker(db)
+    else
+      :ok
+    end
+  end
+
   defp deserialize(db, options) do
     case Keyword.get(options, :serialized, nil) do
       nil -> :ok
@@ -582,6 +757,7 @@ defmodule Exqlite.Connection do
     with {:ok, directory} <- resolve_directory(database),
          :ok <- mkdir_p(directory),
          {:ok, db} <- Sqlite3.open(database, options),
+         :ok <- maybe_start_worker(db, options),
          :ok <- set_key(db, options),
          :ok <- set_custom_pragmas(db, options),
          :ok <- set_journal_mode(db, options),
@@ -601,7 +777,8 @@ defmodule Exqlite.Connection do
          :ok <- set_soft_heap_limit(db, options),
          :ok <- set_hard_heap_limit(db, options),
          :ok <- load_extensions(db, options),
-         :ok <- deserialize(db, options) do
+         :ok <- deserialize(db, options),
+         :ok <- maybe_set_query_stats(db, options) do
       state = %__MODULE__{
         db: db,
         default_transaction_mode:
@@ -611,7 +788,13 @@ defmodule Exqlite.Connection do
         transaction_status: :idle,
         status: :idle,
         chunk_size: Keyword.get(options, :chunk_size),
-        before_disconnect: Keyword.get(options, :before_disconnect, nil)
+        before_disconnect: Keyword.get(options, :before_disconnect, nil),
+        statement_cache:
+          StatementCache.new(Keyword.get(options, :statement_cache_size, 0)),
+        query_timeout: Keyword.get(options, :query_timeout),
+        async: Keyword.get(options, :async, false),
+        query_stats: Keyword.get(options, :query_stats, false),
+        stmt_status: Keyword.get(options, :stmt_status, false)
       }
 
       {:ok, state}
@@ -628,10 +811,38 @@ defmodule Exqlite.Connection do
     end
   end
 
+  defp prepare(%Query{} = query, options, %{statement_cache: nil} = state) do
+    with {:ok, query} <- prepare_uncached(query, options, state) do
+      {:ok, query, state}
+    end
+  end
+
   defp prepare(%Query{statement: statement} = query, options, state) do
     query = maybe_put_command(query, options)
+    sql = IO.iodata_to_binary(statement)
+
+    case StatementCache.fetch(state.statement_cache, sql) do
+      {:ok, ref, cache} ->
+        {:ok, %{query | ref: ref}, %{state | statement_cache: cache}}
+
+      :error ->
+        case Sqlite3.prepare(state.db, sql, async: state.async) do
+          {:ok, ref} ->
+            {cache, evicted} = StatementCache.put(state.statement_cache, sql, ref)
+            Enum.each(evicted, &Sqlite3.release(state.db, &1))
+            {:ok, %{query | ref: ref}, %{state | statement_cache: cache}}
+
+          {:error, reason} ->
+            {:error, %Error{message: to_string(reason), statement: statement}, state}
+        end
+    end
+  end
+
+  defp prepare_uncached(%Query{statement: statement} = query, options, state) do
+    query = maybe_put_command(query, options)
+    sql = IO.iodata_to_binary(statement)
 
-    case Sqlite3.prepare(state.db, IO.iodata_to_binary(statement)) do
+    case Sqlite3.prepare(state.db, sql, async: state.async) do
       {:ok, ref} ->
         {:ok, %{query | ref: ref}}
 
@@ -640,6 +851,16 @@ defmodule Exqlite.Connection do
     end
   end
 
+  defp query_sql(%Query{statement: nil}), do: nil
+  defp query_sql(%Query{statement: statement}), do: IO.iodata_to_binary(statement)
+
+  defp release_cached_statements(%__MODULE__{statement_cache: nil}), do: :ok
+
+  defp release_cached_statements(%__MODULE__{db: db, statement_cache: cache}) do
+    {_cache, refs} = StatementCache.clear(cache)
+    Enum.each(refs, &Sqlite3.release(db, &1))
+  end
+
   @spec maybe_changes(Sqlite3.db(), Query.t()) :: integer() | nil
   defp maybe_changes(db, %Query{command: command})
        when command in [:update, :insert, :delete] do
@@ -657,10 +878,10 @@ defmodule Exqlite.Connection do
   defp maybe_rows([], []), do: nil
   defp maybe_rows(rows, _cols), do: rows
 
-  defp execute(call, %Query{} = query, params, state) do
+  defp execute(call, %Query{} = query, params, state, deadline) do
     with {:ok, query} <- bind_params(query, params, state),
          {:ok, columns} <- get_columns(query, state),
-         {:ok, rows} <- get_rows(query, state),
+         {:ok, rows} <- get_rows(query, state, deadline),
          {:ok, transaction_status} <- Sqlite3.transaction_status(state.db),
          changes <- maybe_changes(state.db, query) do
       case query.command do
@@ -713,8 +934,10 @@ defmodule Exqlite.Connection do
     end
   end
 
-  defp get_rows(%Query{ref: ref, statement: statement}, state) do
-    case Sqlite3.fetch_all(state.db, ref, state.chunk_size) do
+  defp get_rows(%Query{ref: ref, statement: statement}, state, deadline) do
+    opts = step_opts(state, deadline)
+
+    case Sqlite3.fetch_all(state.db, ref, state.chunk_size, opts) do
       {:ok, rows} ->
         {:ok, rows}
 
@@ -724,7 +947,7 @@ defmodule Exqlite.Connection do
   end
 
   defp handle_transaction(call, statement, state) do
-    with :ok <- Sqlite3.execute(state.db, statement),
+    with :ok <- Sqlite3.execute(state.db, statement, async: state.async),
          {:ok, transaction_status} <- Sqlite3.transaction_status(state.db) do
       result = %Result{
         command: call,
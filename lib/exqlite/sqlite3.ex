@@ -17,8 +17,20 @@ defmodule Exqlite.Sqlite3 do
 
   @type db() :: reference()
   @type statement() :: reference()
+  @type snapshot() :: reference()
   @type reason() :: atom() | String.t()
-  @type row() :: list()
+  @type row() :: list() | tuple()
+  @type row_opt() :: {:row_format, :list | :tuple}
+  @type decode_hint() ::
+          :raw | :boolean | :naive_datetime | :date | :json | :atom_from_text
+  @type async_opt() :: {:async, boolean()}
+  @type query_timeout_opt() :: {:query_timeout, timeout() | nil}
+  @type multi_step_opt() ::
+          row_opt()
+          | async_opt()
+          | query_timeout_opt()
+          | {:prefetch, boolean()}
+          | {:decode, [decode_hint()]}
   @type open_mode :: :readwrite | :readonly | :nomutex | :create
   @type open_opt :: {:mode, :readwrite | :readonly | :create | [open_mode()]}
 
@@ -132,6 +144,12 @@ defmodule Exqlite.Sqlite3 do
   Larger values let SQLite keep retrying until the timeout expires or the wait
   is cancelled.
 
+  Connections in this VM that open the same database file wait for the write
+  lock in line. When one of them commits or rolls back a write transaction,
+  the longest waiting connection retries right away instead of sleeping until
+  its next retry, and the others keep waiting for their turn. Locks held by
+  other OS processes are still polled for.
+
   This is the low-level API behind the `:busy_timeout` connection option.
   """
   @spec set_busy_timeout(db(), integer()) :: :ok | {:error, reason()}
@@ -168,11 +186,162 @@ defmodule Exqlite.Sqlite3 do
   def cancel(nil), do: :ok
   def cancel(conn), do: Sqlite3NIF.cancel(conn)
 
+  @doc """
+  Sets the time after which running statements on the connection are
+  interrupted.
+
+  `deadline` is an absolute `System.monotonic_time(:nanosecond)` value, or
+  `:infinity` to clear it. Past the deadline the progress handler interrupts
+  the running statement and the busy handler stops waiting for locks. Both
+  read the deadline with a single atomic load, so arming and checking it never
+  contends with the call that is running.
+
+  The progress handler only runs when `set_progress_handler_steps/2` is at
+  least `1`, otherwise the deadline only bounds busy waits.
+
+  The deadline applies to every call on the connection, from any process,
+  until it is cleared. For a deadline on a single call use the
+  `:query_timeout` option of `execute/3`, `step/3`, `multi_step/4` and
+  `fetch_all/4` instead. It is passed to the NIF, armed once the call holds
+  the connection lock and disarmed before it lets go, so it neither
+  interrupts nor clears the deadline of another process sharing the handle.
+  A call stops at the earlier of the two deadlines.
+  """
+  @spec set_deadline(db(), integer() | :infinity) :: :ok | {:error, reason()}
+  def set_deadline(conn, deadline), do: Sqlite3NIF.set_deadline(conn, deadline)
+
+  @type lock_stats() :: %{
+          lock_acquisitions: non_neg_integer(),
+          lock_contended: non_neg_integer(),
+          lock_wait_ns: non_neg_integer(),
+          lock_max_wait_ns: non_neg_integer(),
+          busy_handler_calls: non_neg_integer(),
+          busy_sleep_ms: non_neg_integer(),
+          busy_timeouts: non_neg_integer()
+        }
+
+  @doc """
+  Returns the contention counters of the connection since it was opened.
+
+    * `:lock_acquisitions` - how many times the connection lock was taken.
+    * `:lock_contended` - how many of those had to wait for another call on
+      the same connection to finish.
+    * `:lock_wait_ns` and `:lock_max_wait_ns` - total and longest time spent
+      waiting for the connection lock, in nanoseconds.
+    * `:busy_handler_calls` - how many times SQLite called the busy handler
+      because another connection held a database lock.
+    * `:busy_sleep_ms` - total time the busy handler slept, in milliseconds.
+    * `:busy_timeouts` - how many times the busy handler gave up after the
+      busy timeout, returning `SQLITE_BUSY` to the caller.
+
+  Waiting on the connection lock points at too few connections in the pool,
+  sleeping in the busy handler at contention on the database file itself.
+  Like `cancel/1` this does not take the connection lock, so it can be called
+  while a query is running.
+
+      iex> {:ok, conn} = Sqlite3.open(":memory:")
+      iex> :ok = Sqlite3.execute(conn, "select 1")
+      iex> {:ok, %{lock_contended: 0, busy_timeouts: 0}} = Sqlite3.lock_stats(conn)
+
+  """
+  @spec lock_stats(db()) :: {:ok, lock_stats()} | {:error, reason()}
+  def lock_stats(conn), do: Sqlite3NIF.lock_stats(conn)
+
+  @type query_stats() :: %{
+          prepare_ns: non_neg_integer(),
+          bind_ns: non_neg_integer(),
+          step_ns: non_neg_integer(),
+          decode_ns: non_neg_integer(),
+          rows_returned: non_neg_integer(),
+          bytes_returned: non_neg_integer()
+        }
+
+  @doc """
+  Turns timing the phases of every query on the connection on or off.
+
+  While enabled, the NIFs read the monotonic clock around each phase and add
+  the time to the connection's query stats, see `take_query_stats/1`. It is
+  off by default so queries do not pay for the clock reads. Turning it off
+  clears the stats collected so far.
+  """
+  @spec set_query_stats(db(), boolean()) :: :ok | {:error, reason()}
+  def set_query_stats(conn, enabled) when is_boolean(enabled),
+    do: Sqlite3NIF.set_query_stats(conn, enabled)
+
+  @doc """
+  Returns the query stats collected since they were last taken and clears them.
+
+    * `:prepare_ns` - time spent compiling statements in `prepare/3`.
+    * `:bind_ns` - time spent binding parameters in `bind/2` and
+      `execute_many/3`.
+    * `:step_ns` - time spent in `sqlite3_step`, which covers planning
+      decisions made at run time, reading pages and waiting on locks. For
+      `execute/2` it is the whole script, compiling included.
+    * `:decode_ns` - time spent turning rows into Erlang terms.
+    * `:rows_returned` and `:bytes_returned` - rows returned by `step/3`,
+      `multi_step/4`, `multi_step_columnar/3` and `fetch_all/4`, and the bytes
+      of their TEXT and BLOB values. Rows drained by `execute_many/3` are not
+      returned and not counted.
+
+  A chunk read ahead by `multi_step/4` with `prefetch: true` is counted when
+  the call that returns it runs, so its time is not split across callers. A
+  chunk that is read ahead and then discarded, because the statement was
+  reset or bound again, is not counted.
+
+  A query dominated by `:step_ns` is I/O or plan bound, one dominated by
+  `:decode_ns` returns more data than it needs to.
+
+      iex> {:ok, conn} = Sqlite3.open(":memory:")
+      iex> :ok = Sqlite3.set_query_stats(conn, true)
+      iex> {:ok, statement} = Sqlite3.prepare(conn, "select 'hello'")
+      iex> {:ok, [["hello"]]} = Sqlite3.fetch_all(conn, statement)
+      iex> {:ok, %{rows_returned: 1, bytes_returned: 5}} = Sqlite3.take_query_stats(conn)
+
+  """
+  @spec take_query_stats(db()) :: {:ok, query_stats()} | {:error, reason()}
+  def take_query_stats(conn), do: Sqlite3NIF.take_query_stats(conn)
+
+  @doc """
+  Starts a native worker thread owned by the connection.
+
+  Calls made with `async: true` are queued to this thread instead of running
+  on a dirty IO scheduler, and the caller waits for the result in a `receive`.
+  Dirty schedulers are then never blocked on the connection lock or on disk
+  I/O for those calls, however many connections are busy.
+
+  The worker runs until `close/1`, or until the connection is garbage
+  collected. Calls still queued at `close/1` return
+  `{:error, :connection_closed}`. Only `cancel/1` and `interrupt/1` can stop a
+  call running on the worker, the busy handler does not watch the caller.
+
+  Calling it again while the worker is running does nothing.
+  """
+  @spec start_worker(db()) :: :ok | {:error, reason()}
+  def start_worker(conn), do: Sqlite3NIF.start_worker(conn)
+
   @doc """
   Executes an sql script. Multiple stanzas can be passed at once.
+
+  ## Options
+
+    * `:async` - run on the connection's worker thread, see `start_worker/1`.
+      Defaults to `false`.
+    * `:query_timeout` - the time in milliseconds the call may run before it
+      is interrupted, see `set_deadline/2`. An interrupted call returns
+      `{:error, "query deadline exceeded"}`. Defaults to `:infinity`.
+
   """
-  @spec execute(db(), String.t()) :: :ok | {:error, reason()}
-  def execute(conn, sql), do: Sqlite3NIF.execute(conn, sql)
+  @spec execute(db(), String.t(), [async_opt() | query_timeout_opt()]) ::
+          :ok | {:error, reason()}
+  def execute(conn, sql, opts \\ []) do
+    with_query_timeout(opts, fn deadline ->
+      if async?(opts) do
+        async_call(conn, :execute, [sql, deadline])
+      else
+        Sqlite3NIF.execute(conn, sql, deadline)
+      end
+    end)
+  end
 
   @doc """
   Get the number of changes recently.
@@ -184,8 +353,20 @@ defmodule Exqlite.Sqlite3 do
   @spec changes(db()) :: {:ok, integer()} | {:error, reason()}
   def changes(conn), do: Sqlite3NIF.changes(conn)
 
-  @spec prepare(db(), String.t()) :: {:ok, statement()} | {:error, reason()}
-  def prepare(conn, sql), do: Sqlite3NIF.prepare(conn, sql)
+  @doc """
+  Prepares a statement.
+
+  Accepts the `:async` option of `execute/3`.
+  """
+  @spec prepare(db(), String.t(), [async_opt()]) ::
+          {:ok, statement()} | {:error, reason()}
+  def prepare(conn, sql, opts \\ []) do
+    if async?(opts) do
+      async_call(conn, :prepare, [sql])
+    else
+      Sqlite3NIF.prepare(conn, sql)
+    end
+  end
 
   @doc """
   Resets a prepared statement.
@@ -254,73 +435,104 @@ defmodule Exqlite.Sqlite3 do
         ) :: :ok
   def bind(stmt, nil), do: bind(stmt, [])
 
-  def bind(stmt, args) when is_list(args) do
-    case bind_parameter_count(stmt) do
-      {:error, reason} ->
-        {:error, reason}
+  def bind(stmt, args) when is_list(args) or is_map(args) do
+    case Sqlite3NIF.bind_all(stmt, convert_params(args, type_extensions())) do
+      :ok -> :ok
+      {:error, reason} -> handle_bind_error(args, reason)
+    end
+  end
 
-      params_count ->
-        args_count = length(args)
+  defp convert_params(nil, _extensions), do: []
 
-        if args_count == params_count do
-          bind_all(args, stmt, 1)
-        else
-          raise ArgumentError, "expected #{params_count} arguments, got #{args_count}"
-        end
-    end
+  defp convert_params(args, extensions) when is_list(args) do
+    Enum.map(args, &convert(&1, extensions))
   end
 
-  def bind(stmt, args) when is_map(args) do
-    case bind_parameter_count(stmt) do
-      {:error, reason} ->
-        {:error, reason}
+  defp convert_params(args, extensions) when is_map(args) do
+    Map.new(args, fn {name, param} -> {name, convert(param, extensions)} end)
+  end
 
-      params_count ->
-        args_count = map_size(args)
+  defp handle_bind_error(args, {:invalid_parameter_count, params_count})
+       when is_list(args) do
+    raise ArgumentError, "expected #{params_count} arguments, got #{length(args)}"
+  end
 
-        if args_count == params_count do
-          bind_all_named(Map.to_list(args), stmt)
-        else
-          raise ArgumentError,
-                "expected #{params_count} named arguments, got #{args_count}: #{inspect(Map.keys(args))}"
-        end
-    end
+  defp handle_bind_error(args, {:invalid_parameter_count, params_count})
+       when is_map(args) do
+    raise ArgumentError,
+          "expected #{params_count} named arguments, got #{map_size(args)}: #{inspect(Map.keys(args))}"
   end
 
-  defp bind_all([param | params], stmt, idx) do
-    do_bind(stmt, idx, param)
-    bind_all(params, stmt, idx + 1)
+  defp handle_bind_error(_args, {:unknown_parameter, name}) do
+    raise ArgumentError, "unknown named parameter: #{inspect(name)}"
   end
 
-  defp bind_all([], _stmt, _idx), do: :ok
+  defp handle_bind_error(args, {:unsupported_type, idx}) when is_list(args) do
+    raise ArgumentError, "unsupported type: #{inspect(Enum.at(args, idx - 1))}"
+  end
 
-  defp bind_all_named([{name, param} | named_params], stmt) do
-    idx = Sqlite3NIF.bind_parameter_index(stmt, to_string(name))
+  defp handle_bind_error(args, {:unsupported_type, name}) when is_map(args) do
+    raise ArgumentError, "unsupported type: #{inspect(Map.fetch!(args, name))}"
+  end
 
-    if idx == 0 do
-      raise ArgumentError, "unknown named parameter: #{inspect(name)}"
-    end
+  defp handle_bind_error(_args, message) when is_binary(message),
+    do: raise(Exqlite.Error, message: message)
+
+  defp handle_bind_error(_args, reason), do: {:error, reason}
+
+  @doc """
+  Binds and steps `statement` once for every entry of `rows`, all in a single
+  NIF call.
 
-    do_bind(stmt, idx, param)
-    bind_all_named(named_params, stmt)
-  end
-
-  defp bind_all_named([], _stmt), do: :ok
-
-  # credo:disable-for-next-line Credo.Check.Refactor.CyclomaticComplexity
-  defp do_bind(stmt, idx, param) do
-    case convert(param) do
-      i when is_integer(i) -> bind_integer(stmt, idx, i)
-      f when is_float(f) -> bind_float(stmt, idx, f)
-      b when is_binary(b) -> bind_text(stmt, idx, b)
-      b when is_list(b) -> bind_text(stmt, idx, IO.iodata_to_binary(b))
-      nil -> bind_null(stmt, idx)
-      :undefined -> bind_null(stmt, idx)
-      a when is_atom(a) -> bind_text(stmt, idx, Atom.to_string(a))
-      {:blob, b} when is_binary(b) -> bind_blob(stmt, idx, b)
-      {:blob, b} when is_list(b) -> bind_blob(stmt, idx, IO.iodata_to_binary(b))
-      _other -> raise ArgumentError, "unsupported type: #{inspect(param)}"
+  Each entry is a list of positional or a map of named parameters, as accepted
+  by `bind/2`. Returns the total number of rows changed, including those
+  changed by triggers.
+
+  The NIF yields its dirty scheduler periodically, so long inputs don't hog it,
+  except while it runs the rows in a transaction it opened itself: it then
+  holds the connection until the transaction ends, so that calls from other
+  processes on the same connection never run inside it.
+
+  ## Options
+
+    * `:transaction` - wrap the rows in a transaction unless the connection is
+      already in one. The transaction is rolled back if any row fails.
+      Defaults to `true`.
+    * `:rowids` - also return the rowid of the last insert after each row,
+      in order. Defaults to `false`.
+
+  ## Examples
+
+      iex> {:ok, conn} = Sqlite3.open(":memory:")
+      iex> :ok = Sqlite3.execute(conn, "create table t(id integer primary key, v text)")
+      iex> {:ok, stmt} = Sqlite3.prepare(conn, "insert into t(v) values (?)")
+      iex> Sqlite3.execute_many(conn, stmt, [["a"], ["b"], ["c"]], rowids: true)
+      {:ok, 3, [1, 2, 3]}
+
+  """
+  @spec execute_many(db(), statement(), [[bind_value] | map() | nil], keyword()) ::
+          {:ok, non_neg_integer()}
+          | {:ok, non_neg_integer(), [integer()]}
+          | {:error, reason()}
+  def execute_many(conn, statement, rows, opts \\ []) when is_list(rows) do
+    extensions = type_extensions()
+    params = Enum.map(rows, &convert_params(&1, extensions))
+    transaction = Keyword.get(opts, :transaction, true)
+    rowids = Keyword.get(opts, :rowids, false)
+
+    case Sqlite3NIF.execute_many(conn, statement, params, transaction, rowids) do
+      {:error, {:bind, index, reason}} ->
+        handle_bind_error(Enum.at(rows, index) || [], reason)
+
+      :busy ->
+        {:error, "Database busy"}
+
+      result ->
+        result
     end
+  rescue
+    e ->
+      handle_nif_exception(e, __STACKTRACE__)
   end
 
   @spec columns(db(), statement()) :: {:ok, [binary()]} | {:error, reason()}
@@ -330,9 +542,68 @@ defmodule Exqlite.Sqlite3 do
     e -> handle_nif_exception(e, __STACKTRACE__)
   end
 
-  @spec step(db(), statement()) :: :done | :busy | {:row, row()} | {:error, reason()}
-  def step(conn, statement) do
-    Sqlite3NIF.step(conn, statement)
+  @doc """
+  Returns the declared types of the columns of a prepared statement.
+
+  The types are taken verbatim from the table definition, or `nil` for
+  expressions and columns without a declared type. Like `columns/2`, the
+  result is computed once when the statement is prepared and copied to the
+  caller on each call.
+
+      iex> {:ok, conn} = Sqlite3.open(":memory:")
+      iex> :ok = Sqlite3.execute(conn, "create table t(a integer, b varchar(10), c)")
+      iex> {:ok, stmt} = Sqlite3.prepare(conn, "select a, b, c, 1 from t")
+      iex> Sqlite3.column_types(conn, stmt)
+      {:ok, ["integer", "varchar(10)", nil, nil]}
+
+  """
+  @spec column_types(db(), statement()) :: {:ok, [binary() | nil]} | {:error, reason()}
+  def column_types(conn, statement) do
+    Sqlite3NIF.column_types(conn, statement)
+  rescue
+    e -> handle_nif_exception(e, __STACKTRACE__)
+  end
+
+  @doc """
+  Returns `{:ok, true}` if the prepared statement makes no direct changes to
+  the database file.
+
+      iex> {:ok, conn} = Sqlite3.open(":memory:")
+      iex> {:ok, stmt} = Sqlite3.prepare(conn, "select 1")
+      iex> Sqlite3.statement_readonly(conn, stmt)
+      {:ok, true}
+
+  """
+  @spec statement_readonly(db(), statement()) :: {:ok, boolean()} | {:error, reason()}
+  def statement_readonly(conn, statement) do
+    Sqlite3NIF.statement_readonly(conn, statement)
+  rescue
+    e -> handle_nif_exception(e, __STACKTRACE__)
+  end
+
+  @doc """
+  Steps the statement once.
+
+  ## Options
+
+    * `:row_format` - `:list` (the default) returns each row as a list,
+      `:tuple` returns it as a tuple, which is smaller and gives constant time
+      access to a column.
+    * `:async` - run on the connection's worker thread, see `start_worker/1`.
+      Defaults to `false`.
+    * `:query_timeout` - see `execute/3`.
+
+  """
+  @spec step(db(), statement(), [row_opt() | async_opt() | query_timeout_opt()]) ::
+          :done | :busy | {:row, row()} | {:error, reason()}
+  def step(conn, statement, opts \\ []) do
+    with_query_timeout(opts, fn deadline ->
+      if async?(opts) do
+        async_call(conn, :step, [statement, row_format(opts), deadline])
+      else
+        Sqlite3NIF.step(conn, statement, row_format(opts), deadline)
+      end
+    end)
   rescue
     e ->
       handle_nif_exception(e, __STACKTRACE__)
@@ -345,22 +616,188 @@ defmodule Exqlite.Sqlite3 do
     multi_step(conn, statement, chunk_size)
   end
 
-  @spec multi_step(db(), statement(), integer()) ::
+  @doc """
+  Steps the statement up to `chunk_size` times and returns the rows in order.
+
+  TEXT and BLOB values longer than 64 bytes are sub-binaries of buffers of up
+  to 256 KB shared by the rows of the call, larger values get their own. A
+  value kept after the rows are dropped keeps its whole buffer alive, use
+  `:binary.copy/1` on values that are kept for long.
+
+  Accepts the same options as `step/3`, plus:
+
+    * `:decode` - a list with one decode hint per column, applied inside the
+      NIF while the rows are built. Columns past the end of the list are
+      returned as they are. A hint only converts the storage class it
+      expects, other values and values that don't parse are left untouched:
+
+        * `:raw` - no conversion.
+        * `:boolean` - INTEGER `0` to `false`, anything else to `true`.
+        * `:naive_datetime` - ISO 8601 TEXT without a `Z` or an offset to
+          `NaiveDateTime`.
+        * `:date` - ISO 8601 TEXT to `Date`.
+        * `:json` - JSON TEXT to maps with string keys, lists, strings,
+          numbers, booleans and `nil`. Integers that don't fit in 64 bits
+          become floats. Documents nested more than 256 levels deep, or with
+          a number too large for a float, are left as TEXT.
+        * `:atom_from_text` - TEXT to an atom, only if that atom exists.
+
+    * `:prefetch` - when `true` and rows remain after this chunk, SQLite steps
+      the next chunk on a background thread while the caller processes this
+      one, and the next call with `prefetch: true` returns it right away.
+      Binding, resetting or releasing the statement discards a pending chunk,
+      and so does stepping it without `prefetch: true` or with a different
+      chunk size, `:row_format` or `:decode`, whose rows are then skipped if
+      SQLite already stepped them. Defaults to `false`. Ignored
+      with `async: true`.
+
+      iex> {:ok, conn} = Sqlite3.open(":memory:")
+      iex> {:ok, stmt} = Sqlite3.prepare(conn, "SELECT 1, 'one' UNION ALL SELECT 2, 'two'")
+      iex> Sqlite3.multi_step(conn, stmt, 10, row_format: :tuple)
+      {:done, [{1, "one"}, {2, "two"}]}
+
+      iex> {:ok, conn} = Sqlite3.open(":memory:")
+      iex> {:ok, stmt} = Sqlite3.prepare(conn, ~s(SELECT 1, '2024-02-29', '{"a":[1]}'))
+      iex> Sqlite3.multi_step(conn, stmt, 10, decode: [:boolean, :date, :json])
+      {:done, [[true, ~D[2024-02-29], %{"a" => [1]}]]}
+
+  """
+  @spec multi_step(db(), statement(), integer(), [multi_step_opt()]) ::
           :busy | {:rows, [row()]} | {:done, [row()]} | {:error, reason()}
-  def multi_step(conn, statement, chunk_size) do
-    case Sqlite3NIF.multi_step(conn, statement, chunk_size) do
-      :busy ->
-        :busy
+  def multi_step(conn, statement, chunk_size, opts \\ []) do
+    format = row_format(opts)
+    hints = decode_hints(opts)
+
+    with_query_timeout(opts, fn deadline ->
+      cond do
+        async?(opts) ->
+          args = [statement, chunk_size, format, hints, deadline]
+          async_call(conn, :multi_step, args)
+
+        Keyword.get(opts, :prefetch, false) ->
+          Sqlite3NIF.multi_step_prefetch(
+            conn,
+            statement,
+            chunk_size,
+            format,
+            hints,
+            deadline
+          )
+
+        true ->
+          Sqlite3NIF.multi_step(conn, statement, chunk_size, format, hints, deadline)
+      end
+    end)
+  rescue
+    e ->
+      handle_nif_exception(e, __STACKTRACE__)
+  end
+
+  defp async?(opts), do: Keyword.get(opts, :async, false)
+
+  # The deadline is handed to the NIF, which arms it only while it holds the
+  # connection lock, so it never interrupts another caller sharing the handle.
+  defp with_query_timeout(opts, fun) do
+    case Keyword.get(opts, :query_timeout) do
+      timeout when timeout in [nil, :infinity] ->
+        fun.(:infinity)
+
+      timeout when is_integer(timeout) and timeout >= 0 ->
+        deadline =
+          System.monotonic_time(:nanosecond) +
+            System.convert_time_unit(timeout, :millisecond, :nanosecond)
+
+        case fun.(deadline) do
+          {:error, "interrupted"} = error ->
+            if System.monotonic_time(:nanosecond) >= deadline,
+              do: {:error, "query deadline exceeded"},
+              else: error
+
+          result ->
+            result
+        end
+    end
+  end
+
+  defp async_call(conn, function, args) do
+    case Sqlite3NIF.async_call(conn, function, args) do
+      {:ok, ref} ->
+        receive do
+          {^ref, result} -> result
+        end
 
       {:error, reason} ->
         {:error, reason}
+    end
+  end
 
-      {:rows, rows} ->
-        {:rows, Enum.reverse(rows)}
+  defp row_format(opts) do
+    case Keyword.get(opts, :row_format, :list) do
+      format when format in [:list, :tuple] ->
+        format
 
-      {:done, rows} ->
-        {:done, Enum.reverse(rows)}
+      other ->
+        raise ArgumentError,
+              "expected :row_format to be :list or :tuple, got: #{inspect(other)}"
+    end
+  end
+
+  @decode_hints [:raw, :boolean, :naive_datetime, :date, :json, :atom_from_text]
+
+  defp decode_hints(opts) do
+    hints = Keyword.get(opts, :decode, [])
+
+    if is_list(hints) and Enum.all?(hints, &(&1 in @decode_hints)) do
+      hints
+    else
+      raise ArgumentError,
+            "expected :decode to be a list of #{inspect(@decode_hints)}, got: #{inspect(hints)}"
     end
+  end
+
+  @type column_chunk() ::
+          {:integer | :float, values :: binary(), nulls :: binary()}
+          | {:text | :blob, offsets :: binary(), data :: binary(), nulls :: binary()}
+          | {:null, nulls :: binary()}
+          | {:mixed, [term()]}
+
+  @doc """
+  Steps the statement up to `chunk_size` times and returns the rows column by
+  column, packed into binaries rather than one term per cell.
+
+  Each column takes the storage class of its first non-NULL value in the chunk:
+
+    * `{:integer, values, nulls}` and `{:float, values, nulls}` - `values`
+      holds one native-endian 64-bit integer or float per row. NULL rows are
+      zero.
+    * `{:text, offsets, data, nulls}` and `{:blob, offsets, data, nulls}` -
+      `offsets` holds `num_rows + 1` native-endian 64-bit offsets into
+      `data`, so row `i` is `binary_part(data, offset_i, offset_i+1 - offset_i)`.
+    * `{:null, nulls}` - every row in the chunk is NULL.
+    * `{:mixed, values}` - the column held more than one storage class in the
+      chunk, so it is returned as a plain list of cells.
+
+  `nulls` is a bitmap with bit `rem(i, 8)` of byte `div(i, 8)` set when row
+  `i` is NULL.
+
+      iex> {:ok, conn} = Sqlite3.open(":memory:")
+      iex> {:ok, stmt} = Sqlite3.prepare(conn, "SELECT 1, 'one' UNION ALL SELECT NULL, 'two'")
+      iex> {:done, 2, [{:integer, values, nulls}, {:text, _offsets, data, _}]} =
+      ...>   Sqlite3.multi_step_columnar(conn, stmt, 10)
+      iex> for <<value::signed-native-64 <- values>>, do: value
+      [1, 0]
+      iex> nulls
+      <<0b10>>
+      iex> data
+      "onetwo"
+
+  """
+  @spec multi_step_columnar(db(), statement(), integer()) ::
+          :busy
+          | {:rows | :done, non_neg_integer(), [column_chunk()]}
+          | {:error, reason()}
+  def multi_step_columnar(conn, statement, chunk_size) do
+    Sqlite3NIF.multi_step_columnar(conn, statement, chunk_size)
   rescue
     e ->
       handle_nif_exception(e, __STACKTRACE__)
@@ -378,32 +815,142 @@ defmodule Exqlite.Sqlite3 do
   """
   @spec shrink_memory(db()) :: :ok | {:error, reason()}
   def shrink_memory(conn) do
-    Sqlite3NIF.execute(conn, "PRAGMA shrink_memory")
+    Sqlite3NIF.execute(conn, "PRAGMA shrink_memory", :infinity)
   end
 
-  @spec fetch_all(db(), statement(), integer()) :: {:ok, [row()]} | {:error, reason()}
-  def fetch_all(conn, statement, chunk_size) do
-    {:ok, try_fetch_all(conn, statement, chunk_size)}
-  catch
-    :throw, {:error, _reason} = error -> error
+  @type db_status() :: %{
+          optional(:tempbuf_spill) => non_neg_integer(),
+          lookaside_used: non_neg_integer(),
+          lookaside_used_highwater: non_neg_integer(),
+          lookaside_hit: non_neg_integer(),
+          lookaside_miss_size: non_neg_integer(),
+          lookaside_miss_full: non_neg_integer(),
+          cache_used: non_neg_integer(),
+          cache_used_shared: non_neg_integer(),
+          cache_hit: non_neg_integer(),
+          cache_miss: non_neg_integer(),
+          cache_write: non_neg_integer(),
+          cache_spill: non_neg_integer(),
+          schema_used: non_neg_integer(),
+          stmt_used: non_neg_integer(),
+          deferred_fks: non_neg_integer()
+        }
+
+  @doc """
+  Returns the memory and page cache counters SQLite keeps for the connection,
+  see https://www.sqlite.org/c3ref/c_dbstatus_options.html.
+
+    * `:cache_used`, `:schema_used` and `:stmt_used` - bytes held by the page
+      cache, the schema and the prepared statements of the connection.
+      `:cache_used_shared` splits pages shared with other connections evenly.
+    * `:cache_hit`, `:cache_miss`, `:cache_write` and `:cache_spill` - page
+      cache hits, misses, pages written and pages spilled to disk mid
+      transaction since the connection was opened.
+    * `:lookaside_used` and `:lookaside_used_highwater` - lookaside slots in
+      use now and at most. `:lookaside_hit`, `:lookaside_miss_size` and
+      `:lookaside_miss_full` count allocations served by the lookaside and
+      those that fell back to the allocator.
+    * `:deferred_fks` - `1` while deferred foreign key constraints are
+      unresolved, `0` otherwise.
+    * `:tempbuf_spill` - bytes written to temporary files, when the SQLite
+      library is recent enough to report it.
+
+  The counters are read, never reset.
+  """
+  @spec db_status(db()) :: {:ok, db_status()} | {:error, reason()}
+  def db_status(conn), do: Sqlite3NIF.db_status(conn)
+
+  @type stmt_status() :: %{
+          fullscan_step: non_neg_integer(),
+          sort: non_neg_integer(),
+          autoindex: non_neg_integer(),
+          vm_step: non_neg_integer(),
+          reprepare: non_neg_integer(),
+          run: non_neg_integer(),
+          filter_miss: non_neg_integer(),
+          filter_hit: non_neg_integer(),
+          memused: non_neg_integer()
+        }
+
+  @doc """
+  Returns the counters SQLite keeps for a prepared statement, see
+  https://www.sqlite.org/c3ref/c_stmtstatus_counter.html.
+
+    * `:fullscan_step` - rows stepped over in full table scans. A large value
+      points at a missing index.
+    * `:sort` - sorts that could not use an index.
+    * `:autoindex` - rows inserted into automatic indexes built because no
+      suitable index existed.
+    * `:vm_step` - virtual machine operations run.
+    * `:reprepare` - times the statement was recompiled after a schema change.
+    * `:run` - times the statement ran to completion or was reset.
+    * `:filter_miss` and `:filter_hit` - bloom filter checks that skipped a
+      join row, and those that did not.
+    * `:memused` - bytes held by the statement, never reset.
+
+  When `reset` is `true` the counters are set back to zero once read, so the
+  next call only sees what ran in between. Counters the SQLite library does
+  not know are left out.
+
+      iex> {:ok, conn} = Sqlite3.open(":memory:")
+      iex> :ok = Sqlite3.execute(conn, "create table t (i integer)")
+      iex> {:ok, statement} = Sqlite3.prepare(conn, "select * from t where i = 1")
+      iex> :done = Sqlite3.step(conn, statement)
+      iex> {:ok, %{fullscan_step: 0, sort: 0}} = Sqlite3.stmt_status(statement)
+
+  """
+  @spec stmt_status(statement(), boolean()) :: {:ok, stmt_status()} | {:error, reason()}
+  def stmt_status(statement, reset \\ false) when is_boolean(reset),
+    do: Sqlite3NIF.stmt_status(statement, reset)
+
+  @doc """
+  Steps the statement to completion and returns every row.
+
+  The rows are collected inside the NIF, which periodically yields the dirty
+  scheduler it runs on. `chunk_size` is the number of rows stepped between
+  those checks.
+
+  Accepts the `:row_format`, `:decode`, `:async` and `:query_timeout` options
+  of `multi_step/4`, which also describes how the values share memory.
+  With `async: true` the worker steps one chunk per call instead.
+  """
+  @spec fetch_all(db(), statement(), integer(), [multi_step_opt()]) ::
+          {:ok, [row()]} | {:error, reason()}
+  def fetch_all(conn, statement, chunk_size, opts \\ []) do
+    format = row_format(opts)
+    hints = decode_hints(opts)
+
+    result =
+      with_query_timeout(opts, fn deadline ->
+        if async?(opts) do
+          async_fetch_all(conn, [statement, chunk_size, format, hints, deadline], [])
+        else
+          Sqlite3NIF.fetch_all(conn, statement, chunk_size, format, hints, deadline)
+        end
+      end)
+
+    case result do
+      {:ok, rows} -> {:ok, rows}
+      {:error, reason} -> {:error, reason}
+      :busy -> {:error, "Database busy"}
+    end
+  rescue
+    e ->
+      handle_nif_exception(e, __STACKTRACE__)
   end
 
-  defp try_fetch_all(conn, statement, chunk_size) do
-    case multi_step(conn, statement, chunk_size) do
-      {:done, rows} -> rows
-      {:rows, rows} -> rows ++ try_fetch_all(conn, statement, chunk_size)
-      {:error, _reason} = error -> throw(error)
-      :busy -> throw({:error, "Database busy"})
+  # The fetch_all NIF reschedules itself, which only works in a NIF call made by
+  # a process, so the worker runs multi_step until the statement is done.
+  defp async_fetch_all(conn, args, chunks) do
+    case async_call(conn, :multi_step, args) do
+      {:rows, rows} -> async_fetch_all(conn, args, [rows | chunks])
+      {:done, rows} -> {:ok, [rows | chunks] |> Enum.reverse() |> Enum.concat()}
+      other -> other
     end
   end
 
   @spec fetch_all(db(), statement()) :: {:ok, [row()]} | {:error, reason()}
   def fetch_all(conn, statement) do
-    # Should this be done in the NIF? It can be _much_ faster to build a list
-    # there, but at the expense that it could block other dirty nifs from
-    # getting work done.
-    #
-    # For now this just works
     chunk_size = Application.get_env(:exqlite, :default_chunk_size, 50)
     fetch_all(conn, statement, chunk_size)
   end
@@ -425,6 +972,64 @@ defmodule Exqlite.Sqlite3 do
     Sqlite3NIF.deserialize(conn, database, serialized)
   end
 
+  @doc """
+  Records the state of the main database as the connection currently reads it.
+
+  Several connections can then read that same state with `snapshot_open/2`,
+  for example to split the queries of a report over a pool while every one of
+  them sees one consistent database. See
+  https://www.sqlite.org/c3ref/snapshot_get.html.
+
+  The database must be in WAL journal mode with at least one transaction
+  written to the WAL, and the connection must be inside a transaction that has
+  not written anything. If the transaction has not read anything yet, taking
+  the snapshot starts its read, and checkpoints cannot invalidate the snapshot
+  until that transaction ends.
+
+      :ok = Sqlite3.execute(conn, "BEGIN")
+      {:ok, snapshot} = Sqlite3.snapshot_get(conn)
+
+      # On every reader
+      :ok = Sqlite3.execute(reader, "BEGIN")
+      :ok = Sqlite3.snapshot_open(reader, snapshot)
+      # ... queries ...
+      :ok = Sqlite3.execute(reader, "COMMIT")
+
+      :ok = Sqlite3.execute(conn, "COMMIT")
+
+  The snapshot is freed when it is garbage collected, or by `snapshot_free/1`.
+
+  The bundled SQLite is built with `SQLITE_ENABLE_SNAPSHOT`. With
+  `EXQLITE_USE_SYSTEM` the snapshot functions return
+  `{:error, :snapshots_not_supported}` unless `EXQLITE_SYSTEM_CFLAGS` sets
+  `-DSQLITE_ENABLE_SNAPSHOT=1` for a system library built with it.
+  """
+  @spec snapshot_get(db()) :: {:ok, snapshot()} | {:error, reason()}
+  def snapshot_get(conn), do: Sqlite3NIF.snapshot_get(conn)
+
+  @doc """
+  Moves the read transaction of the connection onto `snapshot`, so that its
+  queries see the database as it was when the snapshot was taken.
+
+  The connection must be inside a transaction, see `snapshot_get/1`. If that
+  transaction has already read, none of its statements may be running. A
+  connection that has not touched the database since it was opened may not
+  know the file is in WAL mode yet and fails, run any query first, for
+  example `PRAGMA application_id`.
+
+  Fails once a checkpoint has overwritten the snapshot, that is once no
+  transaction holds it open any more and the WAL has been checkpointed.
+  """
+  @spec snapshot_open(db(), snapshot()) :: :ok | {:error, reason()}
+  def snapshot_open(conn, snapshot), do: Sqlite3NIF.snapshot_open(conn, snapshot)
+
+  @doc """
+  Frees `snapshot` without waiting for it to be garbage collected. Opening it
+  afterwards returns `{:error, :invalid_snapshot}`.
+  """
+  @spec snapshot_free(snapshot()) :: :ok | {:error, reason()}
+  def snapshot_free(snapshot), do: Sqlite3NIF.snapshot_free(snapshot)
+
   def release(_conn, nil), do: :ok
 
   @doc """
@@ -541,6 +1146,88 @@ defmodule Exqlite.Sqlite3 do
     Sqlite3NIF.set_log_hook(pid)
   end
 
+  @doc """
+  Sets a memory budget, in bytes, shared by the page caches of every file
+  database opened in this VM.
+
+  Each connection keeps its own page cache, sized by `PRAGMA cache_size`, so a
+  pool of N connections normally holds up to N times that much memory. With a
+  budget the caches split it evenly instead, each one holding at most its
+  share or its own `cache_size`, whichever is smaller. Shares are rebalanced
+  as connections open and close, a cache adopts a new share the next time
+  its connection reads a page.
+
+  In-memory databases are not counted, their cache holds the whole database.
+  A budget of `0`, the default, removes the limit.
+  """
+  @spec set_page_cache_budget(non_neg_integer()) :: :ok
+  def set_page_cache_budget(bytes), do: Sqlite3NIF.set_page_cache_budget(bytes)
+
+  @type allocator_class_stats() :: %{
+          size: pos_integer(),
+          allocations: non_neg_integer(),
+          reused: non_neg_integer(),
+          in_use: non_neg_integer(),
+          high_water: non_neg_integer(),
+          cached: non_neg_integer()
+        }
+
+  @doc """
+  Returns the counters of the allocator SQLite uses in this VM.
+
+  The allocator is picked once, when the NIF loads. By default every SQLite
+  allocation goes to the VM allocator and `:classes` is empty. Setting
+  `EXQLITE_ALLOCATOR=pool` in the environment of the VM selects the pool
+  allocator, which serves allocations of up to 512 bytes from free lists per
+  size class. Each class splits its free list into shards picked by thread,
+  so connections used from many schedulers at once rarely wait on each
+  other. `:classes` then holds one map per size class, summed over its shards:
+
+    * `:size` - the block size of the class, in bytes.
+    * `:allocations` - how many blocks were handed out.
+    * `:reused` - how many of those came from the free list.
+    * `:in_use` and `:high_water` - blocks currently allocated, and the most
+      that ever were at once.
+    * `:cached` - free blocks kept for reuse.
+
+  SQLite keeps its own totals over every allocation whichever allocator is
+  used, see `status/0`.
+  """
+  @spec allocator_stats() ::
+          {:ok, %{allocator: :default | :pool, classes: [allocator_class_stats()]}}
+  def allocator_stats, do: Sqlite3NIF.allocator_stats()
+
+  @type status() :: %{
+          memory_used: non_neg_integer(),
+          memory_used_highwater: non_neg_integer(),
+          malloc_count: non_neg_integer(),
+          malloc_count_highwater: non_neg_integer(),
+          malloc_size_highwater: non_neg_integer(),
+          pagecache_used: non_neg_integer(),
+          pagecache_used_highwater: non_neg_integer(),
+          pagecache_overflow: non_neg_integer(),
+          pagecache_overflow_highwater: non_neg_integer(),
+          pagecache_size_highwater: non_neg_integer(),
+          parser_stack_highwater: non_neg_integer()
+        }
+
+  @doc """
+  Returns the memory counters SQLite keeps across every connection in this
+  VM, see https://www.sqlite.org/c3ref/c_status_malloc_count.html.
+
+    * `:memory_used` and `:malloc_count` - bytes and allocations currently
+      held by SQLite. `:malloc_size_highwater` is the largest single request.
+    * `:pagecache_used` and `:pagecache_overflow` - page cache slots taken
+      from the static page cache buffer, and bytes that did not fit in it.
+    * `:pagecache_size_highwater` and `:parser_stack_highwater` - the largest
+      page cache allocation and the deepest parser stack.
+
+  The `_highwater` keys hold the most ever reported since the NIF loaded.
+  Counters SQLite does not track in its current configuration read `0`.
+  """
+  @spec status() :: {:ok, status()}
+  def status, do: Sqlite3NIF.status()
+
   @sqlite_ok 0
 
   @doc """
@@ -631,17 +1318,19 @@ defmodule Exqlite.Sqlite3 do
   defp errmsg(stmt), do: Sqlite3NIF.errmsg(stmt)
   defp errstr(rc), do: Sqlite3NIF.errstr(rc)
 
-  defp convert(%Date{} = val), do: Date.to_iso8601(val)
-  defp convert(%Time{} = val), do: Time.to_iso8601(val)
-  defp convert(%NaiveDateTime{} = val), do: NaiveDateTime.to_iso8601(val)
-  defp convert(%DateTime{time_zone: "Etc/UTC"} = val), do: NaiveDateTime.to_iso8601(val)
+  defp convert(%Date{} = val, _extensions), do: Date.to_iso8601(val)
+  defp convert(%Time{} = val, _extensions), do: Time.to_iso8601(val)
+  defp convert(%NaiveDateTime{} = val, _extensions), do: NaiveDateTime.to_iso8601(val)
+
+  defp convert(%DateTime{time_zone: "Etc/UTC"} = val, _extensions),
+    do: NaiveDateTime.to_iso8601(val)
 
-  defp convert(%DateTime{} = datetime) do
+  defp convert(%DateTime{} = datetime, _extensions) do
     raise ArgumentError, "#{inspect(datetime)} is not in UTC"
   end
 
-  defp convert(val) do
-    convert_with_type_extensions(type_extensions(), val)
+  defp convert(val, extensions) do
+    convert_with_type_extensions(extensions, val)
   end
 
   defp convert_with_type_extensions(nil, val), do: val
@@ -15,8 +15,10 @@ defmodule Exqlite.Sqlite3NIF do
 
   @type db() :: reference()
   @type statement() :: reference()
+  @type snapshot() :: reference()
   @type reason() :: :atom | String.Chars.t()
-  @type row() :: list()
+  @type row() :: list() | tuple()
+  @type deadline() :: integer() | :infinity
 
   def load_nif() do
     path = :filename.join(:code.priv_dir(:exqlite), ~c"sqlite3_nif")
@@ -41,8 +43,26 @@ defmodule Exqlite.Sqlite3NIF do
   @spec cancel(db()) :: :ok | {:error, reason()}
   def cancel(_conn), do: :erlang.nif_error(:not_loaded)
 
-  @spec execute(db(), String.t()) :: :ok | {:error, reason()}
-  def execute(_conn, _sql), do: :erlang.nif_error(:not_loaded)
+  @spec set_deadline(db(), deadline()) :: :ok | {:error, reason()}
+  def set_deadline(_conn, _deadline), do: :erlang.nif_error(:not_loaded)
+
+  @spec start_worker(db()) :: :ok | {:error, reason()}
+  def start_worker(_conn), do: :erlang.nif_error(:not_loaded)
+
+  @spec async_call(db(), atom(), list()) :: {:ok, reference()} | {:error, reason()}
+  def async_call(_conn, _function, _args), do: :erlang.nif_error(:not_loaded)
+
+  @spec lock_stats(db()) :: {:ok, map()} | {:error, reason()}
+  def lock_stats(_conn), do: :erlang.nif_error(:not_loaded)
+
+  @spec set_query_stats(db(), boolean()) :: :ok | {:error, reason()}
+  def set_query_stats(_conn, _enabled), do: :erlang.nif_error(:not_loaded)
+
+  @spec take_query_stats(db()) :: {:ok, map()} | {:error, reason()}
+  def take_query_stats(_conn), do: :erlang.nif_error(:not_loaded)
+
+  @spec execute(db(), String.t(), deadline()) :: :ok | {:error, reason()}
+  def execute(_conn, _sql, _deadline), do: :erlang.nif_error(:not_loaded)
 
   @spec changes(db()) :: {:ok, integer()} | {:error, reason()}
   def changes(_conn), do: :erlang.nif_error(:not_loaded)
@@ -50,16 +70,70 @@ defmodule Exqlite.Sqlite3NIF do
   @spec prepare(db(), String.t()) :: {:ok, statement()} | {:error, reason()}
   def prepare(_conn, _sql), do: :erlang.nif_error(:not_loaded)
 
-  @spec step(db(), statement()) :: :done | :busy | {:row, row()} | {:error, reason()}
-  def step(_conn, _statement), do: :erlang.nif_error(:not_loaded)
-
-  @spec multi_step(db(), statement(), integer()) ::
+  @spec step(db(), statement(), :list | :tuple, deadline()) ::
+          :done | :busy | {:row, row()} | {:error, reason()}
+  def step(_conn, _statement, _row_format, _deadline),
+    do: :erlang.nif_error(:not_loaded)
+
+  @spec multi_step(
+          db(),
+          statement(),
+          integer(),
+          :list | :tuple,
+          [atom()],
+          deadline()
+        ) ::
+          :busy | {:rows, [row()]} | {:done, [row()]} | {:error, reason()}
+  def multi_step(_conn, _statement, _chunk_size, _row_format, _decode, _deadline),
+    do: :erlang.nif_error(:not_loaded)
+
+  @spec execute_many(db(), statement(), list(), boolean(), boolean()) ::
+          :busy
+          | {:ok, non_neg_integer()}
+          | {:ok, non_neg_integer(), [integer()]}
+          | {:error, reason()}
+  def execute_many(_conn, _statement, _rows, _transaction, _rowids),
+    do: :erlang.nif_error(:not_loaded)
+
+  @spec multi_step_prefetch(
+          db(),
+          statement(),
+          integer(),
+          :list | :tuple,
+          [atom()],
+          deadline()
+        ) ::
           :busy | {:rows, [row()]} | {:done, [row()]} | {:error, reason()}
-  def multi_step(_conn, _statement, _chunk_size), do: :erlang.nif_error(:not_loaded)
+  def multi_step_prefetch(
+        _conn,
+        _statement,
+        _chunk_size,
+        _row_format,
+        _decode,
+        _deadline
+      ),
+      do: :erlang.nif_error(:not_loaded)
+
+  @spec fetch_all(db(), statement(), integer(), :list | :tuple, [atom()], deadline()) ::
+          :busy | {:ok, [row()]} | {:error, reason()}
+  def fetch_all(_conn, _statement, _chunk_size, _row_format, _decode, _deadline),
+    do: :erlang.nif_error(:not_loaded)
+
+  @spec multi_step_columnar(db(), statement(), integer()) ::
+          :busy | {:rows | :done, non_neg_integer(), list()} | {:error, reason()}
+  def multi_step_columnar(_conn, _statement, _chunk_size),
+    do: :erlang.nif_error(:not_loaded)
 
   @spec columns(db(), statement()) :: {:ok, list(binary())} | {:error, reason()}
   def columns(_conn, _statement), do: :erlang.nif_error(:not_loaded)
 
+  @spec column_types(db(), statement()) ::
+          {:ok, list(binary() | nil)} | {:error, reason()}
+  def column_types(_conn, _statement), do: :erlang.nif_error(:not_loaded)
+
+  @spec statement_readonly(db(), statement()) :: {:ok, boolean()} | {:error, reason()}
+  def statement_readonly(_conn, _statement), do: :erlang.nif_error(:not_loaded)
+
   @spec last_insert_rowid(db()) :: {:ok, integer()}
   def last_insert_rowid(_conn), do: :erlang.nif_error(:not_loaded)
 
@@ -72,6 +146,15 @@ defmodule Exqlite.Sqlite3NIF do
   @spec deserialize(db(), String.t(), binary()) :: :ok | {:error, reason()}
   def deserialize(_conn, _database, _serialized), do: :erlang.nif_error(:not_loaded)
 
+  @spec snapshot_get(db()) :: {:ok, snapshot()} | {:error, reason()}
+  def snapshot_get(_conn), do: :erlang.nif_error(:not_loaded)
+
+  @spec snapshot_open(db(), snapshot()) :: :ok | {:error, reason()}
+  def snapshot_open(_conn, _snapshot), do: :erlang.nif_error(:not_loaded)
+
+  @spec snapshot_free(snapshot()) :: :ok | {:error, reason()}
+  def snapshot_free(_snapshot), do: :erlang.nif_error(:not_loaded)
+
   @spec release(db(), statement()) :: :ok | {:error, reason()}
   def release(_conn, _statement), do: :erlang.nif_error(:not_loaded)
 
@@ -87,6 +170,21 @@ defmodule Exqlite.Sqlite3NIF do
   @spec set_log_hook(pid()) :: :ok | {:error, reason()}
   def set_log_hook(_pid), do: :erlang.nif_error(:not_loaded)
 
+  @spec set_page_cache_budget(non_neg_integer()) :: :ok
+  def set_page_cache_budget(_bytes), do: :erlang.nif_error(:not_loaded)
+
+  @spec allocator_stats() :: {:ok, map()}
+  def allocator_stats(), do: :erlang.nif_error(:not_loaded)
+
+  @spec db_status(db()) :: {:ok, map()} | {:error, reason()}
+  def db_status(_conn), do: :erlang.nif_error(:not_loaded)
+
+  @spec stmt_status(statement(), boolean()) :: {:ok, map()} | {:error, reason()}
+  def stmt_status(_statement, _reset), do: :erlang.nif_error(:not_loaded)
+
+  @spec status() :: {:ok, map()}
+  def status(), do: :erlang.nif_error(:not_loaded)
+
   @spec bind_parameter_count(statement) :: non_neg_integer() | {:error, reason()}
   def bind_parameter_count(_stmt), do: :erlang.nif_error(:not_loaded)
 
@@ -108,6 +206,9 @@ defmodule Exqlite.Sqlite3NIF do
   @spec bind_null(statement, non_neg_integer) :: integer()
   def bind_null(_stmt, _index), do: :erlang.nif_error(:not_loaded)
 
+  @spec bind_all(statement, list() | map()) :: :ok | {:error, term()}
+  def bind_all(_stmt, _params), do: :erlang.nif_error(:not_loaded)
+
   @spec reset(statement) :: :ok
   def reset(_stmt), do: :erlang.nif_error(:not_loaded)
 
@@ -0,0 +1,111 @@
+defmodule Exqlite.StatementCache do
+  @moduledoc """
+  A bounded, least recently used cache of prepared statements keyed by their
+  SQL text.
+
+  Used by `Exqlite.Connection` when the `:statement_cache_size` option is
+  set, so that hot queries skip `sqlite3_prepare_v3` on every execution. The
+  cache only tracks references; the caller is responsible for releasing the
+  statements that get evicted.
+  """
+
+  alias Exqlite.Sqlite3
+
+  @type t() :: %__MODULE__{
+          size: pos_integer(),
+          tick: non_neg_integer(),
+          entries: %{String.t() => {Sqlite3.statement(), non_neg_integer()}},
+          lru: :gb_trees.tree(non_neg_integer(), String.t())
+        }
+
+  defstruct size: 0, tick: 0, entries: %{}, lru: :gb_trees.empty()
+
+  @doc """
+  Creates a new cache holding at most `size` statements.
+
+  Returns `nil` when `size` is `nil` or less than `1`, which disables caching.
+  """
+  @spec new(integer() | nil) :: t() | nil
+  def new(size) when is_integer(size) and size > 0, do: %__MODULE__{size: size}
+  def new(_size), do: nil
+
+  @doc """
+  Looks up the statement prepared for `sql`, marking it as most recently used.
+  """
+  @spec fetch(t(), String.t()) :: {:ok, Sqlite3.statement(), t()} | :error
+  def fetch(%__MODULE__{entries: entries} = cache, sql) do
+    case entries do
+      %{^sql => {ref, tick}} ->
+        next = cache.tick + 1
+        lru = :gb_trees.insert(next, sql, :gb_trees.delete(tick, cache.lru))
+        entries = %{entries | sql => {ref, next}}
+
+        {:ok, ref, %{cache | tick: next, lru: lru, entries: entries}}
+
+      _ ->
+        :error
+    end
+  end
+
+  @doc """
+  Stores the statement prepared for `sql`.
+
+  Returns the updated cache along with the statements that were evicted to
+  stay within the size limit.
+  """
+  @spec put(t(), String.t(), Sqlite3.statement()) :: {t(), [Sqlite3.statement()]}
+  def put(%__MODULE__{} = cache, sql, ref) do
+    {cache, replaced} = delete(cache, sql)
+
+    next = cache.tick + 1
+
+    cache = %{
+      cache
+      | tick: next,
+        lru: :gb_trees.insert(next, sql, cache.lru),
+        entries: Map.put(cache.entries, sql, {ref, next})
+    }
+
+    evict(cache, replaced)
+  end
+
+  @doc """
+  Returns `true` if `ref` is the statement currently cached for `sql`.
+  """
+  @spec cached?(t() | nil, String.t(), Sqlite3.statement() | nil) :: boolean()
+  def cached?(nil, _sql, _ref), do: false
+
+  def cached?(%__MODULE__{entries: entries}, sql, ref) do
+    match?(%{^sql => {^ref, _tick}}, entries)
+  end
+
+  @doc """
+  Returns every cached statement and an empty cache.
+  """
+  @spec clear(t()) :: {t(), [Sqlite3.statement()]}
+  def clear(%__MODULE__{entries: entries} = cache) do
+    refs = Enum.map(entries, fn {_sql, {ref, _tick}} -> ref end)
+    {%{cache | entries: %{}, lru: :gb_trees.empty()}, refs}
+  end
+
+  defp delete(%__MODULE__{entries: entries} = cache, sql) do
+    case Map.pop(entries, sql) do
+      {nil, _entries} ->
+        {cache, []}
+
+      {{ref, tick}, entries} ->
+        {%{cache | entries: entries, lru: :gb_trees.delete(tick, cache.lru)}, [ref]}
+    end
+  end
+
+  defp evict(%__MODULE__{size: size, entries: entries} = cache, evicted)
+       when map_size(entries) <= size do
+    {cache, evicted}
+  end
+
+  defp evict(%__MODULE__{} = cache, evicted) do
+    {_tick, sql, lru} = :gb_trees.take_smallest(cache.lru)
+    {{ref, _tick}, entries} = Map.pop(cache.entries, sql)
+    evict(%{cache | lru: lru, entries: entries}, [ref | evicted])
+  end
+end
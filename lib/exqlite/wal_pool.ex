@@ -0,0 +1,310 @@
+defmodule Exqlite.WALPool do
+  @moduledoc """
+  A pool that splits a write-ahead logged database into one writer connection
+  and several read-only reader connections.
+
+  SQLite in `:wal` journal mode lets any number of readers run alongside a
+  single writer. A plain `DBConnection` pool treats every connection the same,
+  so readers end up waiting behind writers for a connection. This pool starts
+  two `DBConnection` pools for the same database file instead:
+
+    * a writer pool holding exactly one connection opened with
+      `journal_mode: :wal`
+    * a reader pool holding `:readers` connections opened with
+      `mode: :readonly`
+
+  Queries are routed by preparing them and asking SQLite whether the statement
+  writes to the database (see `Exqlite.Sqlite3.statement_readonly/2`). The
+  answer is cached per SQL text. Transaction control statements (`BEGIN`,
+  `COMMIT`, `SAVEPOINT`, ...), `PRAGMA` statements and `transaction/3` always
+  run on the writer, as does every query issued through the connection handed
+  to a transaction. A `PRAGMA` often reads or changes the state of the
+  connection it runs on rather than the database, so only the writer gives a
+  stable answer.
+
+  ## Example
+
+      children = [
+        {Exqlite.WALPool, name: MyApp.DB, database: "app.db", readers: 4}
+      ]
+
+      {:ok, _result} = Exqlite.WALPool.query(MyApp.DB, "SELECT * FROM users")
+
+      Exqlite.WALPool.transaction(MyApp.DB, fn conn ->
+        Exqlite.WALPool.query!(conn, "INSERT INTO users (name) VALUES (?)", ["a"])
+      end)
+  """
+
+  use Supervisor
+
+  alias Exqlite.Connection
+  alias Exqlite.Query
+  alias Exqlite.Result
+  alias Exqlite.Sqlite3
+
+  @classification_cache_size 1024
+
+  @type pool() :: atom() | DBConnection.conn()
+
+  @type start_opt() ::
+          {:name, atom()}
+          | {:readers, pos_integer()}
+          | Connection.connection_opt()
+          | DBConnection.start_option()
+
+  @doc """
+  Starts the writer and reader pools.
+
+  Options:
+
+    * `:name` - Required. The name used to address the pool.
+    * `:database` - Required. The path to the database file. In memory
+      databases are not supported since every connection would see its own
+      database.
+    * `:readers` - The number of read-only connections. Defaults to
+      `System.schedulers_online/0`.
+
+  Every other option is passed to both pools, see `Exqlite.Connection.connect/1`
+  and `DBConnection.start_link/2`. `:pool_size`, `:mode` and `:journal_mode`
+  are managed by this module and are ignored.
+  """
+  @spec start_link([start_opt()]) :: Supervisor.on_start()
+  def start_link(opts) do
+    name = Keyword.fetch!(opts, :name)
+    Supervisor.start_link(__MODULE__, opts, name: name)
+  end
+
+  @impl true
+  def init(opts) do
+    name = Keyword.fetch!(opts, :name)
+
+    database =
+      case Keyword.fetch!(opts, :database) do
+        memory when memory in [:memory, ":memory:"] ->
+          raise ArgumentError, "#{inspect(__MODULE__)} requires a database file"
+
+        database ->
+          database
+      end
+
+    readers = Keyword.get(opts, :readers, System.schedulers_online())
+
+    opts =
+      opts
+      |> Keyword.drop([:name, :readers, :pool_size, :mode, :journal_mode])
+      |> Keyword.put(:database, database)
+
+    writer_opts =
+      Keyword.merge(opts,
+        name: writer(name),
+        pool_size: 1,
+        mode: [:readwrite, :create],
+        journal_mode: :wal
+      )
+
+    reader_opts =
+      Keyword.merge(opts,
+        name: reader(name),
+        pool_size: readers,
+        mode: :readonly
+      )
+
+    children = [
+      {__MODULE__.Router, name: name, database: database},
+      Supervisor.child_spec(DBConnection.child_spec(Connection, writer_opts),
+        id: :writer
+      ),
+      Supervisor.child_spec(DBConnection.child_spec(Connection, reader_opts),
+        id: :readers
+      )
+    ]
+
+    # DBConnection pools connect asynchronously, so the router creates the
+    # file and switches it to WAL before either pool starts. Otherwise readers
+    # could race the writer and fail to open the file read-only.
+    Supervisor.init(children, strategy: :rest_for_one)
+  end
+
+  @doc """
+  The name of the writer pool for `pool`.
+  """
+  @spec writer(atom()) :: atom()
+  def writer(pool), do: Module.concat(pool, Writer)
+
+  @doc """
+  The name of the reader pool for `pool`.
+  """
+  @spec reader(atom()) :: atom()
+  def reader(pool), do: Module.concat(pool, Readers)
+
+  @doc """
+  Runs `sql` on the reader pool if it only reads from the database, on the
+  writer otherwise.
+
+  When `pool` is a connection handed out by `transaction/3` the query runs on
+  that connection.
+  """
+  @spec query(pool(), iodata(), list() | map(), Keyword.t()) ::
+          {:ok, Result.t()} | {:error, Exception.t()}
+  def query(pool, sql, params \\ [], opts \\ []) do
+    query = Query.build(statement: IO.iodata_to_binary(sql))
+
+    pool
+    |> route(query.statement)
+    |> DBConnection.prepare_execute(query, params, opts)
+    |> case do
+      {:ok, _query, result} -> {:ok, result}
+      {:error, _reason} = error -> error
+    end
+  end
+
+  @doc """
+  Same as `query/4` but raises on error.
+  """
+  @spec query!(pool(), iodata(), list() | map(), Keyword.t()) :: Result.t()
+  def query!(pool, sql, params \\ [], opts \\ []) do
+    case query(pool, sql, params, opts) do
+      {:ok, result} -> result
+      {:error, reason} -> raise reason
+    end
+  end
+
+  @doc """
+  Runs `fun` inside a transaction on the writer connection.
+
+  See `DBConnection.transaction/3`.
+  """
+  @spec transaction(pool(), (DBConnection.t() -> result), Keyword.t()) ::
+          {:ok, result} | {:error, any()}
+        when result: var
+  def transaction(pool, fun, opts \\ [])
+
+  def transaction(%DBConnection{} = conn, fun, opts) do
+    DBConnection.transaction(conn, fun, opts)
+  end
+
+  def transaction(pool, fun, opts) when is_atom(pool) do
+    DBConnection.transaction(writer(pool), fun, opts)
+  end
+
+  @doc """
+  Returns `true` when `sql` would be routed to the reader pool.
+  """
+  @spec readonly?(atom(), iodata()) :: boolean()
+  def readonly?(pool, sql) when is_atom(pool) do
+    sql = IO.iodata_to_binary(sql)
+    not writer_only?(sql) and classify(pool, sql)
+  end
+
+  defp writer_only?(sql) do
+    Regex.match?(~r/\A\s*(BEGIN|COMMIT|END|ROLLBACK|SAVEPOINT|RELEASE|PRAGMA)\b/i, sql)
+  end
+
+  defp route(%DBConnection{} = conn, _sql), do: conn
+
+  defp route(pool, sql) when is_atom(pool) do
+    if readonly?(pool, sql), do: reader(pool), else: writer(pool)
+  end
+
+  defp classify(pool, sql) do
+    table = __MODULE__.Router.table(pool)
+
+    case :ets.lookup(table, sql) do
+      [{^sql, readonly}] ->
+        readonly
+
+      [] ->
+        [{:db, db}] = :ets.lookup(table, :db)
+
+        # Statements that fail to prepare go to the writer, which reports the
+        # actual error. They are not cached, the schema may change under them.
+        with {:ok, statement} <- Sqlite3.prepare(db, sql),
+             {:ok, readonly} <- readonly_and_release(db, statement) do
+          if :ets.info(table, :size) > @classification_cache_size do
+            evict(table)
+          end
+
+          :ets.insert(table, {sql, readonly})
+          readonly
+        else
+          _ -> false
+        end
+    end
+  end
+
+  # Makes room for one entry by evicting an arbitrary one, so a burst of new
+  # SQL texts does not throw away every classification at once.
+  defp evict(table) do
+    case :ets.first(table) do
+      :db -> evict(table, :ets.next(table, :db))
+      key -> evict(table, key)
+    end
+  end
+
+  defp evict(_table, :"$end_of_table"), do: true
+  defp evict(table, key), do: :ets.delete(table, key)
+
+  defp readonly_and_release(db, statement) do
+    Sqlite3.statement_readonly(db, statement)
+  after
+    Sqlite3.release(db, statement)
+  end
+
+  defmodule Router do
+    @moduledoc false
+
+    # Owns the classification cache and the connection used to prepare
+    # statements for classification. Statements are only ever prepared on it,
+    # never stepped. Callers prepare on it directly, the NIF serializes access
+    # to the connection.
+
+    use GenServer
+
+    alias Exqlite.Sqlite3
+
+    def start_link(opts) do
+      GenServer.start_link(__MODULE__, opts)
+    end
+
+    def table(pool), do: Module.concat(pool, Router)
+
+    @impl true
+    def init(opts) do
+      Process.flag(:trap_exit, true)
+
+      database = Keyword.fetch!(opts, :database)
+      File.mkdir_p!(Path.dirname(database))
+
+      with {:ok, db} <- Sqlite3.open(database),
+           :ok <- enable_wal(db) do
+        table =
+          :ets.new(table(Keyword.fetch!(opts, :name)), [
+            :named_table,
+            :public,
+            read_concurrency: true
+          ])
+
+        :ets.insert(table, {:db, db})
+        {:ok, db}
+      else
+        {:error, reason} -> {:stop, reason}
+      end
+    end
+
+    @impl true
+    def terminate(_reason, db) do
+      Sqlite3.close(db)
+    end
+
+    defp enable_wal(db) do
+      case Sqlite3.execute(db, "PRAGMA journal_mode = WAL") do
+        :ok ->
+          :ok
+
+        {:error, _reason} = error ->
+          Sqlite3.close(db)
+          error
+      end
+    end
+  end
+end
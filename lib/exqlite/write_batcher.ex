@@ -0,0 +1,269 @@
+defmodule Exqlite.WriteBatcher do
+  @moduledoc """
+  Groups writes from many processes into shared transactions.
+
+  Every standalone write commits its own transaction, and with `:synchronous`
+  set to `:normal` or `:full` each commit waits on the disk. The batcher owns a
+  single `Exqlite.Connection` and queues the writes it receives. Once the
+  oldest queued write has waited `:max_latency` milliseconds, or `:max_batch`
+  writes are queued, it runs all of them inside one `BEGIN IMMEDIATE` ...
+  `COMMIT`, so N callers pay for a single commit.
+
+  Each write runs inside its own savepoint. A write that fails is rolled back
+  to its savepoint and its caller gets the error, while the rest of the batch
+  still commits. Callers are answered once the batch has committed.
+
+  Writes must be single statements that do not manage transactions themselves.
+
+  When the connection reports that it has to be disconnected, every caller in
+  the batch gets that error and the batcher opens a new connection. If that
+  fails the batcher stops.
+
+  ## Example
+
+      {:ok, batcher} = Exqlite.WriteBatcher.start_link(database: "app.db")
+
+      {:ok, %Exqlite.Result{num_rows: 1}} =
+        Exqlite.WriteBatcher.query(batcher, "INSERT INTO logs (line) VALUES (?)", [
+          "hi"
+        ])
+  """
+
+  use GenServer
+
+  alias Exqlite.Connection
+  alias Exqlite.Error
+  alias Exqlite.Query
+  alias Exqlite.Result
+  alias Exqlite.Sqlite3
+
+  defstruct [:conn, :opts, :max_latency, :max_batch, :timer, queue: [], queued: 0]
+
+  @type start_opt() ::
+          {:max_latency, non_neg_integer()}
+          | {:max_batch, pos_integer()}
+          | GenServer.option()
+          | Connection.connection_opt()
+
+  @doc """
+  Starts a batcher and opens its connection.
+
+  Options:
+
+    * `:max_latency` - How long in milliseconds the first write of a batch may
+      wait for others to join it. Defaults to `2`.
+    * `:max_batch` - The number of queued writes that triggers a commit right
+      away. Defaults to `100`.
+    * `:name` - Registers the batcher, see `GenServer.start_link/3`.
+    * `:statement_cache_size` - See `Exqlite.Connection.connect/1`. Defaults
+      to `32`, batched writes tend to repeat the same few statements.
+
+  The remaining options are passed to `Exqlite.Connection.connect/1`.
+  """
+  @spec start_link([start_opt()]) :: GenServer.on_start()
+  def start_link(opts) do
+    {server_opts, opts} = Keyword.split(opts, [:name, :timeout, :debug, :spawn_opt])
+    GenServer.start_link(__MODULE__, opts, server_opts)
+  end
+
+  @doc """
+  Queues `sql` with `params` for the next batch and waits until that batch is
+  committed.
+
+  Returns the result of this statement alone, or its error if it failed. When
+  the batch as a whole cannot commit every caller in it gets that error.
+  """
+  @spec query(GenServer.server(), iodata(), list() | map(), timeout()) ::
+          {:ok, Result.t()} | {:error, Exception.t()}
+  def query(batcher, sql, params \\ [], timeout \\ 5000) do
+    GenServer.call(batcher, {:query, IO.iodata_to_binary(sql), params}, timeout)
+  end
+
+  @impl true
+  def init(opts) do
+    Process.flag(:trap_exit, true)
+
+    {max_latency, opts} = Keyword.pop(opts, :max_latency, 2)
+    {max_batch, opts} = Keyword.pop(opts, :max_batch, 100)
+    opts = Keyword.put_new(opts, :statement_cache_size, 32)
+
+    case Connection.connect(opts) do
+      {:ok, conn} ->
+        state = %__MODULE__{
+          conn: conn,
+          opts: opts,
+          max_latency: max_latency,
+          max_batch: max_batch
+        }
+
+        {:ok, state}
+
+      {:error, reason} ->
+        {:stop, reason}
+    end
+  end
+
+  @impl true
+  def handle_call({:query, sql, params}, from, state) do
+    state = %{
+      state
+      | queue: [{from, sql, params} | state.queue],
+        queued: state.queued + 1
+    }
+
+    cond do
+      state.queued >= state.max_batch ->
+        state |> flush() |> noreply()
+
+      state.timer == nil ->
+        timer = Process.send_after(self(), :flush, state.max_latency)
+        {:noreply, %{state | timer: timer}}
+
+      true ->
+        {:noreply, state}
+    end
+  end
+
+  @impl true
+  def handle_info(:flush, state) do
+    %{state | timer: nil} |> flush() |> noreply()
+  end
+
+  def handle_info(_message, state), do: {:noreply, state}
+
+  @impl true
+  def terminate(reason, state) do
+    state =
+      case flush(state) do
+        {:ok, state} -> state
+        {:disconnect, _error, state} -> state
+      end
+
+    # There is no connection left when reconnecting failed.
+    if state.conn, do: Connection.disconnect(reason, state.conn)
+  end
+
+  defp noreply({:ok, state}), do: {:noreply, state}
+
+  defp noreply({:disconnect, error, state}) do
+    Connection.disconnect(error, state.conn)
+
+    case Connection.connect(state.opts) do
+      {:ok, conn} -> {:noreply, %{state | conn: conn}}
+      {:error, reason} -> {:stop, reason, %{state | conn: nil}}
+    end
+  end
+
+  # Returns `{:disconnect, error, state}` when the connection can no longer be
+  # used, after answering every caller in the batch with `error`.
+  defp flush(%__MODULE__{queued: 0} = state), do: {:ok, state}
+
+  defp flush(state) do
+    if state.timer, do: Process.cancel_timer(state.timer)
+
+    requests = Enum.reverse(state.queue)
+    state = %{state | queue: [], queued: 0, timer: nil}
+
+    case Connection.handle_begin([mode: :immediate], state.conn) do
+      {:ok, _result, conn} ->
+        case Enum.map_reduce(requests, conn, &run_request/2) do
+          {replies, {:disconnect, error, conn}} ->
+            reply_all(replies, {:error, error})
+            {:disconnect, error, %{state | conn: conn}}
+
+          {replies, conn} ->
+            commit(replies, %{state | conn: conn})
+        end
+
+      {:disconnect, error, conn} ->
+        reply_all(requests, {:error, error})
+        {:disconnect, error, %{state | conn: conn}}
+
+      {_status, error, conn} ->
+        reply_all(requests, {:error, error})
+        {:ok, %{state | conn: conn}}
+    end
+  end
+
+  # Once the connection has to be disconnected the rest of the batch is not
+  # run, the accumulator carries the disconnect instead of the connection.
+  defp run_request({from, _sql, _params}, {:disconnect, error, _conn} = disconnect) do
+    {{from, {:error, error}}, disconnect}
+  end
+
+  defp run_request({from, _sql, _params}, %{transaction_status: :idle} = conn) do
+    {{from, {:error, aborted_error()}}, conn}
+  end
+
+  defp run_request({from, sql, params}, conn) do
+    query = Query.build(statement: sql)
+
+    with {:ok, _result, conn} <- Connection.handle_begin([mode: :savepoint], conn),
+         {:ok, query, result, conn} <-
+           Connection.handle_execute(query, params, [], conn),
+         # Releases the statement unless the statement cache holds it.
+         {:ok, nil, conn} <- Connection.handle_close(query, [], conn),
+         {:ok, _result, conn} <- Connection.handle_commit([mode: :savepoint], conn) do
+      {{from, {:ok, result}}, conn}
+    else
+      {:disconnect, error, conn} ->
+        {{from, {:error, error}}, {:disconnect, error, conn}}
+
+      {_status, error, conn} ->
+        {{from, {:error, error}}, rollback_savepoint(conn)}
+    end
+  end
+
+  # Some errors (SQLITE_FULL, SQLITE_IOERR, SQLITE_NOMEM, ...) make SQLite roll
+  # back the whole transaction on its own, in which case there is no savepoint
+  # left to roll back to and the rest of the batch has to fail.
+  defp rollback_savepoint(conn) do
+    with {:ok, :transaction} <- Sqlite3.transaction_status(conn.db),
+         {:ok, _result, conn} <- Connection.handle_rollback([mode: :savepoint], conn) do
+      conn
+    else
+      {:ok, :idle} -> %{conn | transaction_status: :idle}
+      {:error, _reason} -> conn
+      {:disconnect, _error, _conn} = disconnect -> disconnect
+      {_status, _error, conn} -> conn
+    end
+  end
+
+  defp commit(replies, %{conn: %{transaction_status: :idle}} = state) do
+    Enum.each(replies, fn
+      {from, {:ok, _result}} -> GenServer.reply(from, {:error, aborted_error()})
+      {from, error} -> GenServer.reply(from, error)
+    end)
+
+    {:ok, state}
+  end
+
+  defp commit(replies, state) do
+    case Connection.handle_commit([], state.conn) do
+      {:ok, _result, conn} ->
+        Enum.each(replies, fn {from, reply} -> GenServer.reply(from, reply) end)
+        {:ok, %{state | conn: conn}}
+
+      {:disconnect, error, conn} ->
+        reply_all(replies, {:error, error})
+        {:disconnect, error, %{state | conn: conn}}
+
+      {_status, error, conn} ->
+        reply_all(replies, {:error, error})
+
+        case Connection.handle_rollback([], conn) do
+          {:ok, _result, conn} -> {:ok, %{state | conn: conn}}
+          {:disconnect, error, conn} -> {:disconnect, error, %{state | conn: conn}}
+          {_status, _error, conn} -> {:ok, %{state | conn: conn}}
+        end
+    end
+  end
+
+  defp reply_all(requests, reply) do
+    Enum.each(requests, fn request -> GenServer.reply(elem(request, 0), reply) end)
+  end
+
+  defp aborted_error do
+    %Error{message: "batch was rolled back by an earlier statement in the batch"}
+  end
+end
@@ -47,6 +47,7 @@ defmodule Exqlite.MixProject do
   defp deps do
     [
       {:db_connection, "~> 2.1"},
+      {:telemetry, "~> 0.4 or ~> 1.0"},
       {:ex_sqlean, "~> 0.8.5", only: [:dev, :test]},
       {:elixir_make, "~> 0.8", runtime: false},
       {:cc_precompiler, "~> 0.1", runtime: false},
@@ -60,7 +61,8 @@ defmodule Exqlite.MixProject do
 
   defp aliases do
     [
-      lint: ["format --check-formatted", "credo --all", "dialyzer"]
+      lint: ["format --check-formatted", "credo --all", "dialyzer"],
+      bench: ["run bench/hot_paths.exs"]
     ]
   end
 
@@ -630,4 +630,140 @@ defmodule Exqlite.CancellationTest do
       end)
     end
   end
+
+  # -- Query deadlines ---------------------------------------------------------
+
+  describe "query_timeout" do
+    test "interrupts a long-running SELECT" do
+      with_db(fn db ->
+        {:ok, stmt} = Sqlite3.prepare(db, @long_running_select)
+
+        {elapsed_us, result} =
+          :timer.tc(fn -> Sqlite3.multi_step(db, stmt, 50, query_timeout: 200) end)
+
+        assert {:error, "query deadline exceeded"} = result
+        assert div(elapsed_us, 1000) < 2_000
+      end)
+    end
+
+    test "is cleared once the call returns" do
+      with_db(fn db ->
+        assert {:error, "query deadline exceeded"} =
+                 Sqlite3.execute(db, @long_running_select, query_timeout: 0)
+
+        {:ok, stmt} = Sqlite3.prepare(db, "SELECT 1")
+        Process.sleep(10)
+        assert {:ok, [[1]]} = Sqlite3.fetch_all(db, stmt)
+      end)
+    end
+
+    test "stops waiting in the busy handler" do
+      with_file_db(fn path ->
+        {:ok, db1} = Sqlite3.open(path)
+        {:ok, db2} = Sqlite3.open(path)
+
+        :ok = Sqlite3.execute(db1, "PRAGMA journal_mode=WAL")
+        :ok = Sqlite3.set_busy_timeout(db2, 10_000)
+        :ok = Sqlite3.execute(db1, "BEGIN IMMEDIATE")
+
+        {elapsed_us, result} =
+          :timer.tc(fn ->
+            Sqlite3.execute(db2, "BEGIN IMMEDIATE", query_timeout: 100)
+          end)
+
+        assert {:error, "database is locked"} = result
+        assert div(elapsed_us, 1000) < 1_000
+
+        Sqlite3.execute(db1, "ROLLBACK")
+        Sqlite3.close(db1)
+        Sqlite3.close(db2)
+      end)
+    end
+
+    test "set_deadline/2 applies to every call until cleared" do
+      with_db(fn db ->
+        deadline = System.monotonic_time(:nanosecond)
+        :ok = Sqlite3.set_deadline(db, deadline)
+        assert {:error, "interrupted"} = Sqlite3.execute(db, @long_running_select)
+
+        :ok = Sqlite3.set_deadline(db, :infinity)
+        assert :ok = Sqlite3.execute(db, "SELECT 1")
+      end)
+    end
+
+    test "does not interrupt another process sharing the connection" do
+      with_db(fn db ->
+        sql = """
+        WITH RECURSIVE r(i) AS (VALUES(0) UNION ALL SELECT i+1 FROM r LIMIT 200000)
+        SELECT count(*) FROM r
+        """
+
+        timed_out =
+          Task.async(fn ->
+            for _ <- 1..20 do
+              Sqlite3.execute(db, @long_running_select, query_timeout: 5)
+            end
+          end)
+
+        for _ <- 1..20 do
+          {:ok, stmt} = Sqlite3.prepare(db, sql)
+          assert {:ok, [[200_000]]} = Sqlite3.fetch_all(db, stmt)
+          :ok = Sqlite3.release(db, stmt)
+        end
+
+        assert Enum.all?(Task.await(timed_out, 10_000), fn result ->
+                 result == {:error, "query deadline exceeded"}
+               end)
+      end)
+    end
+
+    test "leaves the deadline set with set_deadline/2 in place" do
+      with_db(fn db ->
+        :ok = Sqlite3.set_deadline(db, System.monotonic_time(:nanosecond))
+        assert :ok = Sqlite3.execute(db, "SELECT 1", query_timeout: 1_000)
+        assert {:error, "interrupted"} = Sqlite3.execute(db, @long_running_select)
+      end)
+    end
+
+    test "applies to Exqlite.Connection queries" do
+      {:ok, state} =
+        Exqlite.Connection.connect(database: ":memory:", query_timeout: 100)
+
+      query = %Exqlite.Query{statement: @long_running_select}
+
+      assert {:error, %Exqlite.Error{message: "query deadline exceeded"}, state} =
+               Exqlite.Connection.handle_execute(query, [], [], state)
+
+      assert {:ok, _query, %Exqlite.Result{rows: [[1]]}, _state} =
+               Exqlite.Connection.handle_execute(
+                 %Exqlite.Query{statement: "SELECT 1"},
+                 [],
+                 [query_timeout: :infinity],
+                 state
+               )
+    end
+
+    test "leaves a deadline set on the Exqlite.Connection handle in place" do
+      {:ok, state} =
+        Exqlite.Connection.connect(database: ":memory:", query_timeout: 1_000)
+
+      :ok = Sqlite3.set_deadline(state.db, System.monotonic_time(:nanosecond))
+
+      assert {:ok, _query, %Exqlite.Result{rows: [[1]]}, state} =
+               Exqlite.Connection.handle_execute(
+                 %Exqlite.Query{statement: "SELECT 1"},
+                 [],
+                 [],
+                 state
+               )
+
+      assert {:error, %Exqlite.Error{message: "interrupted"}, _state} =
+               Exqlite.Connection.handle_execute(
+                 %Exqlite.Query{statement: @long_running_select},
+                 [],
+                 [query_timeout: :infinity],
+                 state
+               )
+    end
+  end
 end
@@ -4,6 +4,7 @@ defmodule Exqlite.ConnectionTest do
   alias Exqlite.Connection
   alias Exqlite.Query
   alias Exqlite.Sqlite3
+  alias Exqlite.StatementCache
 
   describe ".connect/1" do
     test "returns error when path is missing from options" do
@@ -328,6 +329,126 @@ defmodule Exqlite.ConnectionTest do
     end
   end
 
+  describe "async: true" do
+    test "runs queries on the connection's worker" do
+      {:ok, conn} = Connection.connect(database: :memory, async: true)
+      assert conn.async
+
+      {:ok, _query, _result, conn} =
+        %Query{statement: "create table users (id integer primary key, name text)"}
+        |> Connection.handle_execute([], [], conn)
+
+      {:ok, _result, conn} = Connection.handle_begin([], conn)
+
+      {:ok, _query, _result, conn} =
+        %Query{statement: "insert into users (name) values (?), (?)"}
+        |> Connection.handle_execute(["Jim", "Bob"], [], conn)
+
+      {:ok, _result, conn} = Connection.handle_commit([], conn)
+
+      {:ok, _query, result, conn} =
+        %Query{statement: "select name from users order by id"}
+        |> Connection.handle_execute([], [], conn)
+
+      assert result.rows == [["Jim"], ["Bob"]]
+
+      Connection.disconnect(nil, conn)
+    end
+  end
+
+  describe "query_stats: true" do
+    test "emits the phases of every execute" do
+      {:ok, conn} = Connection.connect(database: :memory, query_stats: true)
+      test_pid = self()
+      handler_id = {__MODULE__, :query_stats}
+
+      :telemetry.attach(
+        handler_id,
+        [:exqlite, :query],
+        fn _event, measurements, metadata, _config ->
+          send(test_pid, {:query, measurements, metadata})
+        end,
+        nil
+      )
+
+      try do
+        {:ok, _query, _result, conn} =
+          %Query{statement: "create table users (id integer primary key, name text)"}
+          |> Connection.handle_execute([], [], conn)
+
+        assert_receive {:query, _measurements, %{call: :execute, status: :ok}}
+
+        {:ok, _query, _result, conn} =
+          %Query{statement: "insert into users (name) values (?), (?)"}
+          |> Connection.handle_execute(["Jim", "Bob"], [], conn)
+
+        assert_receive {:query, %{bind_time: bind_time}, _metadata}
+        assert bind_time > 0
+
+        query = %Query{statement: "select name from users"}
+        {:ok, _query, _result, conn} = Connection.handle_execute(query, [], [], conn)
+
+        assert_receive {:query, measurements, %{query: ^query, status: :ok}}
+        assert measurements.rows == 2
+        assert measurements.bytes == 6
+        assert measurements.prepare_time > 0
+        assert measurements.step_time > 0
+
+        Connection.disconnect(nil, conn)
+      after
+        :telemetry.detach(handler_id)
+      end
+    end
+
+    test "emits nothing by default" do
+      {:ok, conn} = Connection.connect(database: :memory)
+      refute conn.query_stats
+    end
+  end
+
+  describe "stmt_status: true" do
+    test "emits the statement counters of every execute" do
+      {:ok, conn} = Connection.connect(database: :memory, stmt_status: true)
+      test_pid = self()
+      handler_id = {__MODULE__, :stmt_status}
+
+      :telemetry.attach(
+        handler_id,
+        [:exqlite, :query],
+        fn _event, measurements, _metadata, _config ->
+          send(test_pid, {:query, measurements})
+        end,
+        nil
+      )
+
+      try do
+        {:ok, _query, _result, conn} =
+          %Query{statement: "create table users (id integer primary key, name text)"}
+          |> Connection.handle_execute([], [], conn)
+
+        assert_receive {:query, _measurements}
+
+        {:ok, _query, _result, conn} =
+          %Query{statement: "insert into users (name) values (?), (?)"}
+          |> Connection.handle_execute(["Jim", "Bob"], [], conn)
+
+        assert_receive {:query, _measurements}
+
+        query = %Query{statement: "select * from users where name = ?"}
+        {:ok, _query, _result, conn} =
+          Connection.handle_execute(query, ["Jim"], [], conn)
+
+        assert_receive {:query, measurements}
+        assert measurements.fullscan_step > 0
+        refute Map.has_key?(measurements, :step_time)
+
+        Connection.disconnect(nil, conn)
+      after
+        :telemetry.detach(handler_id)
+      end
+    end
+  end
+
   describe ".handle_prepare/3" do
     test "returns a prepared query" do
       {:ok, conn} = Connection.connect(database: :memory)
@@ -400,4 +521,79 @@ defmodule Exqlite.ConnectionTest do
       assert {:ok, nil, conn} == Connection.handle_close(query, [], conn)
     end
   end
+
+  describe "statement cache" do
+    test "reuses prepared statements for the same sql" do
+      {:ok, conn} = Connection.connect(database: :memory, statement_cache_size: 2)
+
+      query = %Query{statement: "select ?"}
+
+      {:ok, %Query{ref: ref}, %{rows: [[1]]}, conn} =
+        Connection.handle_execute(query, [1], [], conn)
+
+      {:ok, %Query{ref: ^ref}, %{rows: [[2]]}, conn} =
+        Connection.handle_execute(query, [2], [], conn)
+
+      # Closing a cached query must not release the shared statement
+      {:ok, nil, conn} = Connection.handle_close(%{query | ref: ref}, [], conn)
+
+      assert {:ok, _query, %{rows: [[3]]}, _conn} =
+               Connection.handle_execute(query, [3], [], conn)
+    end
+
+    test "evicts the least recently used statement" do
+      {:ok, conn} = Connection.connect(database: :memory, statement_cache_size: 2)
+
+      {:ok, %Query{ref: ref1}, _, conn} =
+        Connection.handle_execute(%Query{statement: "select 1"}, [], [], conn)
+
+      {:ok, _query, _, conn} =
+        Connection.handle_execute(%Query{statement: "select 2"}, [], [], conn)
+
+      {:ok, _query, _, conn} =
+        Connection.handle_execute(%Query{statement: "select 1"}, [], [], conn)
+
+      {:ok, _query, _, conn} =
+        Connection.handle_execute(%Query{statement: "select 3"}, [], [], conn)
+
+      assert {:ok, ^ref1, _cache} =
+               StatementCache.fetch(conn.statement_cache, "select 1")
+
+      assert :error = StatementCache.fetch(conn.statement_cache, "select 2")
+    end
+
+    test "is disabled by default" do
+      {:ok, conn} = Connection.connect(database: :memory)
+
+      assert conn.statement_cache == nil
+    end
+
+    test "sees schema changes while stmt_status resets the counters" do
+      {:ok, conn} =
+        Connection.connect(
+          database: :memory,
+          statement_cache_size: 2,
+          stmt_status: true
+        )
+
+      {:ok, _query, _result, conn} =
+        %Query{statement: "create table t (a integer)"}
+        |> Connection.handle_execute([], [], conn)
+
+      query = %Query{statement: "select * from t"}
+
+      {:ok, _query, %{columns: ["a"]}, conn} =
+        Connection.handle_execute(query, [], [], conn)
+
+      {:ok, _query, _result, conn} =
+        %Query{statement: "alter table t add column b text"}
+        |> Connection.handle_execute([], [], conn)
+
+      {:ok, _query, %{columns: ["a", "b"]}, conn} =
+        Connection.handle_execute(query, [], [], conn)
+
+      assert {:ok, _query, %{columns: ["a", "b"]}, _conn} =
+               Connection.handle_execute(query, [], [], conn)
+    end
+  end
 end
@@ -289,4 +289,24 @@ defmodule Exqlite.IntegrationTest do
     assert result.columns == ["id", "stuff"]
     assert result.rows == [[1, "hello"]]
   end
+
+  test "streams with a prefetching cursor" do
+    {:ok, conn} = DBConnection.start_link(Connection, database: :memory)
+
+    query = %Query{
+      statement: """
+      with recursive n(x) as (select 1 union all select x + 1 from n where x < 1000)
+      select x from n
+      """
+    }
+
+    rows =
+      DBConnection.run(conn, fn conn ->
+        conn
+        |> DBConnection.stream(query, [], chunk_size: 64, prefetch: true)
+        |> Enum.flat_map(& &1.rows)
+      end)
+
+    assert rows == Enum.map(1..1000, &[&1])
+  end
 end
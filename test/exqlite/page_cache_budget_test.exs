@@ -0,0 +1,53 @@
+defmodule Exqlite.PageCacheBudgetTest do
+  # The budget is global to the VM, so nothing else may open databases while
+  # these tests change it.
+  use ExUnit.Case, async: false
+
+  alias Exqlite.Sqlite3
+
+  setup do
+    path = Temp.path!()
+
+    on_exit(fn ->
+      Sqlite3.set_page_cache_budget(0)
+      File.rm(path)
+      File.rm(path <> "-wal")
+      File.rm(path <> "-shm")
+    end)
+
+    {:ok, path: path}
+  end
+
+  test "caps the page cache of a connection", %{path: path} do
+    :ok = Sqlite3.set_page_cache_budget(64 * 1024)
+
+    {:ok, conn} = Sqlite3.open(path)
+    :ok = Sqlite3.execute(conn, "create table t (i integer, pad text)")
+
+    :ok =
+      Sqlite3.execute(conn, """
+      with recursive r(i) as (values(1) union all select i + 1 from r limit 5000)
+      insert into t select i, zeroblob(200) from r
+      """)
+
+    {:ok, statement} = Sqlite3.prepare(conn, "select count(*), sum(length(pad)) from t")
+    assert {:ok, [[5000, 1_000_000]]} = Sqlite3.fetch_all(conn, statement)
+
+    {:ok, %{cache_used: budgeted}} = Sqlite3.db_status(conn)
+    assert budgeted < 128 * 1024
+
+    # Without a budget the cache grows back to its cache_size and holds the
+    # whole table.
+    :ok = Sqlite3.set_page_cache_budget(0)
+    assert {:ok, [[5000, 1_000_000]]} = Sqlite3.fetch_all(conn, statement)
+
+    {:ok, %{cache_used: unbudgeted}} = Sqlite3.db_status(conn)
+    assert unbudgeted > 512 * 1024
+
+    :ok = Sqlite3.close(conn)
+  end
+
+  test "rejects a negative budget" do
+    assert_raise ErlangError, fn -> Sqlite3.set_page_cache_budget(-1) end
+  end
+end
@@ -369,6 +369,50 @@ defmodule Exqlite.Sqlite3Test do
         Sqlite3.bind(statement, %{":name" => "Alice", ":age" => 30, ":extra" => "value"})
       end
     end
+
+    test "raises an error on unknown named parameters" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select :name")
+
+      assert_raise ArgumentError, "unknown named parameter: \":other\"", fn ->
+        Sqlite3.bind(statement, %{":other" => "Alice"})
+      end
+    end
+
+    test "binds iodata, atoms and blobs" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select ?, ?, ?, ?, ?, ?")
+
+      :ok =
+        Sqlite3.bind(statement, [
+          ["hello", ?\s, "world"],
+          :café,
+          true,
+          :undefined,
+          {:blob, [<<0>>, <<1, 2>>]},
+          -9_223_372_036_854_775_808
+        ])
+
+      assert {:row, row} = Sqlite3.step(conn, statement)
+
+      assert row == [
+               "hello world",
+               "café",
+               "true",
+               nil,
+               <<0, 1, 2>>,
+               -9_223_372_036_854_775_808
+             ]
+    end
+
+    test "raises an error for unsupported named parameter values" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select :a, :b")
+
+      assert_raise ArgumentError, "unsupported type: %{}", fn ->
+        Sqlite3.bind(statement, %{":a" => 1, ":b" => %{}})
+      end
+    end
   end
 
   describe ".bind_text/3" do
@@ -565,6 +609,60 @@ defmodule Exqlite.Sqlite3Test do
         end
       )
     end
+
+    test "reflects schema changes after the statement is recompiled" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.execute(conn, "create table test (id integer primary key)")
+      {:ok, statement} = Sqlite3.prepare(conn, "select * from test")
+      assert {:ok, ["id"]} = Sqlite3.columns(conn, statement)
+
+      :ok = Sqlite3.execute(conn, "alter table test add column stuff text")
+      :done = Sqlite3.step(conn, statement)
+
+      assert {:ok, ["id", "stuff"]} = Sqlite3.columns(conn, statement)
+      assert {:ok, ["integer", "text"]} = Sqlite3.column_types(conn, statement)
+    end
+
+    test "returns an error for a released statement" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select 1")
+      :ok = Sqlite3.release(conn, statement)
+
+      assert {:error, :invalid_statement} = Sqlite3.columns(conn, statement)
+      assert {:error, :invalid_statement} = Sqlite3.column_types(conn, statement)
+    end
+
+    test "waits for a query running on the connection" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select 1 as one")
+
+      query =
+        Task.async(fn ->
+          Sqlite3.execute(conn, """
+          with recursive r(i) as (values(0) union all select i+1 from r limit 2000000)
+          select count(*) from r
+          """)
+        end)
+
+      for _ <- 1..100 do
+        assert {:ok, ["one"]} = Sqlite3.columns(conn, statement)
+      end
+
+      assert :ok = Task.await(query)
+    end
+  end
+
+  describe ".statement_readonly/2" do
+    test "distinguishes reads from writes" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.execute(conn, "create table test (id integer primary key)")
+
+      {:ok, select} = Sqlite3.prepare(conn, "select * from test")
+      {:ok, insert} = Sqlite3.prepare(conn, "insert into test default values")
+
+      assert {:ok, true} = Sqlite3.statement_readonly(conn, select)
+      assert {:ok, false} = Sqlite3.statement_readonly(conn, insert)
+    end
   end
 
   describe ".step/2" do
@@ -669,6 +767,240 @@ defmodule Exqlite.Sqlite3Test do
       assert rows == [[5, "five"], [6, "six"]]
     end
 
+    test "returns rows as tuples" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      {:ok, statement} =
+        Sqlite3.prepare(conn, "select 1, 'one', null union all select 2, 'two', 2.5")
+
+      assert {:row, {1, "one", nil}} = Sqlite3.step(conn, statement, row_format: :tuple)
+      assert {:row, [2, "two", 2.5]} = Sqlite3.step(conn, statement)
+      assert :done = Sqlite3.step(conn, statement, row_format: :tuple)
+
+      assert {:done, [{1, "one", nil}, {2, "two", 2.5}]} =
+               Sqlite3.multi_step(conn, statement, 10, row_format: :tuple)
+
+      assert {:ok, [{1, "one", nil}, {2, "two", 2.5}]} =
+               Sqlite3.fetch_all(conn, statement, 1, row_format: :tuple)
+    end
+
+    test "prefetches the next chunk" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      {:ok, statement} =
+        Sqlite3.prepare(conn, """
+        with recursive n(x) as (select 1 union all select x + 1 from n where x < 250)
+        select x from n
+        """)
+
+      chunks =
+        Stream.repeatedly(fn ->
+          Sqlite3.multi_step(conn, statement, 100, prefetch: true)
+        end)
+        |> Enum.take(3)
+
+      assert [{:rows, first}, {:rows, second}, {:done, third}] = chunks
+      assert first ++ second ++ third == Enum.map(1..250, &[&1])
+    end
+
+    test "discards a prefetched chunk on reset and release" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select 1 union all select 2")
+
+      assert {:rows, [[1]]} = Sqlite3.multi_step(conn, statement, 1, prefetch: true)
+      :ok = Sqlite3.reset(statement)
+      assert {:rows, [[1]]} = Sqlite3.multi_step(conn, statement, 1, prefetch: true)
+
+      :ok = Sqlite3.release(conn, statement)
+
+      assert {:error, :invalid_statement} =
+               Sqlite3.multi_step(conn, statement, 1, prefetch: true)
+    end
+
+    test "discards a prefetched chunk when the statement is rebound" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select ?1 union all select ?1 + 1")
+
+      :ok = Sqlite3.bind(statement, [10])
+      assert {:rows, [[10]]} = Sqlite3.multi_step(conn, statement, 1, prefetch: true)
+
+      :ok = Sqlite3.bind(statement, [20])
+      assert {:rows, [[20]]} = Sqlite3.multi_step(conn, statement, 1, prefetch: true)
+
+      :ok = Sqlite3.bind(statement, [30])
+      assert {:row, [30]} = Sqlite3.step(conn, statement)
+      assert {:rows, [[31]]} = Sqlite3.multi_step(conn, statement, 1, prefetch: true)
+
+      :ok = Sqlite3.bind(statement, [40])
+      assert {:ok, [[40], [41]]} = Sqlite3.fetch_all(conn, statement)
+    end
+
+    test "discards a prefetched chunk stepped with other options" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      {:ok, statement} =
+        Sqlite3.prepare(conn, """
+        with recursive n(x) as (select 1 union all select x + 1 from n where x < 20)
+        select x from n
+        """)
+
+      assert {:rows, [[1]]} = Sqlite3.multi_step(conn, statement, 1, prefetch: true)
+
+      # Whether the rows read ahead are skipped depends on how far the thread
+      # got, but the chunk comes back the way this call asked for it.
+      assert {:rows, [row]} =
+               Sqlite3.multi_step(conn, statement, 1, prefetch: true, row_format: :tuple)
+
+      assert is_tuple(row)
+
+      assert {:rows, rows} = Sqlite3.multi_step(conn, statement, 3, prefetch: true)
+      assert length(rows) == 3
+    end
+
+    test "applies decode hints" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      {:ok, statement} =
+        Sqlite3.prepare(conn, """
+        select 0, '2024-01-02 03:04:05.123', '2024-01-02T03:04:05', '1999-12-31',
+          '{"a": [1, 2.5, "\\u00e9\\ud83d\\ude00"], "b": {"c": null}, "d": true}',
+          'done', 'raw', 7
+        union all
+        select 3, 'not a date', null, '2023-02-29', '{"a":', 'no_such_atom_ever', 1, 'x'
+        """)
+
+      hints = [:boolean, :naive_datetime, :naive_datetime, :date, :json, :atom_from_text]
+
+      assert {:ok, [first, second]} = Sqlite3.fetch_all(conn, statement, 10, decode: hints)
+
+      assert first == [
+               false,
+               ~N[2024-01-02 03:04:05.123],
+               ~N[2024-01-02 03:04:05],
+               ~D[1999-12-31],
+               %{"a" => [1, 2.5, "é😀"], "b" => %{"c" => nil}, "d" => true},
+               :done,
+               "raw",
+               7
+             ]
+
+      assert second == [
+               true,
+               "not a date",
+               nil,
+               "2023-02-29",
+               ~s({"a":),
+               "no_such_atom_ever",
+               1,
+               "x"
+             ]
+    end
+
+    test "decodes JSON numbers at the edges of their range" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      {:ok, statement} =
+        Sqlite3.prepare(conn, """
+        select '[9223372036854775807, 12345678901234567890, -1e-310, 0.5]', '[1e400]'
+        """)
+
+      assert {:ok, [[numbers, "[1e400]"]]} =
+               Sqlite3.fetch_all(conn, statement, 10, decode: [:json, :json])
+
+      assert [9_223_372_036_854_775_807, big, tiny, 0.5] = numbers
+      assert big == 12_345_678_901_234_567_890.0
+      assert tiny < 0 and tiny > -1.0e-300
+    end
+
+    test "leaves deeply nested JSON and zoned datetimes as text" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      deep = String.duplicate("[", 300) <> String.duplicate("]", 300)
+      shallow = String.duplicate("[", 200) <> String.duplicate("]", 200)
+
+      {:ok, statement} = Sqlite3.prepare(conn, "select ?1, ?2, '2024-01-02 03:04:05Z'")
+      :ok = Sqlite3.bind(statement, [deep, shallow])
+
+      hints = [:json, :json, :naive_datetime]
+
+      assert {:ok, [[^deep, nested, "2024-01-02 03:04:05Z"]]} =
+               Sqlite3.fetch_all(conn, statement, 10, decode: hints)
+
+      assert is_list(nested)
+    end
+
+    test "raises for an unknown decode hint" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select 1")
+
+      assert_raise ArgumentError, ~r/:decode/, fn ->
+        Sqlite3.multi_step(conn, statement, 10, decode: [:uuid])
+      end
+    end
+
+    test "raises for an unknown row format" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select 1")
+
+      assert_raise ArgumentError, ~r/:row_format/, fn ->
+        Sqlite3.multi_step(conn, statement, 10, row_format: :map)
+      end
+    end
+
+    test "returns small and large text and blob values intact" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok =
+        Sqlite3.execute(conn, "create table test (id integer primary key, t text, b blob)")
+
+      values =
+        for size <- [0, 1, 64, 65, 4096, 100_000] do
+          {String.duplicate("t", size), :binary.copy(<<0, 255>>, size)}
+        end
+
+      {:ok, insert} = Sqlite3.prepare(conn, "insert into test (t, b) values (?1, ?2)")
+
+      for {text, blob} <- values do
+        :ok = Sqlite3.bind(insert, [text, {:blob, blob}])
+        :done = Sqlite3.step(conn, insert)
+      end
+
+      expected = for {text, blob} <- values, do: [text, blob]
+
+      {:ok, statement} = Sqlite3.prepare(conn, "select t, b from test order by id")
+      assert {:done, ^expected} = Sqlite3.multi_step(conn, statement, 50)
+      assert {:ok, ^expected} = Sqlite3.fetch_all(conn, statement, 2)
+
+      for row <- expected do
+        assert {:row, ^row} = Sqlite3.step(conn, statement)
+      end
+    end
+
+    test "caps the memory a kept value keeps alive" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.execute(conn, "create table test (id integer primary key, t text)")
+
+      :ok =
+        Sqlite3.execute(conn, """
+        with recursive r(i) as (values(1) union all select i + 1 from r limit 1000)
+        insert into test (t) select printf('%.1000c', char(64 + i % 26)) from r
+        """)
+
+      :ok = Sqlite3.execute(conn, "insert into test (t) values (printf('%.300000c', 'z'))")
+
+      {:ok, statement} = Sqlite3.prepare(conn, "select t from test order by id")
+      assert {:ok, rows} = Sqlite3.fetch_all(conn, statement, 2_000)
+      assert length(rows) == 1001
+
+      {small, [[large]]} = Enum.split(rows, 1000)
+
+      for {[text], i} <- Enum.with_index(small, 1) do
+        assert text == String.duplicate(<<64 + rem(i, 26)>>, 1000)
+        assert :binary.referenced_byte_size(text) <= 256 * 1024
+      end
+
+      assert large == String.duplicate("z", 300_000)
+      assert :binary.referenced_byte_size(large) == 300_000
+    end
+
     test "raises exception when statement was prepared for another connection" do
       {:ok, connection_a} = Sqlite3.open(":memory:")
       {:ok, connection_b} = Sqlite3.open(":memory:")
@@ -715,6 +1047,177 @@ defmodule Exqlite.Sqlite3Test do
     end
   end
 
+  describe ".execute_many/4" do
+    setup do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      :ok =
+        Sqlite3.execute(conn, "create table test (id integer primary key, stuff text)")
+
+      {:ok, conn: conn}
+    end
+
+    test "inserts every row", %{conn: conn} do
+      {:ok, insert} = Sqlite3.prepare(conn, "insert into test (stuff) values (?1)")
+      rows = for i <- 1..10_000, do: ["row #{i}"]
+
+      assert {:ok, 10_000} = Sqlite3.execute_many(conn, insert, rows)
+
+      {:ok, select} = Sqlite3.prepare(conn, "select count(*), max(stuff) from test")
+      assert {:row, [10_000, "row 9999"]} = Sqlite3.step(conn, select)
+      assert {:ok, :idle} = Sqlite3.transaction_status(conn)
+    end
+
+    test "accepts named parameters and returns rowids", %{conn: conn} do
+      {:ok, insert} =
+        Sqlite3.prepare(conn, "insert into test (id, stuff) values (:id, :stuff)")
+
+      rows = [%{":id" => 10, ":stuff" => "a"}, %{":id" => 20, ":stuff" => "b"}]
+
+      assert {:ok, 2, [10, 20]} = Sqlite3.execute_many(conn, insert, rows, rowids: true)
+    end
+
+    test "rolls back when a row fails", %{conn: conn} do
+      {:ok, insert} = Sqlite3.prepare(conn, "insert into test (id) values (?1)")
+
+      assert {:error, "UNIQUE constraint failed: test.id"} =
+               Sqlite3.execute_many(conn, insert, [[1], [2], [1]])
+
+      assert_raise ArgumentError, "expected 1 arguments, got 2", fn ->
+        Sqlite3.execute_many(conn, insert, [[3], [4, 5]])
+      end
+
+      {:ok, select} = Sqlite3.prepare(conn, "select count(*) from test")
+      assert {:row, [0]} = Sqlite3.step(conn, select)
+      assert {:ok, :idle} = Sqlite3.transaction_status(conn)
+    end
+
+    test "joins an open transaction", %{conn: conn} do
+      {:ok, insert} = Sqlite3.prepare(conn, "insert into test (id) values (?1)")
+
+      :ok = Sqlite3.execute(conn, "begin")
+      assert {:ok, 2} = Sqlite3.execute_many(conn, insert, [[1], [2]])
+      assert {:ok, :transaction} = Sqlite3.transaction_status(conn)
+      :ok = Sqlite3.execute(conn, "rollback")
+    end
+
+    test "counts no changes for statements that change nothing", %{conn: conn} do
+      :ok = Sqlite3.execute(conn, "insert into test (stuff) values ('a'), ('b')")
+      {:ok, select} = Sqlite3.prepare(conn, "select * from test where id = ?1")
+
+      assert {:ok, 0} = Sqlite3.execute_many(conn, select, [[1], [2]])
+    end
+  end
+
+  describe ".multi_step_columnar/3" do
+    test "packs each column into binaries" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      :ok =
+        Sqlite3.execute(conn, "create table test (i integer, f real, t text, b blob)")
+
+      :ok =
+        Sqlite3.execute(conn, """
+        insert into test values
+          (1, 1.5, 'one', x'00'),
+          (null, null, null, null),
+          (3, 3.5, 'three', x'0102')
+        """)
+
+      {:ok, statement} = Sqlite3.prepare(conn, "select i, f, t, b from test")
+
+      assert {:done, 3, [ints, floats, texts, blobs]} =
+               Sqlite3.multi_step_columnar(conn, statement, 10)
+
+      assert {:integer, values, <<0b010>>} = ints
+      assert for(<<v::signed-native-64 <- values>>, do: v) == [1, 0, 3]
+
+      assert {:float, values, <<0b010>>} = floats
+      assert for(<<v::float-native-64 <- values>>, do: v) == [1.5, 0.0, 3.5]
+
+      assert {:text, offsets, "onethree", <<0b010>>} = texts
+      assert for(<<o::native-64 <- offsets>>, do: o) == [0, 3, 3, 8]
+
+      assert {:blob, offsets, <<0, 1, 2>>, <<0b010>>} = blobs
+      assert for(<<o::native-64 <- offsets>>, do: o) == [0, 1, 1, 3]
+    end
+
+    test "falls back to a list for columns with mixed storage classes" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      {:ok, statement} =
+        Sqlite3.prepare(conn, "select 1 union all select null union all select 'two'")
+
+      assert {:done, 3, [{:mixed, [1, nil, "two"]}]} =
+               Sqlite3.multi_step_columnar(conn, statement, 10)
+    end
+
+    test "returns the rows in chunks" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      {:ok, statement} =
+        Sqlite3.prepare(conn, """
+        with recursive n(x) as (select 1 union all select x + 1 from n where x < 5)
+        select x, null from n
+        """)
+
+      assert {:rows, 3, [{:integer, values, <<0>>}, {:null, <<0b111>>}]} =
+               Sqlite3.multi_step_columnar(conn, statement, 3)
+
+      assert for(<<v::signed-native-64 <- values>>, do: v) == [1, 2, 3]
+
+      assert {:done, 2, [{:integer, values, <<0>>}, {:null, <<0b11>>}]} =
+               Sqlite3.multi_step_columnar(conn, statement, 3)
+
+      assert for(<<v::signed-native-64 <- values>>, do: v) == [4, 5]
+    end
+  end
+
+  describe ".fetch_all/3" do
+    test "returns every row in order" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      {:ok, statement} =
+        Sqlite3.prepare(conn, """
+        with recursive n(x) as (select 1 union all select x + 1 from n where x < 100000)
+        select x from n
+        """)
+
+      assert {:ok, rows} = Sqlite3.fetch_all(conn, statement, 7)
+      assert length(rows) == 100_000
+      assert rows == Enum.map(1..100_000, &[&1])
+    end
+
+    test "returns an error for an invalid chunk size" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select 1")
+
+      assert {:error, :invalid_chunk_size} = Sqlite3.fetch_all(conn, statement, 0)
+    end
+
+    test "returns sqlite errors" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select abs(-9223372036854775808)")
+
+      assert {:error, "integer overflow"} = Sqlite3.fetch_all(conn, statement)
+    end
+
+    test "raises exception when statement was prepared for another connection" do
+      {:ok, connection_a} = Sqlite3.open(":memory:")
+      {:ok, connection_b} = Sqlite3.open(":memory:")
+
+      {:ok, statement_b} = Sqlite3.prepare(connection_b, "select 'connection b'")
+
+      assert_raise(
+        ArgumentError,
+        "Statement was prepared for a different connection, which is illegal",
+        fn ->
+          Sqlite3.fetch_all(connection_a, statement_b)
+        end
+      )
+    end
+  end
+
   describe "working with prepared statements after close" do
     test "returns proper error" do
       {:ok, conn} = Sqlite3.open(":memory:")
@@ -1648,4 +2151,532 @@ defmodule Exqlite.Sqlite3Test do
       assert :ok = Sqlite3.cancel(conn)
     end
   end
+
+  describe ".start_worker/1" do
+    test "runs calls with async: true on the worker" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.start_worker(conn)
+      :ok = Sqlite3.start_worker(conn)
+
+      :ok = Sqlite3.execute(conn, "create table t (i integer)", async: true)
+      {:ok, insert} = Sqlite3.prepare(conn, "insert into t values (?)", async: true)
+
+      for i <- 1..5 do
+        :ok = Sqlite3.bind(insert, [i])
+        assert :done = Sqlite3.step(conn, insert, async: true)
+      end
+
+      {:ok, select} = Sqlite3.prepare(conn, "select i from t order by i", async: true)
+      assert {:row, {1}} = Sqlite3.step(conn, select, row_format: :tuple, async: true)
+      assert {:rows, [[2], [3]]} = Sqlite3.multi_step(conn, select, 2, async: true)
+      assert {:done, [[4], [5]]} = Sqlite3.multi_step(conn, select, 2, async: true)
+
+      :ok = Sqlite3.reset(select)
+
+      assert {:ok, [[1], [2], [3], [4], [5]]} =
+               Sqlite3.fetch_all(conn, select, 2, async: true)
+
+      assert {:error, "no such table: missing"} =
+               Sqlite3.prepare(conn, "select * from missing", async: true)
+
+      :ok = Sqlite3.close(conn)
+    end
+
+    test "async calls need a worker" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      assert {:error, :no_worker} = Sqlite3.execute(conn, "select 1", async: true)
+    end
+
+    test "close/1 stops the worker" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.start_worker(conn)
+      :ok = Sqlite3.close(conn)
+
+      assert {:error, :no_worker} = Sqlite3.execute(conn, "select 1", async: true)
+      assert {:error, :connection_closed} = Sqlite3.start_worker(conn)
+    end
+
+    test "does not keep a dropped connection alive" do
+      with_file_db(fn path ->
+        # The dropped connection holds an exclusive lock until it is closed.
+        Task.async(fn ->
+          {:ok, conn} = Sqlite3.open(path)
+          :ok = Sqlite3.start_worker(conn)
+          :ok = Sqlite3.execute(conn, "PRAGMA locking_mode = EXCLUSIVE", async: true)
+          :ok = Sqlite3.execute(conn, "create table t (i integer)", async: true)
+        end)
+        |> Task.await()
+
+        :erlang.garbage_collect()
+
+        {:ok, other} = Sqlite3.open(path)
+        :ok = Sqlite3.set_busy_timeout(other, 5_000)
+        assert :ok = Sqlite3.execute(other, "insert into t values (1)")
+        Sqlite3.close(other)
+      end)
+    end
+
+    test "rejects statements from another connection" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, other} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.start_worker(conn)
+      {:ok, statement} = Sqlite3.prepare(other, "select 1")
+
+      assert_raise ArgumentError, fn ->
+        Sqlite3.step(conn, statement, async: true)
+      end
+
+      :ok = Sqlite3.close(conn)
+    end
+  end
+
+  describe ".lock_stats/1" do
+    test "counts lock acquisitions" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, before} = Sqlite3.lock_stats(conn)
+
+      :ok = Sqlite3.execute(conn, "select 1")
+
+      {:ok, stats} = Sqlite3.lock_stats(conn)
+      assert stats.lock_acquisitions > before.lock_acquisitions
+      assert stats.lock_wait_ns >= stats.lock_max_wait_ns
+    end
+
+    test "counts busy handler sleeps and timeouts" do
+      with_file_db(fn path ->
+        {:ok, db1} = Sqlite3.open(path)
+        {:ok, db2} = Sqlite3.open(path)
+
+        :ok = Sqlite3.execute(db1, "PRAGMA journal_mode=WAL")
+        :ok = Sqlite3.execute(db1, "CREATE TABLE t (i INTEGER)")
+        :ok = Sqlite3.set_busy_timeout(db2, 30)
+
+        :ok = Sqlite3.execute(db1, "BEGIN IMMEDIATE")
+        assert {:error, _} = Sqlite3.execute(db2, "INSERT INTO t VALUES(1)")
+        :ok = Sqlite3.execute(db1, "ROLLBACK")
+
+        {:ok, stats} = Sqlite3.lock_stats(db2)
+        assert stats.busy_handler_calls > 0
+        assert stats.busy_sleep_ms > 0
+        assert stats.busy_timeouts == 1
+
+        Sqlite3.close(db1)
+        Sqlite3.close(db2)
+      end)
+    end
+  end
+
+  describe ".take_query_stats/1" do
+    test "times the phases of queries" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.set_query_stats(conn, true)
+      :ok = Sqlite3.execute(conn, "create table t (id integer, name text)")
+
+      {:ok, insert} = Sqlite3.prepare(conn, "insert into t values (?, ?)")
+      {:ok, 3} = Sqlite3.execute_many(conn, insert, [[1, "a"], [2, "bb"], [3, "ccc"]])
+      {:ok, _stats} = Sqlite3.take_query_stats(conn)
+
+      {:ok, select} = Sqlite3.prepare(conn, "select * from t where id > ?")
+      :ok = Sqlite3.bind(select, [0])
+      {:ok, rows} = Sqlite3.fetch_all(conn, select)
+      assert length(rows) == 3
+
+      {:ok, stats} = Sqlite3.take_query_stats(conn)
+      assert stats.prepare_ns > 0
+      assert stats.bind_ns > 0
+      assert stats.step_ns > 0
+      assert stats.decode_ns > 0
+      assert stats.rows_returned == 3
+      assert stats.bytes_returned == 6
+
+      assert {:ok, %{rows_returned: 0, step_ns: 0}} = Sqlite3.take_query_stats(conn)
+    end
+
+    test "times execute, execute_many and columnar reads" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.set_query_stats(conn, true)
+
+      :ok = Sqlite3.execute(conn, "create table t (id integer, name text)")
+      assert {:ok, %{step_ns: step_ns}} = Sqlite3.take_query_stats(conn)
+      assert step_ns > 0
+
+      {:ok, insert} = Sqlite3.prepare(conn, "insert into t values (?, ?)")
+      {:ok, _} = Sqlite3.take_query_stats(conn)
+      {:ok, 2} = Sqlite3.execute_many(conn, insert, [[1, "a"], [2, "bb"]])
+      assert {:ok, stats} = Sqlite3.take_query_stats(conn)
+      assert stats.bind_ns > 0
+      assert stats.step_ns > 0
+      assert stats.rows_returned == 0
+
+      {:ok, select} = Sqlite3.prepare(conn, "select id, name from t order by id")
+      {:ok, _} = Sqlite3.take_query_stats(conn)
+      {:done, 2, _columns} = Sqlite3.multi_step_columnar(conn, select, 10)
+      assert {:ok, stats} = Sqlite3.take_query_stats(conn)
+      assert stats.step_ns > 0
+      assert stats.decode_ns > 0
+      assert stats.rows_returned == 2
+      assert stats.bytes_returned == 3
+    end
+
+    test "credits a prefetched chunk to the call that returns it" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.execute(conn, "create table t (id integer)")
+      :ok = Sqlite3.execute(conn, "insert into t values (1), (2), (3), (4), (5)")
+      {:ok, select} = Sqlite3.prepare(conn, "select id from t order by id")
+      :ok = Sqlite3.set_query_stats(conn, true)
+
+      {:rows, [[1], [2]]} = Sqlite3.multi_step(conn, select, 2, prefetch: true)
+      assert {:ok, %{rows_returned: 2}} = Sqlite3.take_query_stats(conn)
+
+      {:rows, [[3], [4]]} = Sqlite3.multi_step(conn, select, 2, prefetch: true)
+      assert {:ok, %{rows_returned: 2}} = Sqlite3.take_query_stats(conn)
+    end
+
+    test "collects nothing unless enabled" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select 1")
+      {:row, [1]} = Sqlite3.step(conn, statement)
+
+      assert {:ok, %{prepare_ns: 0, rows_returned: 0}} = Sqlite3.take_query_stats(conn)
+
+      :ok = Sqlite3.set_query_stats(conn, true)
+      {:row, [1]} = Sqlite3.step(conn, statement)
+      :ok = Sqlite3.set_query_stats(conn, false)
+
+      assert {:ok, %{rows_returned: 0}} = Sqlite3.take_query_stats(conn)
+    end
+  end
+
+  describe "write lock arbiter" do
+    test "wakes a busy waiter as soon as the holder commits" do
+      with_file_db(fn path ->
+        {:ok, db1} = Sqlite3.open(path)
+        {:ok, db2} = Sqlite3.open(path)
+
+        :ok = Sqlite3.execute(db1, "PRAGMA journal_mode=WAL")
+        :ok = Sqlite3.execute(db1, "CREATE TABLE t (i INTEGER)")
+        :ok = Sqlite3.set_busy_timeout(db2, 10_000)
+
+        :ok = Sqlite3.execute(db1, "BEGIN IMMEDIATE")
+
+        task = Task.async(fn -> Sqlite3.execute(db2, "INSERT INTO t VALUES(2)") end)
+        Process.sleep(200)
+
+        :ok = Sqlite3.execute(db1, "COMMIT")
+        {elapsed_us, result} = :timer.tc(fn -> Task.await(task) end)
+
+        # Far below the busy timeout, without relying on scheduling latency.
+        assert :ok = result
+        assert div(elapsed_us, 1000) < 1_000
+
+        Sqlite3.close(db1)
+        Sqlite3.close(db2)
+      end)
+    end
+
+    test "grants the write lock in the order waiters arrived" do
+      with_file_db(fn path ->
+        {:ok, holder} = Sqlite3.open(path)
+        :ok = Sqlite3.execute(holder, "PRAGMA journal_mode=WAL")
+        :ok = Sqlite3.execute(holder, "CREATE TABLE t (i INTEGER)")
+        :ok = Sqlite3.execute(holder, "BEGIN IMMEDIATE")
+
+        tasks =
+          for i <- 1..3 do
+            {:ok, db} = Sqlite3.open(path)
+            :ok = Sqlite3.set_busy_timeout(db, 10_000)
+
+            task =
+              Task.async(fn ->
+                :ok = Sqlite3.execute(db, "BEGIN IMMEDIATE")
+                Process.sleep(20)
+                :ok = Sqlite3.execute(db, "INSERT INTO t VALUES(#{i})")
+                :ok = Sqlite3.execute(db, "COMMIT")
+                Sqlite3.close(db)
+              end)
+
+            # Let each waiter reach the busy handler before the next one.
+            Process.sleep(100)
+            task
+          end
+
+        :ok = Sqlite3.execute(holder, "COMMIT")
+        Task.await_many(tasks, 10_000)
+
+        {:ok, statement} = Sqlite3.prepare(holder, "SELECT i FROM t ORDER BY rowid")
+        assert {:ok, [[1], [2], [3]]} = Sqlite3.fetch_all(holder, statement)
+
+        Sqlite3.close(holder)
+      end)
+    end
+
+    test "readers blocked by a committing writer do not stall it" do
+      with_file_db(fn path ->
+        {:ok, reader} = Sqlite3.open(path)
+        {:ok, writer} = Sqlite3.open(path)
+        {:ok, blocked} = Sqlite3.open(path)
+
+        :ok = Sqlite3.execute(writer, "CREATE TABLE t (i INTEGER)")
+        :ok = Sqlite3.set_busy_timeout(writer, 5_000)
+        :ok = Sqlite3.set_busy_timeout(blocked, 5_000)
+
+        # In rollback journal mode the COMMIT waits for the reader's SHARED
+        # lock while holding PENDING, which blocks new readers in turn.
+        :ok = Sqlite3.execute(reader, "BEGIN")
+        {:ok, select} = Sqlite3.prepare(reader, "SELECT count(*) FROM t")
+        {:row, [0]} = Sqlite3.step(reader, select)
+
+        :ok = Sqlite3.execute(writer, "BEGIN IMMEDIATE")
+        :ok = Sqlite3.execute(writer, "INSERT INTO t VALUES(1)")
+        commit = Task.async(fn -> Sqlite3.execute(writer, "COMMIT") end)
+        Process.sleep(100)
+
+        read = Task.async(fn -> Sqlite3.execute(blocked, "SELECT * FROM t") end)
+        Process.sleep(100)
+
+        :ok = Sqlite3.reset(select)
+        :ok = Sqlite3.execute(reader, "COMMIT")
+
+        assert :ok = Task.await(commit, 4_000)
+        assert :ok = Task.await(read, 4_000)
+
+        Enum.each([reader, writer, blocked], &Sqlite3.close/1)
+      end)
+    end
+
+    test "cancel/1 wakes a waiter" do
+      with_file_db(fn path ->
+        {:ok, db1} = Sqlite3.open(path)
+        {:ok, db2} = Sqlite3.open(path)
+
+        :ok = Sqlite3.execute(db1, "PRAGMA journal_mode=WAL")
+        :ok = Sqlite3.set_busy_timeout(db2, 10_000)
+        :ok = Sqlite3.execute(db1, "BEGIN IMMEDIATE")
+
+        task = Task.async(fn -> Sqlite3.execute(db2, "BEGIN IMMEDIATE") end)
+        Process.sleep(100)
+
+        :ok = Sqlite3.cancel(db2)
+        assert {:error, _reason} = Task.await(task, 1000)
+
+        Sqlite3.execute(db1, "ROLLBACK")
+        Sqlite3.close(db1)
+        Sqlite3.close(db2)
+      end)
+    end
+  end
+
+  describe ".allocator_stats/0" do
+    test "reports the allocator in use" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.execute(conn, "create table t (i integer)")
+
+      {:ok, stats} = Sqlite3.allocator_stats()
+
+      case stats do
+        %{allocator: :default} ->
+          assert stats.classes == []
+
+        %{allocator: :pool} ->
+          sizes = Enum.map(stats.classes, & &1.size)
+          assert sizes == Enum.sort(sizes)
+          assert Enum.any?(stats.classes, &(&1.allocations > 0))
+          assert Enum.all?(stats.classes, &(&1.high_water >= &1.in_use))
+      end
+
+      :ok = Sqlite3.close(conn)
+    end
+
+    test "keeps consistent counters while connections run in parallel" do
+      counts =
+        1..System.schedulers_online()
+        |> Task.async_stream(fn i ->
+          {:ok, conn} = Sqlite3.open(":memory:")
+          :ok = Sqlite3.execute(conn, "create table t (i integer, s text)")
+
+          :ok =
+            Sqlite3.execute(conn, """
+            with recursive r(i) as (values(1) union all select i + 1 from r limit 2000)
+            insert into t select i, printf('row %d of %d', i, #{i}) from r
+            """)
+
+          {:ok, statement} = Sqlite3.prepare(conn, "select i, s from t")
+          {:ok, rows} = Sqlite3.fetch_all(conn, statement)
+          :ok = Sqlite3.close(conn)
+          length(rows)
+        end)
+        |> Enum.map(fn {:ok, count} -> count end)
+
+      assert Enum.all?(counts, &(&1 == 2000))
+
+      {:ok, stats} = Sqlite3.allocator_stats()
+
+      for class <- stats.classes do
+        assert class.reused <= class.allocations
+        assert class.in_use <= class.high_water
+      end
+    end
+  end
+
+  describe ".db_status/1" do
+    test "reports the counters of the connection" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.execute(conn, "create table t (i integer)")
+      :ok = Sqlite3.execute(conn, "insert into t values (1)")
+
+      {:ok, statement} = Sqlite3.prepare(conn, "select * from t")
+      assert {:ok, status} = Sqlite3.db_status(conn)
+
+      assert status.cache_used > 0
+      assert status.schema_used > 0
+      assert status.stmt_used > 0
+      assert status.deferred_fks == 0
+      assert status.lookaside_used_highwater >= status.lookaside_used
+
+      :ok = Sqlite3.release(conn, statement)
+      :ok = Sqlite3.close(conn)
+    end
+
+    test "returns an error once the connection is closed" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.close(conn)
+
+      assert {:error, :connection_closed} = Sqlite3.db_status(conn)
+    end
+  end
+
+  describe ".stmt_status/2" do
+    test "counts full scans, sorts and automatic indexes" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.execute(conn, "create table a (id integer primary key, x integer)")
+      :ok = Sqlite3.execute(conn, "create table b (id integer primary key, x integer)")
+      {:ok, insert_a} = Sqlite3.prepare(conn, "insert into a (x) values (?)")
+      {:ok, insert_b} = Sqlite3.prepare(conn, "insert into b (x) values (?)")
+      rows = for i <- 1..100, do: [i]
+      {:ok, 100} = Sqlite3.execute_many(conn, insert_a, rows)
+      {:ok, 100} = Sqlite3.execute_many(conn, insert_b, rows)
+
+      {:ok, scan} = Sqlite3.prepare(conn, "select * from a where x > 50 order by x")
+      {:ok, rows} = Sqlite3.fetch_all(conn, scan)
+      assert length(rows) == 50
+
+      {:ok, status} = Sqlite3.stmt_status(scan)
+      assert status.fullscan_step > 0
+      assert status.sort == 1
+      assert status.vm_step > 0
+      assert status.memused > 0
+
+      {:ok, join} = Sqlite3.prepare(conn, "select * from a join b on a.x = b.x")
+      {:ok, rows} = Sqlite3.fetch_all(conn, join)
+      assert length(rows) == 100
+
+      {:ok, status} = Sqlite3.stmt_status(join)
+      assert status.autoindex > 0
+    end
+
+    test "resets the counters" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      :ok = Sqlite3.execute(conn, "create table t (i integer)")
+      :ok = Sqlite3.execute(conn, "insert into t values (1), (2), (3)")
+
+      {:ok, statement} = Sqlite3.prepare(conn, "select * from t")
+      {:ok, _rows} = Sqlite3.fetch_all(conn, statement)
+
+      {:ok, %{fullscan_step: steps}} = Sqlite3.stmt_status(statement, true)
+      assert steps > 0
+
+      assert {:ok, %{fullscan_step: 0, vm_step: 0}} = Sqlite3.stmt_status(statement)
+    end
+
+    test "returns an error for a released statement" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+      {:ok, statement} = Sqlite3.prepare(conn, "select 1")
+      :ok = Sqlite3.release(conn, statement)
+
+      assert {:error, :invalid_statement} = Sqlite3.stmt_status(statement)
+    end
+  end
+
+  describe ".status/0" do
+    test "reports the memory held by SQLite" do
+      {:ok, conn} = Sqlite3.open(":memory:")
+
+      assert {:ok, status} = Sqlite3.status()
+      assert status.memory_used > 0
+      assert status.memory_used_highwater >= status.memory_used
+      assert status.malloc_count_highwater >= status.malloc_count
+
+      :ok = Sqlite3.close(conn)
+    end
+  end
+
+  describe ".snapshot_get/1" do
+    setup do
+      {:ok, path} = Temp.path()
+      {:ok, writer} = Sqlite3.open(path)
+      :ok = Sqlite3.execute(writer, "PRAGMA journal_mode = WAL")
+      :ok = Sqlite3.execute(writer, "create table t (i integer)")
+      :ok = Sqlite3.execute(writer, "insert into t values (1)")
+
+      on_exit(fn ->
+        Sqlite3.close(writer)
+        File.rm(path)
+        File.rm(path <> "-wal")
+        File.rm(path <> "-shm")
+      end)
+
+      [path: path, writer: writer]
+    end
+
+    test "readers opening a snapshot see the state it recorded", context do
+      {:ok, conn} = Sqlite3.open(context.path)
+      :ok = Sqlite3.execute(conn, "BEGIN")
+      {:ok, snapshot} = Sqlite3.snapshot_get(conn)
+
+      :ok = Sqlite3.execute(context.writer, "insert into t values (2)")
+
+      counts =
+        1..2
+        |> Enum.map(fn _ ->
+          Task.async(fn ->
+            {:ok, reader} = Sqlite3.open(context.path)
+            :ok = Sqlite3.execute(reader, "PRAGMA application_id")
+            :ok = Sqlite3.execute(reader, "BEGIN")
+            :ok = Sqlite3.snapshot_open(reader, snapshot)
+            {:ok, statement} = Sqlite3.prepare(reader, "select count(*) from t")
+            {:row, [count]} = Sqlite3.step(reader, statement)
+            :ok = Sqlite3.release(reader, statement)
+            :ok = Sqlite3.execute(reader, "COMMIT")
+            :ok = Sqlite3.close(reader)
+            count
+          end)
+        end)
+        |> Task.await_many()
+
+      assert counts == [1, 1]
+
+      :ok = Sqlite3.execute(conn, "COMMIT")
+      :ok = Sqlite3.close(conn)
+    end
+
+    test "requires a transaction", context do
+      assert {:error, _reason} = Sqlite3.snapshot_get(context.writer)
+    end
+
+    test "a freed snapshot cannot be opened", context do
+      :ok = Sqlite3.execute(context.writer, "BEGIN")
+      {:ok, snapshot} = Sqlite3.snapshot_get(context.writer)
+      :ok = Sqlite3.execute(context.writer, "COMMIT")
+
+      :ok = Sqlite3.snapshot_free(snapshot)
+      :ok = Sqlite3.snapshot_free(snapshot)
+
+      :ok = Sqlite3.execute(context.writer, "BEGIN")
+      assert {:error, :invalid_snapshot} =
+               Sqlite3.snapshot_open(context.writer, snapshot)
+
+      :ok = Sqlite3.execute(context.writer, "COMMIT")
+    end
+  end
 end
@@ -0,0 +1,50 @@
+defmodule Exqlite.StatementCacheTest do
+  use ExUnit.Case
+
+  alias Exqlite.StatementCache
+
+  test "new/1 disables the cache for non-positive sizes" do
+    assert StatementCache.new(0) == nil
+    assert StatementCache.new(nil) == nil
+    assert %StatementCache{size: 3} = StatementCache.new(3)
+  end
+
+  test "fetch/2 returns cached statements" do
+    cache = StatementCache.new(2)
+    ref = make_ref()
+
+    assert :error = StatementCache.fetch(cache, "select 1")
+
+    {cache, []} = StatementCache.put(cache, "select 1", ref)
+
+    assert {:ok, ^ref, _cache} = StatementCache.fetch(cache, "select 1")
+    assert StatementCache.cached?(cache, "select 1", ref)
+    refute StatementCache.cached?(cache, "select 1", make_ref())
+  end
+
+  test "put/3 evicts the least recently used statement" do
+    [ref1, ref2, ref3] = [make_ref(), make_ref(), make_ref()]
+
+    cache = StatementCache.new(2)
+    {cache, []} = StatementCache.put(cache, "select 1", ref1)
+    {cache, []} = StatementCache.put(cache, "select 2", ref2)
+    {:ok, ^ref1, cache} = StatementCache.fetch(cache, "select 1")
+    {cache, [^ref2]} = StatementCache.put(cache, "select 3", ref3)
+
+    assert {:ok, ^ref1, _cache} = StatementCache.fetch(cache, "select 1")
+    assert {:ok, ^ref3, _cache} = StatementCache.fetch(cache, "select 3")
+    assert :error = StatementCache.fetch(cache, "select 2")
+  end
+
+  test "clear/1 returns every cached statement" do
+    [ref1, ref2] = [make_ref(), make_ref()]
+
+    cache = StatementCache.new(2)
+    {cache, []} = StatementCache.put(cache, "select 1", ref1)
+    {cache, []} = StatementCache.put(cache, "select 2", ref2)
+    {cache, refs} = StatementCache.clear(cache)
+
+    assert Enum.sort(refs) == Enum.sort([ref1, ref2])
+    assert :error = StatementCache.fetch(cache, "select 1")
+  end
+end
@@ -0,0 +1,110 @@
+defmodule Exqlite.WALPoolTest do
+  use ExUnit.Case
+
+  alias Exqlite.WALPool
+
+  setup do
+    path = Temp.path!()
+    name = :"#{__MODULE__}.Pool#{System.unique_integer([:positive])}"
+
+    start_supervised!({WALPool, name: name, database: path, readers: 2})
+
+    WALPool.query!(name, "create table test (id integer primary key, stuff text)")
+
+    on_exit(fn ->
+      File.rm(path)
+      File.rm(path <> "-wal")
+      File.rm(path <> "-shm")
+    end)
+
+    [pool: name]
+  end
+
+  describe ".readonly?/2" do
+    test "routes by the prepared statement", %{pool: pool} do
+      assert WALPool.readonly?(pool, "select * from test")
+      refute WALPool.readonly?(pool, "insert into test (stuff) values ('a')")
+      refute WALPool.readonly?(pool, "begin immediate")
+      refute WALPool.readonly?(pool, "  COMMIT")
+      refute WALPool.readonly?(pool, "select * from missing")
+    end
+
+    test "routes PRAGMA statements to the writer", %{pool: pool} do
+      refute WALPool.readonly?(pool, "pragma user_version")
+      refute WALPool.readonly?(pool, "  PRAGMA foreign_keys = ON")
+
+      assert {:ok, %{rows: [["wal"]]}} = WALPool.query(pool, "pragma journal_mode")
+    end
+
+    test "evicts single classifications once the cache is full", %{pool: pool} do
+      table = WALPool.Router.table(pool)
+      assert WALPool.readonly?(pool, "select * from test")
+
+      for i <- 1..1100 do
+        assert WALPool.readonly?(pool, "select #{i} from test")
+      end
+
+      assert :ets.info(table, :size) <= 1026
+      assert [{:db, _db}] = :ets.lookup(table, :db)
+      assert WALPool.readonly?(pool, "select * from test")
+    end
+  end
+
+  describe ".query/4" do
+    test "reads see committed writes", %{pool: pool} do
+      assert {:ok, %{num_rows: 1}} =
+               WALPool.query(pool, "insert into test (stuff) values (?)", ["a"])
+
+      assert {:ok, %{rows: [[1, "a"]]}} = WALPool.query(pool, "select * from test")
+    end
+
+    test "readers reject writes", %{pool: pool} do
+      assert {:error, %Exqlite.Error{message: message}} =
+               DBConnection.prepare_execute(
+                 WALPool.reader(pool),
+                 %Exqlite.Query{statement: "insert into test (stuff) values ('a')"},
+                 []
+               )
+
+      assert message =~ "readonly"
+    end
+
+    test "returns errors from the writer", %{pool: pool} do
+      assert {:error, %Exqlite.Error{message: "no such table: missing"}} =
+               WALPool.query(pool, "select * from missing")
+    end
+  end
+
+  describe ".transaction/3" do
+    test "runs every query on the writer", %{pool: pool} do
+      assert {:ok, [[1, "a"]]} =
+               WALPool.transaction(pool, fn conn ->
+                 WALPool.query!(conn, "insert into test (stuff) values ('a')")
+                 WALPool.query!(conn, "select * from test").rows
+               end)
+    end
+
+    test "readers do not see uncommitted writes", %{pool: pool} do
+      parent = self()
+
+      task =
+        Task.async(fn ->
+          WALPool.transaction(pool, fn conn ->
+            WALPool.query!(conn, "insert into test (stuff) values ('a')")
+            send(parent, :inserted)
+
+            receive do
+              :done -> :ok
+            end
+          end)
+        end)
+
+      assert_receive :inserted
+      assert {:ok, %{rows: []}} = WALPool.query(pool, "select * from test")
+
+      send(task.pid, :done)
+      assert {:ok, :ok} = Task.await(task)
+      assert {:ok, %{rows: [[1, "a"]]}} = WALPool.query(pool, "select * from test")
+    end
+  end
+end
@@ -0,0 +1,135 @@
+defmodule Exqlite.WriteBatcherTest do
+  use ExUnit.Case
+
+  alias Exqlite.Sqlite3
+  alias Exqlite.WriteBatcher
+
+  setup do
+    path = Temp.path!()
+
+    {:ok, db} = Sqlite3.open(path)
+    :ok = Sqlite3.execute(db, "create table test (id integer primary key, stuff text)")
+    :ok = Sqlite3.close(db)
+
+    on_exit(fn -> File.rm(path) end)
+
+    [path: path]
+  end
+
+  test "commits concurrent writes in one batch", %{path: path} do
+    batcher =
+      start_supervised!(
+        {WriteBatcher, database: path, max_latency: 60_000, max_batch: 20}
+      )
+
+    # Savepoints are committed too, the transaction commit has no options.
+    :erlang.trace_pattern({Exqlite.Connection, :handle_commit, 2}, true, [])
+    :erlang.trace(batcher, true, [:call])
+
+    on_exit(fn ->
+      :erlang.trace_pattern({Exqlite.Connection, :handle_commit, 2}, false, [])
+    end)
+
+    results =
+      1..20
+      |> Enum.map(fn i ->
+        Task.async(fn ->
+          WriteBatcher.query(batcher, "insert into test (id) values (?)", [i])
+        end)
+      end)
+      |> Task.await_many()
+
+    assert Enum.all?(results, &match?({:ok, %Exqlite.Result{num_rows: 1}}, &1))
+
+    ref = :erlang.trace_delivered(batcher)
+    assert_receive {:trace_delivered, ^batcher, ^ref}
+
+    commits = collect_commits(batcher)
+    assert length(commits) == 1
+
+    {:ok, db} = Sqlite3.open(path)
+    {:ok, statement} = Sqlite3.prepare(db, "select count(*) from test")
+    assert {:row, [20]} = Sqlite3.step(db, statement)
+  end
+
+  test "a failing write only fails its own caller", %{path: path} do
+    batcher =
+      start_supervised!(
+        {WriteBatcher, database: path, max_latency: 60_000, max_batch: 3}
+      )
+
+    [first, duplicate, last] =
+      [1, 1, 2]
+      |> Enum.with_index()
+      |> Enum.map(fn {id, queued} ->
+        # Keep the submission order stable so the duplicate is the one to fail.
+        await_queued(batcher, queued)
+
+        Task.async(fn ->
+          WriteBatcher.query(batcher, "insert into test (id) values (?)", [id])
+        end)
+      end)
+      |> Task.await_many()
+
+    assert {:ok, _result} = first
+    assert {:error, %Exqlite.Error{message: message}} = duplicate
+    assert message =~ "UNIQUE constraint failed"
+    assert {:ok, _result} = last
+
+    {:ok, db} = Sqlite3.open(path)
+    {:ok, statement} = Sqlite3.prepare(db, "select id from test order by id")
+    assert {:ok, [[1], [2]]} = Sqlite3.fetch_all(db, statement)
+  end
+
+  test "flushes once max_batch writes are queued", %{path: path} do
+    batcher =
+      start_supervised!(
+        {WriteBatcher, database: path, max_latency: 60_000, max_batch: 2}
+      )
+
+    tasks =
+      for id <- [1, 2] do
+        Task.async(fn ->
+          WriteBatcher.query(batcher, "insert into test (id) values (?)", [id])
+        end)
+      end
+
+    assert [{:ok, _}, {:ok, _}] = Task.await_many(tasks, 1000)
+  end
+
+  test "reconnects after the connection has to be disconnected", %{path: path} do
+    batcher = start_supervised!({WriteBatcher, database: path, busy_timeout: 0})
+
+    {:ok, db} = Sqlite3.open(path)
+    :ok = Sqlite3.execute(db, "begin immediate")
+
+    assert {:error, %Exqlite.Error{message: message}} =
+             WriteBatcher.query(batcher, "insert into test (id) values (?)", [1])
+
+    assert message =~ "locked"
+
+    :ok = Sqlite3.execute(db, "rollback")
+    :ok = Sqlite3.close(db)
+
+    assert {:ok, %Exqlite.Result{num_rows: 1}} =
+             WriteBatcher.query(batcher, "insert into test (id) values (?)", [1])
+
+    assert Process.alive?(batcher)
+  end
+
+  defp collect_commits(batcher) do
+    receive do
+      {:trace, ^batcher, :call, {Exqlite.Connection, :handle_commit, [[], _conn]}} ->
+        [:commit | collect_commits(batcher)]
+
+      {:trace, ^batcher, :call, _call} ->
+        collect_commits(batcher)
+    after
+      0 -> []
+    end
+  end
+
+  defp await_queued(batcher, count) do
+    if :sys.get_state(batcher).queued < count, do: await_queued(batcher, count)
+  end
+end